@@ -0,0 +1,327 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "CaptureAnalysis.h"
+#include "PcapReader.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+static const double ReportedPercentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+// Log-linear histogram: values below 16 exactly, larger ones in 16 buckets per power of two
+static const int HistogramSubBits = 4;
+static const size_t HistogramBuckets = (64 - HistogramSubBits + 1) << HistogramSubBits;
+
+static int HighestBit(uint64_t value)
+{
+    int bit = 0;
+    for (int step = 32; step > 0; step /= 2) {
+        if (value >> (bit + step)) {
+            bit += step;
+        }
+    }
+    return bit;
+}
+
+static void AddToHistogram(vector<uint64_t>& histogram, uint64_t value)
+{
+    if (value < (1 << HistogramSubBits)) {
+        histogram[(size_t)value]++;
+        return;
+    }
+    int shift = HighestBit(value) - HistogramSubBits;
+    histogram[((size_t)(shift + 1) << HistogramSubBits) + (size_t)((value >> shift) & ((1 << HistogramSubBits) - 1))]++;
+}
+
+// Largest value of the bucket below which the given percent of the values are
+static uint64_t HistogramPercentile(const vector<uint64_t>& histogram, uint64_t count, double percent)
+{
+    uint64_t position = (uint64_t)((count - 1) * percent / 100.0);
+    uint64_t below = 0;
+    size_t bucket = 0;
+    while (bucket + 1 < histogram.size() && below + histogram[bucket] <= position) {
+        below += histogram[bucket];
+        bucket++;
+    }
+    if (bucket < (1 << HistogramSubBits)) {
+        return bucket;
+    }
+    int shift = (int)(bucket >> HistogramSubBits) - 1;
+    uint64_t first = ((uint64_t)(bucket & ((1 << HistogramSubBits) - 1)) | (1 << HistogramSubBits)) << shift;
+    return first + ((uint64_t)1 << shift) - 1;
+}
+
+CaptureAnalysis::CaptureAnalysis(void)
+{
+    Start(false, MinTrackedPackets);
+}
+
+CaptureAnalysis::~CaptureAnalysis(void)
+{
+}
+
+uint64_t CaptureAnalysis::Memory(size_t trackedPackets)
+{
+    // The newest keys and the tails per tracked packet, the newest keys grow by a chunk
+    // while it is merged into them, which also needs its sorted copy and Fenwick tree
+    uint64_t chunkPackets = min(trackedPackets, (size_t)ChunkPackets);
+    return (uint64_t)trackedPackets * 2 * sizeof(uint64_t) + chunkPackets * 4 * sizeof(uint64_t);
+}
+
+size_t CaptureAnalysis::TrackedPackets(uint64_t bytes)
+{
+    uint64_t packets = bytes / (6 * sizeof(uint64_t));
+    if (packets > ChunkPackets) {
+        packets = (bytes - ChunkPackets * 4 * sizeof(uint64_t)) / (2 * sizeof(uint64_t));
+    }
+    return (size_t)max(packets, (uint64_t)MinTrackedPackets);
+}
+
+void CaptureAnalysis::Start(bool nanoseconds, size_t trackedPackets)
+{
+    this->nanoseconds = nanoseconds;
+    this->trackedPackets = max(trackedPackets, (size_t)1);
+    chunkPackets = min(this->trackedPackets, (size_t)ChunkPackets);
+    chunk.clear();
+    chunk.reserve(chunkPackets);
+    newestKeys.clear();
+    newestKeys.reserve(this->trackedPackets + chunkPackets);
+    tails.clear();
+    tailsDropped = false;
+    inOrderPackets = 0;
+    packetCount = 0;
+    lastKey = 0;
+    newestKey = 0;
+    maxTimeDisplacement = 0;
+    maxPacketDisplacement = 0;
+    untrackedPackets = 0;
+    timeHistogram.assign(HistogramBuckets, 0);
+    packetHistogram.assign(HistogramBuckets, 0);
+    interfaces.clear();
+    for (RunType& run : longestRuns) {
+        run = { 0, 0 };
+    }
+    currentRun = { 0, 0 };
+    runCount = 0;
+}
+
+uint64_t CaptureAnalysis::KeyToNanoseconds(uint64_t key) const
+{
+    return (key >> 32) * 1000000000 + (key & 0xFFFFFFFF) * (nanoseconds ? 1 : 1000);
+}
+
+void CaptureAnalysis::EndRun()
+{
+    if (currentRun.length == 0) {
+        return;
+    }
+    runCount++;
+
+    // The longest runs, longest first
+    for (size_t i = 0; i < ReportedRuns; i++) {
+        if (currentRun.length > longestRuns[i].length) {
+            for (size_t j = ReportedRuns - 1; j > i; j--) {
+                longestRuns[j] = longestRuns[j - 1];
+            }
+            longestRuns[i] = currentRun;
+            break;
+        }
+    }
+}
+
+void CaptureAnalysis::EndChunk()
+{
+    if (chunk.empty()) {
+        return;
+    }
+
+    // Packets newer than it before each packet: those of the chunk by a Fenwick tree over
+    // the ranks in the sorted chunk, those before the chunk among the newest keys. If all
+    // of the newest keys are newer, older ones may be as well and the count is a lower bound.
+    sortedChunk.assign(chunk.begin(), chunk.end());
+    sort(sortedChunk.begin(), sortedChunk.end());
+    tree.assign(chunk.size() + 1, 0);
+    for (size_t i = 0; i < chunk.size(); i++) {
+        size_t rank = (lower_bound(sortedChunk.begin(), sortedChunk.end(), chunk[i]) - sortedChunk.begin()) + 1;
+        uint64_t notNewer = 0;
+        for (size_t node = rank; node > 0; node -= node & (~node + 1)) {
+            notNewer += tree[node];
+        }
+        for (size_t node = rank; node <= chunk.size(); node += node & (~node + 1)) {
+            tree[node]++;
+        }
+
+        uint64_t newerBefore = newestKeys.end() - upper_bound(newestKeys.begin(), newestKeys.end(), chunk[i]);
+        if (newerBefore == trackedPackets) {
+            untrackedPackets++;
+        }
+        uint64_t displacement = i - notNewer + newerBefore;
+        AddToHistogram(packetHistogram, displacement);
+        maxPacketDisplacement = max(maxPacketDisplacement, displacement);
+    }
+
+    // Merge the chunk into the newest keys from the back and keep the newest of them
+    size_t keyCount = newestKeys.size();
+    size_t chunkCount = sortedChunk.size();
+    newestKeys.resize(keyCount + chunkCount);
+    for (size_t out = keyCount + chunkCount; chunkCount > 0; ) {
+        if (keyCount > 0 && newestKeys[keyCount - 1] > sortedChunk[chunkCount - 1]) {
+            newestKeys[--out] = newestKeys[--keyCount];
+        }
+        else {
+            newestKeys[--out] = sortedChunk[--chunkCount];
+        }
+    }
+    if (newestKeys.size() > trackedPackets) {
+        newestKeys.erase(newestKeys.begin(), newestKeys.end() - trackedPackets);
+    }
+    chunk.clear();
+}
+
+void CaptureAnalysis::Add(const PacketBatch& batch)
+{
+    for (size_t i = 0; i < batch.headers.size(); i++) {
+        const PcapPacketHeaderType& header = batch.headers[i];
+        uint64_t key = PacketSortKey(header);
+
+        // A run ends at the first packet which is older than its predecessor
+        if (packetCount > 0 && key < lastKey) {
+            EndRun();
+            currentRun = { packetCount, 0 };
+        }
+        currentRun.length++;
+        lastKey = key;
+
+        // Time behind the newest packet before it
+        newestKey = max(newestKey, key);
+        uint64_t displacement = KeyToNanoseconds(newestKey) - KeyToNanoseconds(key);
+        AddToHistogram(timeHistogram, displacement);
+        maxTimeDisplacement = max(maxTimeDisplacement, displacement);
+
+        // Longest in-order subsequence by patience sorting. Only the tails of the tracked
+        // longest lengths are kept, a packet older than all of them is left out.
+        if (tails.empty() || key >= tails.back()) {
+            tails.push_back(key);
+            inOrderPackets++;
+            if (tails.size() > trackedPackets) {
+                tails.pop_front();
+                tailsDropped = true;
+            }
+        }
+        else if (key >= tails.front() || !tailsDropped) {
+            *upper_bound(tails.begin(), tails.end(), key) = key;
+        }
+
+        packetCount++;
+        chunk.push_back(key);
+        if (chunk.size() >= chunkPackets) {
+            EndChunk();
+        }
+
+        uint32_t interfaceId = batch.interfaceIds[i];
+        if (interfaceId >= interfaces.size()) {
+            interfaces.resize(interfaceId + 1, { 0, 0, UINT64_MAX, 0 });
+        }
+        InterfaceStatisticsType& statistics = interfaces[interfaceId];
+        statistics.packets++;
+        statistics.bytes += header.originalLength;
+        statistics.firstKey = min(statistics.firstKey, key);
+        statistics.lastKey = max(statistics.lastKey, key);
+    }
+}
+
+static string Milliseconds(uint64_t nanoseconds)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f ms", nanoseconds / 1000000.0);
+    return text;
+}
+
+size_t CaptureAnalysis::Report(const char* name, PcapReader* pcapReader)
+{
+    EndChunk();
+    EndRun();
+
+    Logger::GetLogger().Log(LL_INFO, "Analysis of ", name);
+    Logger::GetLogger().Log(LL_INFO, (string("  Packets: ") + to_string(packetCount)).c_str());
+    if (packetCount == 0) {
+        return 1;
+    }
+
+    string line = "  Displacement in time:";
+    for (double percent : ReportedPercentiles) {
+        char label[16];
+        snprintf(label, sizeof(label), " p%g ", percent);
+        line += label + Milliseconds(min(maxTimeDisplacement, HistogramPercentile(timeHistogram, packetCount, percent))) + ",";
+    }
+    line += " max " + Milliseconds(maxTimeDisplacement);
+    Logger::GetLogger().Log(LL_INFO, line.c_str());
+
+    // All but the longest in-order subsequence, the fewest packets which must be moved
+    uint64_t reorderedPackets = packetCount - inOrderPackets;
+    char percentText[32];
+    snprintf(percentText, sizeof(percentText), " (%.2f %%)", reorderedPackets * 100.0 / packetCount);
+    Logger::GetLogger().Log(LL_INFO, (string("  Packets to reorder: ") + to_string(reorderedPackets) + percentText).c_str());
+
+    line = "  Displacement in packets:";
+    for (double percent : ReportedPercentiles) {
+        char label[16];
+        snprintf(label, sizeof(label), " p%g ", percent);
+        line += label + to_string(min(maxPacketDisplacement, HistogramPercentile(packetHistogram, packetCount, percent))) + ",";
+    }
+    line += " max " + to_string(maxPacketDisplacement);
+    Logger::GetLogger().Log(LL_INFO, line.c_str());
+    if (untrackedPackets > 0) {
+        Logger::GetLogger().Log(LL_WARNING, (string("  Packets displaced further than the ") + to_string(trackedPackets) + string(" tracked ones, counted as lower bounds: ") + to_string(untrackedPackets)).c_str());
+    }
+
+    line = string("  In-order runs: ") + to_string(runCount) + ", longest";
+    for (const RunType& run : longestRuns) {
+        if (run.length > 0) {
+            line += string(" ") + to_string(run.length) + " (from packet " + to_string(run.first) + ")";
+        }
+    }
+    Logger::GetLogger().Log(LL_INFO, line.c_str());
+
+    for (size_t i = 0; i < interfaces.size(); i++) {
+        const InterfaceStatisticsType& statistics = interfaces[i];
+        if (statistics.packets == 0) {
+            continue;
+        }
+
+        PcapInterfaceType interface;
+        pcapReader->GetInterface((uint32_t)i, &interface);
+        double seconds = (KeyToNanoseconds(statistics.lastKey) - KeyToNanoseconds(statistics.firstKey)) / 1000000000.0;
+        char rates[128];
+        snprintf(rates, sizeof(rates), " packets, %.1f MB in %.3f s: %.0f packets/s, %.3f Mbit/s", statistics.bytes / 1000000.0, seconds,
+            (seconds > 0) ? statistics.packets / seconds : 0.0, (seconds > 0) ? statistics.bytes * 8 / seconds / 1000000.0 : 0.0);
+        Logger::GetLogger().Log(LL_INFO, (string("  Interface ") + to_string(i) + " (link type " + to_string(interface.linkType) + "): " + to_string(statistics.packets) + rates).c_str());
+    }
+
+    // A packet leaves the window once SORT_WINDOW packets are held, so all packets
+    // which are newer than it must still be held when it arrives
+    size_t sortWindowSize = (size_t)maxPacketDisplacement + 1;
+    if (untrackedPackets > 0) {
+        Logger::GetLogger().Log(LL_INFO, (string("  Smallest SORT_WINDOW for an exact output: more than ") + to_string(maxPacketDisplacement) + string(", use the sort mode exact or index")).c_str());
+    }
+    else {
+        Logger::GetLogger().Log(LL_INFO, (string("  Smallest SORT_WINDOW for an exact output: ") + to_string(sortWindowSize)).c_str());
+    }
+    return sortWindowSize;
+}
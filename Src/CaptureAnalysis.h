@@ -0,0 +1,101 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "PcapPacket.h"
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+class PcapReader;
+
+/**
+ * Disorder statistics of a capture, taken from its record headers only: how far
+ * packets are displaced from their sorted position in packets and in time, how many
+ * of them must be reordered, the longest in-order runs and the rates of the interfaces.
+ * The memory does not grow with the capture, see Memory(). Displacements of up to
+ * the tracked number of packets are exact, larger ones are counted as lower bounds.
+ * The percentiles come from histograms and are up to 1/16 too large.
+ */
+class CaptureAnalysis
+{
+private:
+    struct InterfaceStatisticsType {
+        uint64_t    packets;
+        uint64_t    bytes;      // Original length on the wire
+        uint64_t    firstKey;
+        uint64_t    lastKey;
+    };
+
+    struct RunType {
+        uint64_t    first;      // Number of the first packet
+        uint64_t    length;
+    };
+
+    static const size_t ReportedRuns = 3;
+    // Packets whose displacement is counted at once
+    static const size_t ChunkPackets = 1024 * 1024;
+
+    size_t trackedPackets;
+    size_t chunkPackets;
+    vector<uint64_t> chunk;         // Sort keys of the current chunk in the order of the input
+    vector<uint64_t> sortedChunk;
+    vector<uint64_t> tree;          // Fenwick tree over the ranks in the sorted chunk
+    vector<uint64_t> newestKeys;    // The trackedPackets newest keys before the chunk, ascending
+    deque<uint64_t> tails;          // Smallest last key of an in-order subsequence of each length
+    bool tailsDropped;
+    uint64_t inOrderPackets;        // Length of the longest in-order subsequence
+    uint64_t packetCount;
+    uint64_t lastKey;
+    uint64_t newestKey;
+    uint64_t maxTimeDisplacement;
+    uint64_t maxPacketDisplacement;
+    uint64_t untrackedPackets;      // Displaced by at least trackedPackets
+    vector<uint64_t> timeHistogram;
+    vector<uint64_t> packetHistogram;
+    vector<InterfaceStatisticsType> interfaces;
+    RunType longestRuns[ReportedRuns];
+    RunType currentRun;
+    uint64_t runCount;
+    bool nanoseconds;
+
+    uint64_t KeyToNanoseconds(uint64_t key) const;
+    void EndRun();
+    void EndChunk();
+
+public:
+    static const size_t DefaultTrackedPackets = 4 * 1024 * 1024;
+    static const size_t MinTrackedPackets = 64 * 1024;
+
+    CaptureAnalysis(void);
+    virtual ~CaptureAnalysis(void);
+
+    // Bytes held while the given number of packets are tracked, and the other way round
+    static uint64_t Memory(size_t trackedPackets);
+    static size_t TrackedPackets(uint64_t bytes);
+
+    // Timestamp fractions of the keys are nanoseconds instead of microseconds
+    void Start(bool nanoseconds, size_t trackedPackets);
+    void Add(const PacketBatch& batch);
+
+    // Logs the report and returns the smallest sort window which sorts the capture exactly
+    size_t Report(const char* name, PcapReader* pcapReader);
+};
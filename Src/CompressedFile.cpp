@@ -0,0 +1,906 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "CompressedFile.h"
+#include "Logger.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef PCAPSORTER_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef PCAPSORTER_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef PCAPSORTER_WITH_LZ4
+#include <lz4frame.h>
+#endif
+
+static const size_t SourceChunkSize = 1024 * 1024;
+static const size_t BlockSize = 1024 * 1024;
+static const size_t SequentialBlocks = 4;
+// Frames are decompressed as a whole, larger ones are left to a single stream
+static const uint64_t MaxParallelFrameLength = 64 * 1024 * 1024;
+static const size_t MaxZstdLanes = 4;
+// Bytes compressed into one independent frame of the output
+static const size_t FrameSize = 4 * 1024 * 1024;
+
+bool CompressedFile::IsSupported(CompressionType compression)
+{
+    switch (compression) {
+#ifdef PCAPSORTER_WITH_ZLIB
+    case CT_GZIP:
+        return true;
+#endif
+#ifdef PCAPSORTER_WITH_ZSTD
+    case CT_ZSTD:
+        return true;
+#endif
+#ifdef PCAPSORTER_WITH_LZ4
+    case CT_LZ4:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+bool CompressedFile::IsValidLevel(CompressionType compression, int level)
+{
+    switch (compression) {
+    case CT_GZIP:
+        return level >= 1 && level <= 9;
+    case CT_ZSTD:
+        return level >= 1 && level <= 22;
+    default:
+        return false;
+    }
+}
+
+int CompressedFile::DefaultLevel(CompressionType compression)
+{
+    return (compression == CT_GZIP) ? 6 : 3;
+}
+
+uint64_t CompressedFile::WriteMemory(unsigned int threadCount)
+{
+    // Every block holds a frame and its compressed copy, see Start
+    return (uint64_t)(max(threadCount, 1u) * 2 + 1) * FrameSize * 2;
+}
+
+CompressedFile::CompressedFile(void)
+{
+    compression = CT_NONE;
+    forWrite = false;
+    level = 0;
+    source = nullptr;
+    sourcePrefix = 0;
+    sourceSize = 0;
+    sourcePosition.store(0);
+    stopping.store(false);
+    failed.store(false);
+    isOpen = false;
+    lanes = 1;
+    producerLane = 0;
+    consumerLane = 0;
+    current = nullptr;
+    currentUsed = 0;
+    blocksSubmitted = 0;
+    blocksWritten.store(0);
+}
+
+CompressedFile::~CompressedFile(void)
+{
+    Close();
+}
+
+CompressedFile::CompressionType CompressedFile::Detect(const uint8_t* data, size_t length)
+{
+    static const uint8_t gzipMagic[] = { 0x1F, 0x8B };
+    static const uint8_t zstdMagic[] = { 0x28, 0xB5, 0x2F, 0xFD };
+    static const uint8_t lz4Magic[] = { 0x04, 0x22, 0x4D, 0x18 };
+
+    if (length >= sizeof(gzipMagic) && memcmp(data, gzipMagic, sizeof(gzipMagic)) == 0) {
+        return CT_GZIP;
+    }
+    if (length >= sizeof(zstdMagic) && memcmp(data, zstdMagic, sizeof(zstdMagic)) == 0) {
+        return CT_ZSTD;
+    }
+    if (length >= sizeof(lz4Magic) && memcmp(data, lz4Magic, sizeof(lz4Magic)) == 0) {
+        return CT_LZ4;
+    }
+    return CT_NONE;
+}
+
+const char* CompressedFile::Name(CompressionType compression)
+{
+    switch (compression) {
+    case CT_GZIP:
+        return "gzip";
+    case CT_ZSTD:
+        return "zstd";
+    case CT_LZ4:
+        return "LZ4";
+    default:
+        return "none";
+    }
+}
+
+const char* CompressedFile::Extension(CompressionType compression)
+{
+    switch (compression) {
+    case CT_GZIP:
+        return ".gz";
+    case CT_ZSTD:
+        return ".zst";
+    case CT_LZ4:
+        return ".lz4";
+    default:
+        return "";
+    }
+}
+
+int CompressedFile::Open(const char* fileName, CompressionType compression)
+{
+    Close();
+
+    if (!IsSupported(compression)) {
+        Logger::GetLogger().Log(LL_ERROR, "This build can not decompress the input. Missing support for ", Name(compression));
+        return -1;
+    }
+    if (mappedFile.Open(fileName) != 0) {
+        Logger::GetLogger().Log(LL_ERROR, "Can not map the compressed input file");
+        return -1;
+    }
+
+    this->compression = compression;
+    sourceSize = mappedFile.Size();
+    return Start((compression == CT_ZSTD) ? ParallelZstdLanes() : 1);
+}
+
+int CompressedFile::Open(istream* source, const uint8_t* prefix, size_t prefixLength, CompressionType compression)
+{
+    Close();
+
+    if (!IsSupported(compression)) {
+        Logger::GetLogger().Log(LL_ERROR, "This build can not decompress the input. Missing support for ", Name(compression));
+        return -1;
+    }
+
+    this->compression = compression;
+    this->source = source;
+    sourceBuffer.assign(prefix, prefix + prefixLength);
+    sourceBuffer.resize(max(prefixLength, SourceChunkSize));
+    sourcePrefix = prefixLength;
+    sourceSize = 0;
+    return Start(1);
+}
+
+int CompressedFile::OpenWrite(const char* fileName, CompressionType compression, int level, unsigned int threadCount, size_t bufferSize)
+{
+    Close();
+
+    if (!IsSupported(compression) || !IsValidLevel(compression, level)) {
+        Logger::GetLogger().Log(LL_ERROR, "This build can not compress the output as ", Name(compression));
+        return -1;
+    }
+    if (target.Open(fileName, bufferSize) != 0) {
+        return -1;
+    }
+
+    this->compression = compression;
+    this->level = level;
+    forWrite = true;
+    return Start((threadCount > 0) ? threadCount : 1);
+}
+
+int CompressedFile::Start(size_t lanes)
+{
+    size_t blockCount = forWrite ? lanes * 2 + 1 : ((lanes > 1) ? lanes * 2 : SequentialBlocks);
+
+    // Written frames are compressed by the pool, they wait for the writer thread in one ring
+    this->lanes = forWrite ? 1 : lanes;
+    producerLane = 0;
+    consumerLane = 0;
+    current = nullptr;
+    currentUsed = 0;
+    sourcePosition.store(0);
+    blocksSubmitted = 0;
+    blocksWritten.store(0);
+    stopping.store(false);
+    failed.store(false);
+
+    // Every block is always in exactly one ring or held by one thread, so no ring runs full
+    for (size_t i = 0; i < blockCount; i++) {
+        blocks.emplace_back();
+    }
+    freeBlocks.reset(new BlockRingType(blockCount));
+    for (BlockType& block : blocks) {
+        if (forWrite) {
+            block.data.resize(FrameSize);
+        }
+        else if (lanes == 1) {
+            block.data.resize(BlockSize);
+        }
+        freeBlocks->Push(&block);
+    }
+    for (size_t lane = 0; lane < this->lanes; lane++) {
+        pendingBlocks.emplace_back(new BlockRingType(blockCount));
+        doneBlocks.emplace_back(new BlockRingType(blockCount));
+    }
+
+    if (forWrite) {
+        producer = thread(&CompressedFile::WriteFrames, this);
+        isOpen = true;
+        return 0;
+    }
+
+    switch (compression) {
+    case CT_GZIP:
+        producer = thread(&CompressedFile::ProduceGzip, this);
+        break;
+    case CT_ZSTD:
+#ifdef PCAPSORTER_WITH_ZSTD
+        if (lanes > 1) {
+            Logger::GetLogger().Log(LL_DEBUG, "zstd frames are decompressed in parallel lanes: ", (int)lanes);
+            for (size_t lane = 0; lane < lanes; lane++) {
+                workers.push_back(thread(&CompressedFile::DecompressFrames, this, lane));
+            }
+            producer = thread(&CompressedFile::ProduceZstdFrames, this);
+            break;
+        }
+#endif
+        producer = thread(&CompressedFile::ProduceZstd, this);
+        break;
+    default:
+        producer = thread(&CompressedFile::ProduceLz4, this);
+        break;
+    }
+
+    isOpen = true;
+    return 0;
+}
+
+int CompressedFile::Close()
+{
+    int result = 0;
+
+    if (isOpen && forWrite) {
+        result = Flush();
+    }
+
+    stopping.store(true);
+    if (freeBlocks) {
+        freeBlocks->Wake();
+    }
+    for (unique_ptr<BlockRingType>& ring : pendingBlocks) {
+        ring->Wake();
+    }
+    for (unique_ptr<BlockRingType>& ring : doneBlocks) {
+        ring->Wake();
+    }
+    if (producer.joinable()) {
+        producer.join();
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+
+    pendingBlocks.clear();
+    doneBlocks.clear();
+    freeBlocks.reset();
+    blocks.clear();
+    mappedFile.Close();
+    source = nullptr;
+    sourceBuffer.clear();
+    sourcePrefix = 0;
+    sourceSize = 0;
+    current = nullptr;
+    isOpen = false;
+
+    if (forWrite && target.Close() != 0) {
+        result = -1;
+    }
+    forWrite = false;
+    return result;
+}
+
+size_t CompressedFile::Read(uint8_t* target, size_t length)
+{
+    size_t done = 0;
+
+    while (done < length) {
+        if (current == nullptr) {
+            current = doneBlocks[consumerLane]->Pop();
+            consumerLane = (consumerLane + 1) % lanes;
+            currentUsed = 0;
+            if (current->last && failed.load()) {
+                Logger::GetLogger().Log(LL_ERROR, "The compressed input is corrupt or truncated");
+            }
+        }
+        if (current->last) {
+            break;  // Kept, so every further read ends here as well
+        }
+
+        size_t count = min(length - done, current->length - currentUsed);
+        memcpy(target + done, current->data.data() + currentUsed, count);
+        done += count;
+        currentUsed += count;
+
+        if (currentUsed == current->length) {
+            freeBlocks->Push(current);
+            current = nullptr;
+        }
+    }
+    return done;
+}
+
+const uint8_t* CompressedFile::NextSource(size_t* length)
+{
+    uint64_t position = sourcePosition.load();
+
+    if (mappedFile.IsOpen()) {
+        *length = (size_t)min<uint64_t>(sourceSize - position, SourceChunkSize);
+        sourcePosition.store(position + *length);
+        return mappedFile.Data() + position;
+    }
+
+    if (sourcePrefix > 0) {
+        *length = sourcePrefix;
+        sourcePrefix = 0;
+    }
+    else {
+        source->read((char*)sourceBuffer.data(), sourceBuffer.size());
+        *length = (size_t)source->gcount();
+    }
+    sourcePosition.store(position + *length);
+    return sourceBuffer.data();
+}
+
+CompressedFile::BlockType* CompressedFile::NextFreeBlock()
+{
+    BlockType* block;
+    while (!freeBlocks->TryPop(block)) {
+        // The writing caller compresses queued frames meanwhile
+        if (forWrite && ThreadPool::GetThreadPool().RunPendingTask()) {
+            continue;
+        }
+        if (!freeBlocks->Pop(block, stopping)) {
+            return nullptr;
+        }
+        break;
+    }
+
+    block->length = 0;
+    block->frame = nullptr;
+    block->frameLength = 0;
+    block->last = false;
+    return block;
+}
+
+bool CompressedFile::Deliver(BlockType* block)
+{
+    // With workers the block goes through the one of its lane, the lanes keep the file order.
+    // Written blocks go to the writer thread, which waits until the pool compressed them.
+    bool viaWorker = forWrite || lanes > 1;
+    BlockRingType* ring = viaWorker ? pendingBlocks[producerLane].get() : doneBlocks[producerLane].get();
+    producerLane = (producerLane + 1) % lanes;
+
+    return ring->Push(block, stopping);
+}
+
+void CompressedFile::Finish(bool error)
+{
+    if (error) {
+        failed.store(true);
+    }
+
+    BlockType* block = NextFreeBlock();
+    if (block != nullptr) {
+        block->last = true;
+        Deliver(block);
+    }
+}
+
+// The decoders below leave a block once it is full. Output which the library still holds
+// (flushPending) is collected before further input is passed.
+
+void CompressedFile::ProduceGzip()
+{
+#ifdef PCAPSORTER_WITH_ZLIB
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {   // gzip or zlib header
+        Finish(true);
+        return;
+    }
+
+    BlockType* block = nullptr;
+    bool memberEnded = false;
+    bool flushPending = false;
+    bool error = false;
+
+    while (true) {
+        if (stream.avail_in == 0 && !flushPending) {
+            size_t length;
+            const uint8_t* data = NextSource(&length);
+            if (length == 0) {
+                break;
+            }
+            stream.next_in = (Bytef*)data;
+            stream.avail_in = (uInt)length;
+        }
+        if (block == nullptr && (block = NextFreeBlock()) == nullptr) {
+            inflateEnd(&stream);
+            return;
+        }
+
+        stream.next_out = block->data.data() + block->length;
+        stream.avail_out = (uInt)(block->data.size() - block->length);
+        int result = inflate(&stream, Z_NO_FLUSH);
+        block->length = block->data.size() - stream.avail_out;
+
+        if (result == Z_STREAM_END) {
+            // Further members follow if captures were compressed one by one and appended
+            memberEnded = true;
+            inflateReset(&stream);
+        }
+        else if (result == Z_OK) {
+            memberEnded = false;
+        }
+        else if (result != Z_BUF_ERROR) {
+            // Trailing garbage behind the last member is ignored like gzip does
+            error = !memberEnded;
+            break;
+        }
+        flushPending = (stream.avail_out == 0);
+
+        if (block->length == block->data.size()) {
+            if (!Deliver(block)) {
+                inflateEnd(&stream);
+                return;
+            }
+            block = nullptr;
+        }
+    }
+    inflateEnd(&stream);
+
+    if (block != nullptr && !Deliver(block)) {
+        return;
+    }
+    Finish(error || !memberEnded);
+#else
+    Finish(true);
+#endif
+}
+
+void CompressedFile::ProduceZstd()
+{
+#ifdef PCAPSORTER_WITH_ZSTD
+    ZSTD_DCtx* context = ZSTD_createDCtx();
+    ZSTD_inBuffer input = { nullptr, 0, 0 };
+    BlockType* block = nullptr;
+    bool frameEnded = false;
+    bool flushPending = false;
+    bool error = false;
+
+    while (true) {
+        if (input.pos == input.size && !flushPending) {
+            size_t length;
+            const uint8_t* data = NextSource(&length);
+            if (length == 0) {
+                break;
+            }
+            input.src = data;
+            input.size = length;
+            input.pos = 0;
+        }
+        if (block == nullptr && (block = NextFreeBlock()) == nullptr) {
+            ZSTD_freeDCtx(context);
+            return;
+        }
+
+        // Concatenated frames are decompressed one after the other
+        ZSTD_outBuffer output = { block->data.data(), block->data.size(), block->length };
+        size_t result = ZSTD_decompressStream(context, &output, &input);
+        block->length = output.pos;
+        if (ZSTD_isError(result)) {
+            error = true;
+            break;
+        }
+        frameEnded = (result == 0);
+        flushPending = (output.pos == output.size);
+
+        if (block->length == block->data.size()) {
+            if (!Deliver(block)) {
+                ZSTD_freeDCtx(context);
+                return;
+            }
+            block = nullptr;
+        }
+    }
+    ZSTD_freeDCtx(context);
+
+    if (block != nullptr && !Deliver(block)) {
+        return;
+    }
+    Finish(error || !frameEnded);
+#else
+    Finish(true);
+#endif
+}
+
+#ifdef PCAPSORTER_WITH_ZSTD
+static bool DecompressFrame(ZSTD_DCtx* context, const uint8_t* frame, size_t frameLength, vector<uint8_t>& data, size_t* length)
+{
+    unsigned long long contentSize = ZSTD_getFrameContentSize(frame, frameLength);
+    if (contentSize == ZSTD_CONTENTSIZE_ERROR) {
+        return false;
+    }
+
+    if (contentSize != ZSTD_CONTENTSIZE_UNKNOWN) {
+        if (data.size() < contentSize) {
+            data.resize((size_t)contentSize);
+        }
+        size_t result = ZSTD_decompressDCtx(context, data.data(), data.size(), frame, frameLength);
+        *length = ZSTD_isError(result) ? 0 : result;
+        return !ZSTD_isError(result);
+    }
+
+    // Without a content size the block grows while the frame is streamed
+    ZSTD_inBuffer input = { frame, frameLength, 0 };
+    ZSTD_DCtx_reset(context, ZSTD_reset_session_only);
+    *length = 0;
+    while (true) {
+        if (data.size() - *length < ZSTD_DStreamOutSize()) {
+            data.resize(max(data.size() * 2, *length + ZSTD_DStreamOutSize()));
+        }
+        ZSTD_outBuffer output = { data.data(), data.size(), *length };
+        size_t result = ZSTD_decompressStream(context, &output, &input);
+        *length = output.pos;
+        if (ZSTD_isError(result)) {
+            return false;
+        }
+        if (result == 0) {
+            return true;
+        }
+        if (input.pos == input.size && output.pos < output.size) {
+            return false;   // Truncated frame
+        }
+    }
+}
+#endif
+
+size_t CompressedFile::ParallelZstdLanes()
+{
+#ifdef PCAPSORTER_WITH_ZSTD
+    size_t workerCount = min<size_t>(thread::hardware_concurrency(), MaxZstdLanes);
+    if (workerCount < 2) {
+        return 1;
+    }
+
+    // Single frame files (the default of zstd) are streamed. Several frames of a known size
+    // can be decompressed independently.
+    size_t frameLength = ZSTD_findFrameCompressedSize(mappedFile.Data(), (size_t)sourceSize);
+    if (ZSTD_isError(frameLength) || frameLength >= sourceSize) {
+        return 1;
+    }
+    unsigned long long contentSize = ZSTD_getFrameContentSize(mappedFile.Data(), frameLength);
+    if (contentSize == ZSTD_CONTENTSIZE_UNKNOWN || contentSize == ZSTD_CONTENTSIZE_ERROR || contentSize > MaxParallelFrameLength) {
+        return 1;
+    }
+    return workerCount;
+#else
+    return 1;
+#endif
+}
+
+void CompressedFile::ProduceZstdFrames()
+{
+#ifdef PCAPSORTER_WITH_ZSTD
+    const uint8_t* data = mappedFile.Data();
+    uint64_t position = 0;
+
+    while (position < sourceSize) {
+        size_t frameLength = ZSTD_findFrameCompressedSize(data + position, (size_t)(sourceSize - position));
+        if (ZSTD_isError(frameLength)) {
+            Finish(true);
+            return;
+        }
+
+        BlockType* block = NextFreeBlock();
+        if (block == nullptr) {
+            return;
+        }
+        block->frame = data + position;
+        block->frameLength = frameLength;
+        if (!Deliver(block)) {
+            return;
+        }
+        position += frameLength;
+        sourcePosition.store(position);
+    }
+    Finish(false);
+#else
+    Finish(true);
+#endif
+}
+
+#ifdef PCAPSORTER_WITH_ZSTD
+void CompressedFile::DecompressFrames(size_t lane)
+{
+    ZSTD_DCtx* context = ZSTD_createDCtx();
+
+    while (true) {
+        BlockType* block;
+        if (!pendingBlocks[lane]->Pop(block, stopping)) {
+            break;
+        }
+
+        if (!block->last && !DecompressFrame(context, block->frame, block->frameLength, block->data, &block->length)) {
+            failed.store(true);
+            block->last = true;
+        }
+
+        bool last = block->last;
+        if (!doneBlocks[lane]->Push(block, stopping) || last) {
+            break;
+        }
+    }
+    ZSTD_freeDCtx(context);
+}
+#endif
+
+void CompressedFile::ProduceLz4()
+{
+#ifdef PCAPSORTER_WITH_LZ4
+    LZ4F_dctx* context;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&context, LZ4F_VERSION))) {
+        Finish(true);
+        return;
+    }
+
+    const uint8_t* input = nullptr;
+    size_t inputLength = 0;
+    BlockType* block = nullptr;
+    bool frameEnded = false;
+    bool flushPending = false;
+    bool error = false;
+
+    while (true) {
+        if (inputLength == 0 && !flushPending) {
+            input = NextSource(&inputLength);
+            if (inputLength == 0) {
+                break;
+            }
+        }
+        if (block == nullptr && (block = NextFreeBlock()) == nullptr) {
+            LZ4F_freeDecompressionContext(context);
+            return;
+        }
+
+        // Frames which follow each other are decompressed one after the other
+        size_t outputLength = block->data.size() - block->length;
+        size_t consumed = inputLength;
+        size_t hint = LZ4F_decompress(context, block->data.data() + block->length, &outputLength, input, &consumed, nullptr);
+        if (LZ4F_isError(hint)) {
+            error = true;
+            break;
+        }
+        input += consumed;
+        inputLength -= consumed;
+        block->length += outputLength;
+        frameEnded = (hint == 0);
+        flushPending = (block->length == block->data.size());
+
+        if (block->length == block->data.size()) {
+            if (!Deliver(block)) {
+                LZ4F_freeDecompressionContext(context);
+                return;
+            }
+            block = nullptr;
+        }
+    }
+    LZ4F_freeDecompressionContext(context);
+
+    if (block != nullptr && !Deliver(block)) {
+        return;
+    }
+    Finish(error || !frameEnded);
+#else
+    Finish(true);
+#endif
+}
+
+int CompressedFile::Write(const uint8_t* data, size_t length)
+{
+    while (length > 0) {
+        if (current == nullptr && (current = NextFreeBlock()) == nullptr) {
+            return -1;
+        }
+
+        size_t count = min(length, current->data.size() - current->length);
+        memcpy(current->data.data() + current->length, data, count);
+        current->length += count;
+        data += count;
+        length -= count;
+
+        if (current->length == current->data.size()) {
+            Submit();
+        }
+    }
+    return failed.load() ? -1 : 0;
+}
+
+uint8_t* CompressedFile::Reserve(size_t length)
+{
+    if (current != nullptr && current->length + length > current->data.size()) {
+        Submit();
+    }
+    if (current == nullptr) {
+        current = NextFreeBlock();
+    }
+
+    uint8_t* room = current->data.data() + current->length;
+    current->length += length;
+    return room;
+}
+
+// Frames are cut where a block is full, records continue in the next frame
+void CompressedFile::Submit()
+{
+    BlockType* block = current;
+
+    block->ready.store(false);
+    Deliver(block);
+    ThreadPool::GetThreadPool().Submit([this, block]() {
+        CompressFrame(block);
+    });
+    blocksSubmitted++;
+    current = nullptr;
+}
+
+int CompressedFile::Flush()
+{
+    if (current != nullptr && current->length > 0) {
+        Submit();
+    }
+    while (blocksWritten.load() < blocksSubmitted) {
+        // Frames which no worker took yet are compressed here, the others are waited for
+        if (!ThreadPool::GetThreadPool().RunPendingTask()) {
+            progress.Wait([this]() { return blocksWritten.load() >= blocksSubmitted; });
+        }
+    }
+
+    // The writer thread waits for frames now, the file can be used from here
+    if (target.Flush() != 0) {
+        failed.store(true);
+    }
+    return failed.load() ? -1 : 0;
+}
+
+#ifdef PCAPSORTER_WITH_ZLIB
+struct DeflateStreamType {
+    z_stream    stream;
+    int         level;      // 0 until initialized
+
+    DeflateStreamType() : level(0) {
+        memset(&stream, 0, sizeof(stream));
+    }
+    ~DeflateStreamType() {
+        if (level != 0) {
+            deflateEnd(&stream);
+        }
+    }
+};
+
+// Frames are compressed by any worker, so every thread keeps its own state for the next frame
+static z_stream* ThreadDeflateStream(int level)
+{
+    static thread_local DeflateStreamType deflater;
+
+    if (deflater.level != level) {
+        if (deflater.level != 0) {
+            deflateEnd(&deflater.stream);
+            memset(&deflater.stream, 0, sizeof(deflater.stream));
+            deflater.level = 0;
+        }
+        if (deflateInit2(&deflater.stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return nullptr;
+        }
+        deflater.level = level;
+    }
+    return &deflater.stream;
+}
+
+// One gzip member per frame
+static bool CompressGzip(z_stream* stream, const uint8_t* data, size_t length, vector<uint8_t>& compressed, size_t* compressedLength)
+{
+    deflateReset(stream);
+    compressed.resize(max(compressed.size(), (size_t)deflateBound(stream, (uLong)length)));
+
+    stream->next_in = (Bytef*)data;
+    stream->avail_in = (uInt)length;
+    stream->next_out = compressed.data();
+    stream->avail_out = (uInt)compressed.size();
+    int result = deflate(stream, Z_FINISH);
+    *compressedLength = compressed.size() - stream->avail_out;
+    return result == Z_STREAM_END;
+}
+#endif
+
+#ifdef PCAPSORTER_WITH_ZSTD
+static ZSTD_CCtx* ThreadZstdContext()
+{
+    static thread_local unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    return context.get();
+}
+
+// One zstd frame with its content size per frame, so readers can decompress them in parallel
+static bool CompressZstd(ZSTD_CCtx* context, int level, const uint8_t* data, size_t length, vector<uint8_t>& compressed, size_t* compressedLength)
+{
+    compressed.resize(max(compressed.size(), ZSTD_compressBound(length)));
+
+    size_t result = ZSTD_compressCCtx(context, compressed.data(), compressed.size(), data, length, level);
+    *compressedLength = ZSTD_isError(result) ? 0 : result;
+    return !ZSTD_isError(result);
+}
+#endif
+
+void CompressedFile::CompressFrame(BlockType* block)
+{
+    bool compressed = false;
+    size_t compressedLength = 0;
+
+#ifdef PCAPSORTER_WITH_ZLIB
+    if (compression == CT_GZIP) {
+        z_stream* stream = ThreadDeflateStream(level);
+        compressed = (stream != nullptr) && CompressGzip(stream, block->data.data(), block->length, block->compressed, &compressedLength);
+    }
+#endif
+#ifdef PCAPSORTER_WITH_ZSTD
+    if (compression == CT_ZSTD) {
+        ZSTD_CCtx* context = ThreadZstdContext();
+        compressed = (context != nullptr) && CompressZstd(context, level, block->data.data(), block->length, block->compressed, &compressedLength);
+    }
+#endif
+    // A frame which could not be compressed fails the file
+    block->frame = compressed ? block->compressed.data() : nullptr;
+    block->frameLength = compressedLength;
+    block->ready.store(true);
+    progress.Notify();
+}
+
+void CompressedFile::WriteFrames()
+{
+    while (true) {
+        BlockType* block;
+        if (!pendingBlocks[0]->Pop(block, stopping)) {
+            return;
+        }
+        progress.Wait([block]() { return block->ready.load(); });
+
+        if (block->frame == nullptr || target.Write(block->frame, block->frameLength) != 0) {
+            failed.store(true);
+        }
+        freeBlocks->Push(block);
+        blocksWritten.fetch_add(1);
+        progress.Notify();
+    }
+}
@@ -0,0 +1,175 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "GatherFile.h"
+#include "MappedFile.h"
+#include "SpscRing.h"
+#include "WaitEvent.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Sequential reading and writing of gzip, zstd or LZ4 compressed captures.
+ *
+ * Reading: a producer thread decompresses blocks ahead of the reader and hands
+ * them over through a ring. zstd files of several frames (e.g. written by
+ * pzstd) are split at the frames, which are decompressed by a worker thread
+ * per lane and read back in file order.
+ *
+ * Writing: the output is cut into independent frames (zstd frames or gzip
+ * members) which are compressed as tasks of the thread pool. A writer thread
+ * stores them in file order, so any decompressor reads the file as a whole.
+ *
+ * A format is only supported if the build defines PCAPSORTER_WITH_ZLIB,
+ * PCAPSORTER_WITH_ZSTD or PCAPSORTER_WITH_LZ4 and links the library. Output
+ * is written as gzip or zstd.
+ */
+class CompressedFile
+{
+public:
+    enum CompressionType {
+        CT_NONE,
+        CT_GZIP,
+        CT_ZSTD,
+        CT_LZ4
+    };
+
+private:
+    struct BlockType {
+        vector<uint8_t> data;           // Decompressed bytes
+        size_t          length;
+        const uint8_t*  frame;          // Compressed frame, points into compressed when writing
+        size_t          frameLength;
+        vector<uint8_t> compressed;     // Only used when writing
+        bool            last;           // End of the input, failed tells if it is complete
+        atomic<bool>    ready;          // Frame is compressed, only used when writing
+    };
+    typedef SpscRing<BlockType*> BlockRingType;
+
+    CompressionType     compression;
+    bool                forWrite;
+    int                 level;
+    MappedFile          mappedFile;     // Regular files are decompressed in place ...
+    istream*            source;         // ... others are read from the stream of the caller
+    vector<uint8_t>     sourceBuffer;
+    size_t              sourcePrefix;   // Bytes read by the caller already, at the start of sourceBuffer
+    uint64_t            sourceSize;     // 0 if unknown
+    atomic<uint64_t>    sourcePosition;
+    GatherFile          target;         // Output of the writer thread
+    atomic<bool>        stopping;
+    atomic<bool>        failed;
+    bool                isOpen;
+
+    // The producer (reading) or the caller (writing) hands blocks to the lanes round robin,
+    // the consumer takes them back in the same order
+    deque<BlockType>                blocks;         // Never moved, tasks hold pointers to them
+    unique_ptr<BlockRingType>       freeBlocks;     // Consumer -> producer
+    vector<unique_ptr<BlockRingType>> pendingBlocks; // Producer -> worker of each lane, caller -> writer thread
+    vector<unique_ptr<BlockRingType>> doneBlocks;    // Worker (or a producer without workers) -> consumer
+    size_t              lanes;
+    size_t              producerLane;
+    size_t              consumerLane;
+    BlockType*          current;        // Block which is read or filled by the caller
+    size_t              currentUsed;    // Bytes of it read
+    uint64_t            blocksSubmitted;
+    atomic<uint64_t>    blocksWritten;
+    WaitEvent           progress;       // A frame was compressed or written
+    thread              producer;       // Decompresses (reading) or writes the frames (writing)
+    vector<thread>      workers;
+
+    int Start(size_t lanes);
+    const uint8_t* NextSource(size_t* length);
+    BlockType* NextFreeBlock();
+    bool Deliver(BlockType* block);
+    void Finish(bool error);
+    void Submit();
+
+    void ProduceGzip();
+    void ProduceZstd();
+    void ProduceZstdFrames();
+    void ProduceLz4();
+#ifdef PCAPSORTER_WITH_ZSTD
+    // Without zstd there is only one lane, see ParallelZstdLanes
+    void DecompressFrames(size_t lane);
+#endif
+    size_t ParallelZstdLanes();
+    void CompressFrame(BlockType* block);
+    void WriteFrames();
+
+public:
+    CompressedFile(void);
+    virtual ~CompressedFile(void);
+
+    // Format by the magic bytes at the start of a file
+    static CompressionType Detect(const uint8_t* data, size_t length);
+    static const char* Name(CompressionType compression);
+    // File name suffix, e.g. ".gz"
+    static const char* Extension(CompressionType compression);
+    // True if this build has the library of the format
+    static bool IsSupported(CompressionType compression);
+    // Range of the compression levels of the output formats
+    static bool IsValidLevel(CompressionType compression, int level);
+    static int DefaultLevel(CompressionType compression);
+    // Bytes of the frames which a file written by threadCount tasks holds
+    static uint64_t WriteMemory(unsigned int threadCount);
+
+    // Decompresses a regular file
+    int Open(const char* fileName, CompressionType compression);
+    // Decompresses a stream of the caller, e.g. a pipe. The first prefixLength
+    // bytes were read from it already. The stream must stay open until Close.
+    int Open(istream* source, const uint8_t* prefix, size_t prefixLength, CompressionType compression);
+    // Compresses into a new file, up to threadCount frames at a time. Writes are buffered
+    // by bufferSize bytes once compressed.
+    int OpenWrite(const char* fileName, CompressionType compression, int level, unsigned int threadCount, size_t bufferSize);
+    int Close();
+
+    bool IsOpen() const {
+        return isOpen;
+    }
+
+    // Sequential read, returns less than length only at the end of the input
+    // or if the decompression failed
+    size_t Read(uint8_t* target, size_t length);
+
+    int Write(const uint8_t* data, size_t length);
+    // Room for length bytes (at most one frame) at the end of the output,
+    // valid until the next call
+    uint8_t* Reserve(size_t length);
+    // Waits until everything written so far is in the file
+    int Flush();
+
+    bool Failed() const {
+        return failed.load();
+    }
+
+    // Progress in the compressed input, the decompressed size is not known up front
+    uint64_t CompressedPosition() const {
+        return sourcePosition.load();
+    }
+    uint64_t CompressedSize() const {
+        return sourceSize;
+    }
+};
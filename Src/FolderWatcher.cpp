@@ -0,0 +1,346 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "FolderWatcher.h"
+#include "Logger.h"
+#include <chrono>
+#include <set>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <climits>
+#endif
+
+#ifdef _WIN32
+// Bytes of change records per read, larger buffers fail on network shares
+static const DWORD ChangeBufferSize = 64 * 1024;
+// Interval to look again at changed files which a writer still holds open
+static const int ClosedRetryMs = 200;
+
+/* Read of the changes of the watched tree, pending between the calls of Wait */
+struct FolderWatcher::DirectoryChanges {
+    HANDLE          directory;
+    OVERLAPPED      overlapped;
+    vector<DWORD>   buffer;     // FILE_NOTIFY_INFORMATION records, which are DWORD aligned
+    set<fs::path>   written;    // Changed files, possibly still open for writing
+};
+#endif
+
+FolderWatcher::FolderWatcher(void)
+{
+    recursive = false;
+#ifndef _WIN32
+    handle = -1;
+#endif
+}
+
+FolderWatcher::~FolderWatcher(void)
+{
+    Close();
+}
+
+int FolderWatcher::Open(const fs::path& root, bool recursive, const fs::path& skipDirectory)
+{
+    Close();
+
+    this->root = root;
+    this->recursive = recursive;
+    this->skipDirectory = skipDirectory;
+
+#ifdef __linux__
+    handle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (handle < 0) {
+        Logger::GetLogger().Log(LL_ERROR, "Can not watch the input directory. inotify failed: ", errno);
+        return -1;
+    }
+
+    // Files which are there already are left to the caller, it looks at them once
+    vector<WatchEventType> ignored;
+    AddDirectory(root, ignored);
+    if (watches.empty()) {
+        Close();
+        return -1;
+    }
+#endif
+#ifdef _WIN32
+    changes.reset(new DirectoryChanges());
+    changes->directory = CreateFileW(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (changes->directory == INVALID_HANDLE_VALUE) {
+        Logger::GetLogger().Log(LL_ERROR, "Can not watch the input directory. Error: ", (int)GetLastError());
+        changes.reset();
+        return -1;
+    }
+    ZeroMemory(&changes->overlapped, sizeof(changes->overlapped));
+    changes->overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    changes->buffer.resize(ChangeBufferSize / sizeof(DWORD));
+
+    // Files which are there already are left to the caller, it looks at them once
+    if (changes->overlapped.hEvent == nullptr || !ReadChanges()) {
+        Logger::GetLogger().Log(LL_ERROR, "Can not watch the input directory. Error: ", (int)GetLastError());
+        Close();
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+void FolderWatcher::Close()
+{
+#ifdef _WIN32
+    if (changes) {
+        // The pending read must end before its buffer is freed
+        DWORD length;
+        if (changes->directory != INVALID_HANDLE_VALUE) {
+            if (CancelIoEx(changes->directory, &changes->overlapped) || GetLastError() != ERROR_NOT_FOUND) {
+                GetOverlappedResult(changes->directory, &changes->overlapped, &length, TRUE);
+            }
+            CloseHandle(changes->directory);
+        }
+        if (changes->overlapped.hEvent != nullptr) {
+            CloseHandle(changes->overlapped.hEvent);
+        }
+        changes.reset();
+    }
+#else
+#ifdef __linux__
+    if (handle >= 0) {
+        close(handle);
+    }
+#endif
+    handle = -1;
+    watches.clear();
+#endif
+}
+
+#ifndef _WIN32
+// Watches the directory, and with recursive its subdirectories. Files found in them were
+// possibly written before the watch existed, they are reported as seen.
+void FolderWatcher::AddDirectory(const fs::path& directory, vector<WatchEventType>& events)
+{
+#ifdef __linux__
+    error_code errorCode;
+    if (fs::equivalent(directory, skipDirectory, errorCode)) {
+        return;
+    }
+
+    int watch = inotify_add_watch(handle, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE_SELF);
+    if (watch < 0) {
+        Logger::GetLogger().Log(LL_WARNING, "Can not watch the directory ", directory.generic_string().c_str());
+        return;
+    }
+    watches[watch] = directory;
+
+    ScanDirectory(directory, false, events);
+    if (recursive) {
+        for (fs::directory_iterator entry(directory, fs::directory_options::skip_permission_denied, errorCode); !errorCode && entry != fs::directory_iterator(); entry.increment(errorCode)) {
+            error_code typeError;
+            if (entry->is_directory(typeError)) {
+                AddDirectory(entry->path(), events);
+            }
+        }
+    }
+#endif
+}
+#endif
+
+#ifdef _WIN32
+bool FolderWatcher::ReadChanges()
+{
+    DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE;
+
+    ResetEvent(changes->overlapped.hEvent);
+    return ReadDirectoryChangesW(changes->directory, changes->buffer.data(), (DWORD)(changes->buffer.size() * sizeof(DWORD)),
+        recursive ? TRUE : FALSE, filter, nullptr, &changes->overlapped, nullptr) != 0;
+}
+
+// Collects the changed files. The writer of a file is not reported, so they are
+// looked at again every ClosedRetryMs until it has closed them.
+void FolderWatcher::WaitChanges(vector<WatchEventType>& events, int timeoutMs, bool* rescan)
+{
+    DWORD timeout = (DWORD)((changes->written.empty() || timeoutMs < ClosedRetryMs) ? timeoutMs : ClosedRetryMs);
+
+    if (WaitForSingleObject(changes->overlapped.hEvent, timeout) == WAIT_OBJECT_0) {
+        DWORD length = 0;
+        if (!GetOverlappedResult(changes->directory, &changes->overlapped, &length, FALSE) || length == 0) {
+            *rescan = true;     // More changes than the buffer holds, they are lost
+        }
+        else {
+            const uint8_t* position = (const uint8_t*)changes->buffer.data();
+            while (true) {
+                const FILE_NOTIFY_INFORMATION* change = (const FILE_NOTIFY_INFORMATION*)position;
+                fs::path path = root / wstring(change->FileName, change->FileNameLength / sizeof(WCHAR));
+                bool appeared = (change->Action == FILE_ACTION_ADDED || change->Action == FILE_ACTION_RENAMED_NEW_NAME);
+                error_code typeError;
+
+                if (change->Action == FILE_ACTION_REMOVED || change->Action == FILE_ACTION_RENAMED_OLD_NAME) {
+                    changes->written.erase(path);
+                }
+                else if (!IsSkipped(path)) {
+                    if (appeared && recursive && fs::is_directory(path, typeError)) {
+                        // Its files may have been written before, e.g. a directory moved in
+                        ScanDirectory(path, true, events);
+                    }
+                    else {
+                        changes->written.insert(path);
+                    }
+                }
+
+                if (change->NextEntryOffset == 0) {
+                    break;
+                }
+                position += change->NextEntryOffset;
+            }
+        }
+
+        if (!ReadChanges()) {
+            // E.g. the directory was removed, the tree is scanned from now on
+            Logger::GetLogger().Log(LL_WARNING, "Can not watch the input directory any more. Error: ", (int)GetLastError());
+            Close();
+            *rescan = true;
+        }
+    }
+
+    if (changes) {
+        TakeClosedFiles(events);
+    }
+}
+
+// A file is finished once it can be opened without sharing the write access, i.e. no
+// writer holds it open any more. Files which are gone or are directories are dropped.
+void FolderWatcher::TakeClosedFiles(vector<WatchEventType>& events)
+{
+    for (auto file = changes->written.begin(); file != changes->written.end(); ) {
+        HANDLE handle = CreateFileW(file->c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle);
+            events.push_back({ *file, true });
+            file = changes->written.erase(file);
+        }
+        else if (GetLastError() == ERROR_SHARING_VIOLATION) {
+            ++file;
+        }
+        else {
+            file = changes->written.erase(file);
+        }
+    }
+}
+
+// True if the path lies below the directory which is not watched
+bool FolderWatcher::IsSkipped(const fs::path& path) const
+{
+    error_code errorCode;
+    fs::path directory = root;
+
+    for (const fs::path& part : path.lexically_relative(root).parent_path()) {
+        directory /= part;
+        if (fs::equivalent(directory, skipDirectory, errorCode)) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+void FolderWatcher::ScanDirectory(const fs::path& directory, bool recurse, vector<WatchEventType>& events)
+{
+    error_code errorCode;
+    if (fs::equivalent(directory, skipDirectory, errorCode)) {
+        return;
+    }
+
+    for (fs::directory_iterator entry(directory, fs::directory_options::skip_permission_denied, errorCode); !errorCode && entry != fs::directory_iterator(); entry.increment(errorCode)) {
+        error_code typeError;
+        if (entry->is_regular_file(typeError)) {
+            events.push_back({ entry->path(), false });
+        }
+        else if (recurse && entry->is_directory(typeError)) {
+            ScanDirectory(entry->path(), true, events);
+        }
+    }
+}
+
+int FolderWatcher::Wait(vector<WatchEventType>& events, int timeoutMs, bool* rescan)
+{
+    *rescan = false;
+
+#ifdef _WIN32
+    if (changes) {
+        WaitChanges(events, timeoutMs, rescan);
+        return 0;
+    }
+#endif
+#ifdef __linux__
+    if (handle < 0) {
+        return -1;
+    }
+
+    pollfd request = { handle, POLLIN, 0 };
+    if (poll(&request, 1, timeoutMs) <= 0) {
+        return 0;
+    }
+
+    alignas(inotify_event) char buffer[64 * (sizeof(inotify_event) + NAME_MAX + 1)];
+    while (true) {
+        ssize_t length = read(handle, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+
+        for (char* position = buffer; position < buffer + length; ) {
+            inotify_event* event = (inotify_event*)position;
+            position += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                *rescan = true;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watches.erase(event->wd);   // The directory was removed
+                continue;
+            }
+
+            auto watch = watches.find(event->wd);
+            if (watch == watches.end() || event->len == 0) {
+                continue;
+            }
+            fs::path path = watch->second / event->name;
+
+            if (event->mask & IN_ISDIR) {
+                if (recursive && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                    AddDirectory(path, events);
+                }
+            }
+            else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                events.push_back({ path, true });
+            }
+        }
+    }
+#else
+    // No notifications, the whole tree is looked at again
+    this_thread::sleep_for(chrono::milliseconds(timeoutMs));
+    ScanDirectory(root, recursive, events);
+#endif
+    return 0;
+}
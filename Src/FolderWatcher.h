@@ -0,0 +1,74 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+/**
+ * Reports the files of a directory tree which were written. On Linux inotify tells
+ * when a file was closed after writing or moved in. On Windows ReadDirectoryChangesW
+ * reports the changed files, which are finished once no writer holds them open any
+ * more. Elsewhere the tree is scanned and every file is reported as seen, the caller
+ * waits until it no longer changes.
+ */
+class FolderWatcher
+{
+public:
+    struct WatchEventType {
+        fs::path    path;
+        bool        finished;   // Closed after writing or moved in. Otherwise it may still be written.
+    };
+
+private:
+    fs::path        root;
+    fs::path        skipDirectory;
+    bool            recursive;
+#ifdef _WIN32
+    struct DirectoryChanges;
+    unique_ptr<DirectoryChanges> changes;   // Null if closed, the tree is scanned then
+
+    bool ReadChanges();
+    void WaitChanges(vector<WatchEventType>& events, int timeoutMs, bool* rescan);
+    void TakeClosedFiles(vector<WatchEventType>& events);
+    bool IsSkipped(const fs::path& path) const;
+#else
+    int             handle;     // inotify, -1 if closed
+    map<int, fs::path> watches;  // Watched directory of each watch descriptor
+
+    void AddDirectory(const fs::path& directory, vector<WatchEventType>& events);
+#endif
+    void ScanDirectory(const fs::path& directory, bool recurse, vector<WatchEventType>& events);
+
+public:
+    FolderWatcher(void);
+    virtual ~FolderWatcher(void);
+
+    // The directory skipDirectory (e.g. the output) is never watched
+    int Open(const fs::path& root, bool recursive, const fs::path& skipDirectory);
+    // Waits up to timeoutMs for files and appends them to events. rescan is set if events
+    // were lost, then the caller has to look at the whole tree again.
+    int Wait(vector<WatchEventType>& events, int timeoutMs, bool* rescan);
+    void Close();
+};
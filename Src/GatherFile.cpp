@@ -0,0 +1,241 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "GatherFile.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+GatherFile::GatherFile(void)
+{
+    used = 0;
+    offset = 0;
+    failed = false;
+#ifdef _WIN32
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    fileDescriptor = -1;
+#endif
+}
+
+GatherFile::~GatherFile(void)
+{
+    Close();
+}
+
+int GatherFile::Write(const uint8_t* data, size_t length)
+{
+    if (used + length <= buffer.size()) {
+        memcpy(buffer.data() + used, data, length);
+        used += length;
+        return failed ? -1 : 0;
+    }
+
+    // The record which does not fit goes out right behind the buffer, without a copy
+    return WriteGathered(data, length) ? 0 : -1;
+}
+
+uint8_t* GatherFile::Reserve(size_t length)
+{
+    if (used + length > buffer.size()) {
+        WriteGathered(nullptr, 0);
+    }
+
+    uint8_t* room = buffer.data() + used;
+    used += length;
+    return room;
+}
+
+int GatherFile::Flush()
+{
+    if (used > 0) {
+        WriteGathered(nullptr, 0);
+    }
+    return failed ? -1 : 0;
+}
+
+void GatherFile::SetWriteOffset(uint64_t offset)
+{
+    this->offset = offset;
+}
+
+#ifdef _WIN32
+
+int GatherFile::Open(const char* fileName, size_t bufferSize)
+{
+    Close();
+
+    fileHandle = CreateFileA(fileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    buffer.resize((bufferSize > 0) ? bufferSize : DefaultBufferSize);
+    used = 0;
+    offset = 0;
+    failed = false;
+    return 0;
+}
+
+int GatherFile::Close()
+{
+    int result = 0;
+
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        result = Flush();
+        CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+    buffer.clear();
+    buffer.shrink_to_fit();
+    used = 0;
+    return result;
+}
+
+bool GatherFile::IsOpen() const
+{
+    return fileHandle != INVALID_HANDLE_VALUE;
+}
+
+int GatherFile::Preallocate(uint64_t size)
+{
+    FILE_ALLOCATION_INFO allocation;
+    allocation.AllocationSize.QuadPart = (LONGLONG)size;
+    return SetFileInformationByHandle(fileHandle, FileAllocationInfo, &allocation, sizeof(allocation)) ? 0 : -1;
+}
+
+static const DWORD MaxWriteLength = 0x40000000;
+
+bool GatherFile::WriteGathered(const uint8_t* data, size_t length)
+{
+    // WriteFileGather needs unbuffered page sized I/O, so the two parts are written one by one
+    const uint8_t* parts[2] = { buffer.data(), data };
+    size_t lengths[2] = { used, length };
+
+    for (int part = 0; part < 2 && !failed; part++) {
+        while (lengths[part] > 0) {
+            OVERLAPPED position = {};
+            DWORD written = 0;
+            DWORD count = (lengths[part] > MaxWriteLength) ? MaxWriteLength : (DWORD)lengths[part];
+            position.Offset = (DWORD)offset;
+            position.OffsetHigh = (DWORD)(offset >> 32);
+            if (!WriteFile(fileHandle, parts[part], count, &written, &position) || written == 0) {
+                failed = true;
+                break;
+            }
+            parts[part] += written;
+            lengths[part] -= written;
+            offset += written;
+        }
+    }
+
+    used = 0;
+    return !failed;
+}
+
+#else
+
+int GatherFile::Open(const char* fileName, size_t bufferSize)
+{
+    Close();
+
+    fileDescriptor = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fileDescriptor < 0) {
+        return -1;
+    }
+
+    buffer.resize((bufferSize > 0) ? bufferSize : DefaultBufferSize);
+    used = 0;
+    offset = 0;
+    failed = false;
+    return 0;
+}
+
+int GatherFile::Close()
+{
+    int result = 0;
+
+    if (fileDescriptor >= 0) {
+        result = Flush();
+        close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+    buffer.clear();
+    buffer.shrink_to_fit();
+    used = 0;
+    return result;
+}
+
+bool GatherFile::IsOpen() const
+{
+    return fileDescriptor >= 0;
+}
+
+int GatherFile::Preallocate(uint64_t size)
+{
+#ifdef __linux__
+    // Not every file system supports it, the file then grows as it is written
+    return (fallocate(fileDescriptor, FALLOC_FL_KEEP_SIZE, 0, (off_t)size) == 0) ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+bool GatherFile::WriteGathered(const uint8_t* data, size_t length)
+{
+    struct iovec parts[2] = { { buffer.data(), used }, { (void*)data, length } };
+    int part = 0;
+
+    while (part < 2 && !failed) {
+        if (parts[part].iov_len == 0) {
+            part++;
+            continue;
+        }
+
+        ssize_t written = pwritev(fileDescriptor, parts + part, 2 - part, (off_t)offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            failed = true;
+            break;
+        }
+        offset += (uint64_t)written;
+
+        // Continue behind a short write
+        while (part < 2 && (size_t)written >= parts[part].iov_len) {
+            written -= parts[part].iov_len;
+            part++;
+        }
+        if (part < 2) {
+            parts[part].iov_base = (uint8_t*)parts[part].iov_base + written;
+            parts[part].iov_len -= written;
+        }
+    }
+
+    used = 0;
+    return !failed;
+}
+
+#endif
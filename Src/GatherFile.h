@@ -0,0 +1,84 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Sequential output through one large buffer. Small records are gathered in
+ * the buffer, a record which does not fit any more is written together with
+ * the buffer by a single pwritev instead of being copied. Headers can be
+ * built in place with Reserve, so nothing has to be prepared on the side.
+ */
+class GatherFile
+{
+private:
+    vector<uint8_t> buffer;
+    size_t          used;           // Bytes of the buffer filled
+    uint64_t        offset;         // File offset of the buffer
+    bool            failed;
+
+#ifdef _WIN32
+    void*           fileHandle;
+#else
+    int             fileDescriptor;
+#endif
+
+    // Writes the buffer followed by data at the offset of the buffer
+    bool WriteGathered(const uint8_t* data, size_t length);
+
+public:
+    static const size_t DefaultBufferSize = 1024 * 1024;
+
+    GatherFile(void);
+    virtual ~GatherFile(void);
+
+    int Open(const char* fileName, size_t bufferSize);
+    int Close();
+
+    bool IsOpen() const;
+
+    // Reserves the disk space of a file of the expected size up front, so it is
+    // allocated in one piece. The file keeps the length of what is written.
+    int Preallocate(uint64_t size);
+
+    int Write(const uint8_t* data, size_t length);
+
+    // Room for length bytes (at most the buffer size) at the end of the output,
+    // valid until the next call
+    uint8_t* Reserve(size_t length);
+
+    // Writes everything which is buffered
+    int Flush();
+
+    // Write position. Only change it after Flush, e.g. to skip a range copied by the kernel.
+    uint64_t WriteOffset() const {
+        return offset + used;
+    }
+    void SetWriteOffset(uint64_t offset);
+
+#ifndef _WIN32
+    // Descriptor of the output, e.g. for copy_file_range behind a Flush
+    int Descriptor() const {
+        return fileDescriptor;
+    }
+#endif
+};
@@ -0,0 +1,124 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "JobJournal.h"
+#include "Logger.h"
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+JobJournal::JobJournal(void)
+{
+}
+
+JobJournal::~JobJournal(void)
+{
+    Close();
+}
+
+int JobJournal::Open(const string& fileName)
+{
+    lock_guard<mutex> lock(journalMutex);
+    this->fileName = fileName;
+    completed.clear();
+
+    ifstream previous(fileName);
+    string line;
+    while (getline(previous, line)) {
+        size_t separator = line.find(' ');
+        if (separator == string::npos || separator == 0) {
+            continue;   // Torn last line of a crash
+        }
+        completed[line.substr(separator + 1)] = strtoull(line.substr(0, separator).c_str(), nullptr, 10);
+    }
+    previous.close();
+
+    // Compact: later lines replaced earlier ones, and removed inputs are forgotten
+    string compactName = fileName + ".tmp";
+    ofstream compact(compactName, ios::trunc);
+    for (auto entry = completed.begin(); entry != completed.end(); ) {
+        error_code errorCode;
+        if (!fs::exists(entry->first, errorCode)) {
+            entry = completed.erase(entry);
+            continue;
+        }
+        compact << entry->second << ' ' << entry->first << '\n';
+        ++entry;
+    }
+    compact.close();
+
+    error_code errorCode;
+    fs::rename(compactName, fileName, errorCode);
+    if (!compact || errorCode) {
+        Logger::GetLogger().Log(LL_ERROR, "Can not write the journal ", fileName.c_str());
+        return -1;
+    }
+
+    journal.open(fileName, ios::app);
+    if (!journal) {
+        Logger::GetLogger().Log(LL_ERROR, "Can not write the journal ", fileName.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+void JobJournal::Close()
+{
+    lock_guard<mutex> lock(journalMutex);
+    if (journal.is_open()) {
+        journal.close();
+    }
+}
+
+bool JobJournal::TryStart(const string& inputFile, uint64_t size)
+{
+    lock_guard<mutex> lock(journalMutex);
+    if (running.find(inputFile) != running.end()) {
+        return false;
+    }
+
+    auto entry = completed.find(inputFile);
+    if (entry != completed.end() && entry->second == size) {
+        return false;
+    }
+
+    running[inputFile] = size;
+    return true;
+}
+
+void JobJournal::Finish(const string& inputFile, bool succeeded)
+{
+    lock_guard<mutex> lock(journalMutex);
+    auto entry = running.find(inputFile);
+    if (entry == running.end()) {
+        return;
+    }
+
+    if (succeeded) {
+        completed[inputFile] = entry->second;
+        // One line per input and flushed right away, a crash loses at most the last one
+        journal << entry->second << ' ' << inputFile << '\n' << flush;
+    }
+    running.erase(entry);
+}
+
+size_t JobJournal::CompletedCount()
+{
+    lock_guard<mutex> lock(journalMutex);
+    return completed.size();
+}
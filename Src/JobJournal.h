@@ -0,0 +1,57 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+/**
+ * Persistent record of the inputs which were sorted by the watch mode, one line
+ * "SIZE PATH" per input. An input is sorted again if its size changed. Opening the
+ * journal compacts it to the inputs which still exist.
+ */
+class JobJournal
+{
+private:
+    string fileName;
+    ofstream journal;
+    map<string, uint64_t> completed;
+    map<string, uint64_t> running;  // Jobs pushed and not yet finished
+    mutex journalMutex;
+
+public:
+    JobJournal(void);
+    virtual ~JobJournal(void);
+
+    int Open(const string& fileName);
+    void Close();
+
+    // False if the input was sorted at this size already or its job still runs,
+    // otherwise it is marked running
+    bool TryStart(const string& inputFile, uint64_t size);
+    // Called by the job when it ends, records the input if it succeeded
+    void Finish(const string& inputFile, bool succeeded);
+
+    size_t CompletedCount();
+};
@@ -15,32 +15,28 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+
 #include "JobList.h"
 #include "Logger.h"
-#include <windows.h>
-#include <tchar.h>
+#include "MemoryBudget.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// Jobs beyond these wait in PushSortJob until the pool has taken some
+static const size_t JobRingSize = 4096;
 
 JobList singleton;
 
 JobList::JobList()
+    : jobList(JobRingSize)
 {
-    mutex = CreateMutex(
-        NULL,              // default security attributes
-        FALSE,             // initially not owned
-        NULL);             // unnamed mutex
-
-    if (mutex == NULL)
-    {
-        Logger::GetLogger().Log(LL_ERROR, "CreateMutex error : ", GetLastError());
-    }
+    pendingJobs.store(0);
 }
 
 JobList::~JobList()
 {
-    if (mutex != NULL) {
-        CloseHandle(mutex);
-        mutex = NULL;
-    }
 }
 
 JobList& JobList::GetJobList()
@@ -50,73 +46,95 @@ JobList& JobList::GetJobList()
 
 bool JobList::PushSortJob(SortJob* job)
 {
-    DWORD   dwWaitResult = WaitForSingleObject(
-            mutex,      // handle to mutex
-            INFINITE);  // no time-out interval
-
-    switch (dwWaitResult)
-    {
-        // The thread got ownership of the mutex
-    case WAIT_OBJECT_0:
-        __try {
-            Logger::GetLogger().Log(LL_DEBUG, "Got mutex for job-list");
-            jobList.push_back(job);
-        }
-
-        __finally {
-            // Release ownership of the mutex object
-            if (!ReleaseMutex(mutex))
-            {
-                Logger::GetLogger().Log(LL_ERROR, "Release of job-list mutex failed: ", GetLastError());
-                return false;
-            }
-        }
-        break;
-
-        // The thread got ownership of an abandoned mutex
-        // The database is in an indeterminate state
-    case WAIT_ABANDONED:
-        Logger::GetLogger().Log(LL_ERROR, "Wait for job-list mutex failed: ", GetLastError());
-        return false;
+    pendingJobs.fetch_add(1);
+    jobList.Push(job);
+    ThreadPool::GetThreadPool().NotifyJobs();
+    return true;
+}
+
+bool JobList::PushSortJobs(vector<SortJob*>& jobs)
+{
+    vector<pair<uint64_t, SortJob*>> bySize;
+    for (SortJob* job : jobs) {
+        bySize.push_back(make_pair(job->InputSize(), job));
     }
+    stable_sort(bySize.begin(), bySize.end(), [](const pair<uint64_t, SortJob*>& a, const pair<uint64_t, SortJob*>& b) {
+        return a.first > b.first;
+    });
 
-    return true;
+    bool result = true;
+    for (auto& entry : bySize) {
+        result = PushSortJob(entry.second) && result;
+    }
+    jobs.clear();
+    return result;
 }
 
 SortJob* JobList::PopSortJob()
 {
     SortJob* nextJob = nullptr;
+    if (!jobList.TryPop(nextJob)) {
+        return nullptr;
+    }
+    return nextJob;
+}
 
-    DWORD   dwWaitResult = WaitForSingleObject(
-        mutex,      // handle to mutex
-        INFINITE);  // no time-out interval
-
-    switch (dwWaitResult)
-    {
-        // The thread got ownership of the mutex
-    case WAIT_OBJECT_0:
-        __try {
-            Logger::GetLogger().Log(LL_DEBUG, "Got mutex for job-list");
-            if (!jobList.empty()) {
-                nextJob = jobList.back();
-                jobList.pop_back();
-            }
-        }
-
-        __finally {
-            // Release ownership of the mutex object
-            if (!ReleaseMutex(mutex))
-            {
-                Logger::GetLogger().Log(LL_ERROR, "Release of job-list mutex failed: ", GetLastError());
-            }
-        }
-        break;
-
-        // The thread got ownership of an abandoned mutex
-        // The database is in an indeterminate state
-    case WAIT_ABANDONED:
-        Logger::GetLogger().Log(LL_ERROR, "Wait for job-list mutex failed: ", GetLastError());
+bool JobList::RunNextJob()
+{
+    SortJob* nextJob = PopSortJob();
+    if (nextJob == nullptr) {
+        return false;
     }
 
-    return nextJob;
+    Logger::GetLogger().Log(LL_DEBUG, "Got a new job.");
+    uint64_t releases = MemoryBudget::GetMemoryBudget().Releases();
+    bool result = nextJob->ExecuteJob();
+    if (nextJob->IsWaitingForMemory()) {
+        WaitForMemory(nextJob, releases);
+        return true;
+    }
+
+    if (result) {
+        Logger::GetLogger().Log(LL_DEBUG, "Job executed successfully.");
+    }
+    else {
+        Logger::GetLogger().Log(LL_WARNING, "Job executed not successfully.");
+    }
+    nextJob->Finish(result);
+    delete(nextJob);
+    pendingJobs.fetch_sub(1);
+
+    // Its memory is free now
+    ResumeWaitingJobs();
+    return true;
+}
+
+void JobList::WaitForMemory(SortJob* job, uint64_t releases)
+{
+    lock_guard<mutex> lock(waitingMutex);
+
+    // Memory freed while the job tried is not announced again, so it tries once more
+    if (MemoryBudget::GetMemoryBudget().Releases() != releases && jobList.TryPush(job)) {
+        ThreadPool::GetThreadPool().NotifyJobs();
+        return;
+    }
+    waitingJobs.push_back(job);
+}
+
+void JobList::ResumeWaitingJobs()
+{
+    lock_guard<mutex> lock(waitingMutex);
+
+    // A full list has jobs to run, the rest waits for the next job which finishes
+    while (!waitingJobs.empty() && jobList.TryPush(waitingJobs.front())) {
+        waitingJobs.erase(waitingJobs.begin());
+        ThreadPool::GetThreadPool().NotifyJobs();
+    }
+}
+
+void JobList::WaitJobs()
+{
+    while (pendingJobs.load() > 0) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
 }
@@ -15,17 +15,32 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+
 #pragma once
+#include <atomic>
+#include <mutex>
 #include <vector>
+#include "MpmcRing.h"
 #include "SortJob.h"
 
 using namespace std;
 
+/**
+ * Jobs waiting for a free job slot of the thread pool. Pushing and popping is
+ * lock-free, the pool pops the next job whenever one of its slots is free.
+ * A job which can not reserve its memory yet is put aside instead of holding
+ * its slot, and goes back into the list when another job has finished.
+ */
 class JobList
 {
 private:
-    vector<SortJob*> jobList;
-    void* mutex;
+    MpmcRing<SortJob*> jobList;
+    atomic<size_t> pendingJobs;     // Pushed and not yet finished
+    mutex waitingMutex;
+    vector<SortJob*> waitingJobs;   // Waiting for memory, see SortJob::IsWaitingForMemory
+
+    void WaitForMemory(SortJob* job, uint64_t releases);
+    void ResumeWaitingJobs();
 
 public:
     JobList();
@@ -35,7 +50,12 @@ public:
     static JobList& GetJobList();
 
     bool PushSortJob(SortJob* job);
+    // Pushes the largest inputs first, so no large job is left alone at the end
+    bool PushSortJobs(vector<SortJob*>& jobs);
     SortJob* PopSortJob();
 
+    // Executes and deletes the next job, false if there is none
+    bool RunNextJob();
+    // Blocks until every pushed job has finished
+    void WaitJobs();
 };
-
@@ -20,37 +20,21 @@
 #include <iomanip>
 #include <map>
 #include <string>
-#include <Windows.h>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
-map<unsigned int, Logger*> loggers;
-HANDLE mutex = NULL;
+map<thread::id, Logger*> loggers;
+recursive_mutex* logMutex = nullptr;
 LogLevelType globalLogLevel;
 
 void waitForMutex() {
-    DWORD   dwWaitResult = WaitForSingleObject(
-        mutex,      // handle to mutex
-        INFINITE);  // no time-out interval
-
-    switch (dwWaitResult)
-    {
-        // The thread got ownership of the mutex
-    case WAIT_OBJECT_0:
-        break;
-
-        // The thread got ownership of an abandoned mutex
-        // The database is in an indeterminate state
-    case WAIT_ABANDONED:
-        cout << "[FATAL]   Wait for logging-mutex failed: " << GetLastError() << endl;
-    }
+    logMutex->lock();
 }
 
 void releaseMutex() {
-    if (!ReleaseMutex(mutex))
-    {
-        cout << "[FATAL]   Release of logging-mutex failed: " << GetLastError() << endl;
-    }
+    logMutex->unlock();
 }
 
 Logger::Logger(void)
@@ -84,12 +68,18 @@ void Logger::SetReference(int packetNumber, PcapPacketHeaderType *pcapHeader) {
 
 Logger& Logger::GetLogger()
 {
-    if(loggers.count(GetCurrentThreadId()) == 0) {
+    // Cached per thread, so the map is only touched under the mutex
+    thread_local Logger* threadLogger = nullptr;
+
+    if (threadLogger == nullptr) {
         waitForMutex();
-        loggers[GetCurrentThreadId()] = new Logger(loggers.size());
+        if (loggers.count(this_thread::get_id()) == 0) {
+            loggers[this_thread::get_id()] = new Logger(loggers.size());
+        }
+        threadLogger = loggers[this_thread::get_id()];
         releaseMutex();
     }
-    return *loggers[GetCurrentThreadId()];
+    return *threadLogger;
 }
 
 void Logger::LogHeader(LogLevelType logLevel) {
@@ -128,7 +118,7 @@ void Logger::Log(LogLevelType logLevel, const char* msg)
     }
 }
 
-void Logger::Log(LogLevelType logLevel, char * msg, const char * str)
+void Logger::Log(LogLevelType logLevel, const char * msg, const char * str)
 {
     if (logLevel <= globalLogLevel) {
         waitForMutex();
@@ -141,7 +131,7 @@ void Logger::Log(LogLevelType logLevel, char * msg, const char * str)
     }
 }
 
-void Logger::Log(LogLevelType logLevel, char *msg, int value) {
+void Logger::Log(LogLevelType logLevel, const char *msg, int value) {
     if (logLevel <= globalLogLevel) {
         waitForMutex();
         {
@@ -153,7 +143,7 @@ void Logger::Log(LogLevelType logLevel, char *msg, int value) {
     }
 }
 
-void Logger::Log(LogLevelType logLevel, char *msg, int value, char* unit) {
+void Logger::Log(LogLevelType logLevel, const char *msg, int value, const char* unit) {
     if (logLevel <= globalLogLevel) {
         waitForMutex();
         {
@@ -190,17 +180,8 @@ void Logger::PrintLogLevel(LogLevelType logLevel) {
 }
 
 bool Logger::InitLoggingSystem() {
-    if (mutex == NULL) {
-        mutex = CreateMutex(
-            NULL,              // default security attributes
-            FALSE,             // initially not owned
-            NULL);             // unnamed mutex
-
-        if (mutex == NULL)
-        {
-            cout << "[FATAL]   Can't create mutex " << endl;
-            return false;
-        }
+    if (logMutex == nullptr) {
+        logMutex = new recursive_mutex();
     }
 
     globalLogLevel = LL_INFO;
@@ -209,9 +190,9 @@ bool Logger::InitLoggingSystem() {
 }
 
 bool Logger::DeinitLoggingSystem() {
-    if (mutex != NULL) {
-        CloseHandle(mutex);
-        mutex = NULL;
+    if (logMutex != nullptr) {
+        delete logMutex;
+        logMutex = nullptr;
     }
     return true;
 }
\ No newline at end of file
@@ -41,9 +41,9 @@ public:
 
     void SetReference(int packetNumber, PcapPacketHeaderType *pcapHeader);
     void Log(LogLevelType logLevel, const char *msg);
-    void Log(LogLevelType logLevel, char *msg, const char* str);
-    void Log(LogLevelType logLevel, char *msg, int value);
-    void Log(LogLevelType logLevel, char *msg, int value, char* unit);
+    void Log(LogLevelType logLevel, const char *msg, const char* str);
+    void Log(LogLevelType logLevel, const char *msg, int value);
+    void Log(LogLevelType logLevel, const char *msg, int value, const char* unit);
     
     void PrintLogLevel(LogLevelType logLevel);
 
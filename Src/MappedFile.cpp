@@ -0,0 +1,158 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(void)
+{
+    data = nullptr;
+    size = 0;
+    sequential = false;
+#ifdef _WIN32
+    fileHandle = INVALID_HANDLE_VALUE;
+    mappingHandle = nullptr;
+#else
+    fileDescriptor = -1;
+#endif
+}
+
+MappedFile::~MappedFile(void)
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+int MappedFile::Open(const char* fileName)
+{
+    Close();
+
+    fileHandle = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE || GetFileType(fileHandle) != FILE_TYPE_DISK) {
+        Close();
+        return -1;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+        Close();
+        return -1;
+    }
+    size = (uint64_t)fileSize.QuadPart;
+
+    // Fails on 32 bit builds if the file does not fit into the address space
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle == nullptr) {
+        Close();
+        return -1;
+    }
+    data = (const uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        Close();
+        return -1;
+    }
+
+    sequential = true;
+    return 0;
+}
+
+int MappedFile::Close()
+{
+    if (data != nullptr) {
+        UnmapViewOfFile(data);
+        data = nullptr;
+    }
+    if (mappingHandle != nullptr) {
+        CloseHandle(mappingHandle);
+        mappingHandle = nullptr;
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+    size = 0;
+    return 0;
+}
+
+void MappedFile::AdviseSequential(bool sequential)
+{
+    // The access pattern was declared with FILE_FLAG_SEQUENTIAL_SCAN on open
+    this->sequential = sequential;
+}
+
+#else
+
+int MappedFile::Open(const char* fileName)
+{
+    Close();
+
+    fileDescriptor = open(fileName, O_RDONLY);
+    if (fileDescriptor < 0) {
+        return -1;
+    }
+
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || !S_ISREG(fileStat.st_mode) || fileStat.st_size == 0) {
+        Close();
+        return -1;
+    }
+    size = (uint64_t)fileStat.st_size;
+
+    void* mapping = mmap(nullptr, (size_t)size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (mapping == MAP_FAILED) {
+        size = 0;
+        Close();
+        return -1;
+    }
+    data = (const uint8_t*)mapping;
+
+    AdviseSequential(true);
+    return 0;
+}
+
+int MappedFile::Close()
+{
+    if (data != nullptr) {
+        munmap((void*)data, (size_t)size);
+        data = nullptr;
+    }
+    if (fileDescriptor >= 0) {
+        close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+    size = 0;
+    return 0;
+}
+
+void MappedFile::AdviseSequential(bool sequential)
+{
+    if (data != nullptr && this->sequential != sequential) {
+        madvise((void*)data, (size_t)size, sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+    }
+    this->sequential = sequential;
+}
+
+#endif
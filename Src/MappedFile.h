@@ -0,0 +1,62 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Read-only mapping of a whole file. The pages are loaded on demand by the
+ * OS, so packets can be used in place without copying them out of the file.
+ * Mapping fails for pipes and other non-regular files.
+ */
+class MappedFile
+{
+private:
+    const uint8_t*  data;
+    uint64_t        size;
+    bool            sequential;
+
+#ifdef _WIN32
+    void*           fileHandle;
+    void*           mappingHandle;
+#else
+    int             fileDescriptor;
+#endif
+
+public:
+    MappedFile(void);
+    virtual ~MappedFile(void);
+
+    int Open(const char* fileName);
+    int Close();
+
+    // Read-ahead hint: sequential for streaming, normal for seeking around
+    void AdviseSequential(bool sequential);
+
+    bool IsOpen() const {
+        return data != nullptr;
+    }
+
+    const uint8_t* Data() const {
+        return data;
+    }
+
+    uint64_t Size() const {
+        return size;
+    }
+};
@@ -0,0 +1,134 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "MemoryBudget.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <string>
+
+// Larger limits of cgroup v1 mean there is none
+static const uint64_t UnlimitedCgroup = ((uint64_t)1) << 60;
+
+static MemoryBudget singleton;
+
+MemoryBudget::MemoryBudget()
+{
+    limit = 0;
+    reserved = 0;
+    releases = 0;
+}
+
+MemoryBudget::~MemoryBudget()
+{
+}
+
+MemoryBudget& MemoryBudget::GetMemoryBudget()
+{
+    return singleton;
+}
+
+// First number of a file, 0 if it is missing or says "max"
+static uint64_t ReadLimitFile(const string& fileName)
+{
+    ifstream file(fileName);
+    string value;
+    if (!(file >> value) || value.empty() || !isdigit((unsigned char)value[0])) {
+        return 0;
+    }
+    uint64_t limit = stoull(value);
+    return (limit >= UnlimitedCgroup) ? 0 : limit;
+}
+
+uint64_t MemoryBudget::CgroupLimit()
+{
+    // Lines are "0::/path" for cgroup v2 and "N:memory:/path" for the memory controller of v1
+    ifstream cgroups("/proc/self/cgroup");
+    string line;
+    uint64_t limit = 0;
+
+    while (limit == 0 && getline(cgroups, line)) {
+        size_t first = line.find(':');
+        size_t second = (first == string::npos) ? string::npos : line.find(':', first + 1);
+        if (second == string::npos) {
+            continue;
+        }
+        string controllers = line.substr(first + 1, second - first - 1);
+        string path = line.substr(second + 1);
+        if (path == "/") {
+            path.clear();
+        }
+
+        if (controllers.empty()) {
+            limit = ReadLimitFile("/sys/fs/cgroup" + path + "/memory.max");
+        }
+        else if (controllers.find("memory") != string::npos) {
+            limit = ReadLimitFile("/sys/fs/cgroup/memory" + path + "/memory.limit_in_bytes");
+        }
+    }
+
+    // Inside a container the own group is mounted as the root
+    if (limit == 0) {
+        limit = ReadLimitFile("/sys/fs/cgroup/memory.max");
+    }
+    if (limit == 0) {
+        limit = ReadLimitFile("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+    }
+    return limit;
+}
+
+void MemoryBudget::SetLimit(uint64_t limit)
+{
+    lock_guard<mutex> lock(budgetMutex);
+    this->limit = limit;
+}
+
+bool MemoryBudget::TryReserve(uint64_t wanted, uint64_t minimum, uint64_t* granted)
+{
+    lock_guard<mutex> lock(budgetMutex);
+    uint64_t available = (reserved < limit) ? limit - reserved : 0;
+
+    if (limit == 0 || wanted <= available) {
+        *granted = wanted;
+    }
+    else if (minimum <= available) {
+        *granted = available;
+    }
+    else if (reserved == 0) {
+        *granted = min(wanted, limit);
+    }
+    else {
+        return false;
+    }
+
+    reserved += *granted;
+    return true;
+}
+
+void MemoryBudget::Release(uint64_t bytes)
+{
+    lock_guard<mutex> lock(budgetMutex);
+    reserved -= bytes;
+    releases++;
+}
+
+uint64_t MemoryBudget::Releases()
+{
+    lock_guard<mutex> lock(budgetMutex);
+    return releases;
+}
@@ -0,0 +1,91 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+
+using namespace std;
+
+/**
+ * Memory limit of the whole process, shared by all jobs which run at the same time.
+ * A job reserves its estimated memory before it opens its output. While the others
+ * hold too much of it the job gives back its job slot and is retried once one of
+ * them has released its memory, see JobList. Without a limit every reservation is
+ * granted at once.
+ */
+class MemoryBudget
+{
+private:
+    uint64_t            limit;      // 0 = unlimited
+    uint64_t            reserved;
+    uint64_t            releases;   // Number of Release calls
+    mutex               budgetMutex;
+
+public:
+    MemoryBudget();
+    virtual ~MemoryBudget();
+
+    static MemoryBudget& GetMemoryBudget();
+
+    // Limit of the cgroup of this process (Linux), 0 if there is none
+    static uint64_t CgroupLimit();
+
+    void SetLimit(uint64_t limit);
+    uint64_t Limit() const {
+        return limit;
+    }
+
+    // Reserves wanted bytes if they are free. A job which can make do with less takes what
+    // is free once minimum bytes are. Running alone it gets at most the limit, it will never
+    // have more. Returns false without waiting if the others hold too much.
+    bool TryReserve(uint64_t wanted, uint64_t minimum, uint64_t* granted);
+    void Release(uint64_t bytes);
+
+    // Changes with every Release, e.g. to tell if memory was freed since a failed TryReserve
+    uint64_t Releases();
+};
+
+/**
+ * Bytes reserved from the MemoryBudget until the reservation goes out of scope.
+ */
+class MemoryReservation
+{
+private:
+    uint64_t bytes;
+
+public:
+    MemoryReservation() {
+        bytes = 0;
+    }
+    virtual ~MemoryReservation() {
+        if (bytes > 0) {
+            MemoryBudget::GetMemoryBudget().Release(bytes);
+        }
+    }
+
+    // See MemoryBudget::TryReserve
+    bool TryReserve(uint64_t wanted, uint64_t minimum) {
+        return MemoryBudget::GetMemoryBudget().TryReserve(wanted, minimum, &bytes);
+    }
+
+    uint64_t Bytes() const {
+        return bytes;
+    }
+};
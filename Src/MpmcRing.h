@@ -0,0 +1,116 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "WaitEvent.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+using namespace std;
+
+/**
+ * Bounded lock-free ring for any number of producer and consumer threads. Every
+ * slot carries a sequence number which tells whose turn it is, so producers and
+ * consumers only compete on their own index. Push blocks while the ring is full,
+ * a successful TryPop wakes it.
+ */
+template <typename T>
+class MpmcRing
+{
+private:
+    struct SlotType {
+        atomic<size_t>  sequence;
+        T               value;
+    };
+
+    unique_ptr<SlotType[]> slots;
+    size_t          mask;
+
+    alignas(64) atomic<size_t> head;    // Next slot to pop
+    alignas(64) atomic<size_t> tail;    // Next slot to push
+    WaitEvent       popped;
+
+public:
+    MpmcRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots.reset(new SlotType[size]);
+        for (size_t i = 0; i < size; i++) {
+            slots[i].sequence.store(i, memory_order_relaxed);
+        }
+        mask = size - 1;
+        head.store(0);
+        tail.store(0);
+    }
+
+    bool TryPush(T value) {
+        size_t position = tail.load(memory_order_relaxed);
+        while (true) {
+            SlotType& slot = slots[position & mask];
+            intptr_t turn = (intptr_t)slot.sequence.load(memory_order_acquire) - (intptr_t)position;
+            if (turn == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    slot.value = move(value);
+                    slot.sequence.store(position + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (turn < 0) {
+                return false;   // Full
+            }
+            else {
+                position = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(T& value) {
+        size_t position = head.load(memory_order_relaxed);
+        while (true) {
+            SlotType& slot = slots[position & mask];
+            intptr_t turn = (intptr_t)slot.sequence.load(memory_order_acquire) - (intptr_t)(position + 1);
+            if (turn == 0) {
+                if (head.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    value = move(slot.value);
+                    slot.sequence.store(position + mask + 1, memory_order_release);
+                    popped.Notify();
+                    return true;
+                }
+            }
+            else if (turn < 0) {
+                return false;   // Empty
+            }
+            else {
+                position = head.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    void Push(T value) {
+        popped.Wait([&]() { return TryPush(value); });
+    }
+
+    // A snapshot, other threads may change it right away
+    bool Empty() const {
+        return head.load(memory_order_acquire) == tail.load(memory_order_acquire);
+    }
+};
@@ -0,0 +1,106 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "PacketArena.h"
+
+PacketArena::PacketArena(void)
+{
+    current = 0;
+    chunkSize = DefaultChunkSize;
+    bytesHeld = 0;
+}
+
+PacketArena::~PacketArena(void)
+{
+    Clear();
+}
+
+void PacketArena::Init(size_t maxPacketLength)
+{
+    Clear();
+    chunkSize = (maxPacketLength > DefaultChunkSize) ? maxPacketLength : DefaultChunkSize;
+}
+
+void PacketArena::Clear()
+{
+    for (Chunk& chunk : chunks) {
+        delete[](chunk.memory);
+    }
+    chunks.clear();
+    freeChunks.clear();
+    current = 0;
+    bytesHeld = 0;
+}
+
+uint32_t PacketArena::NextChunk()
+{
+    if (!freeChunks.empty()) {
+        uint32_t chunk = freeChunks.back();
+        freeChunks.pop_back();
+        return chunk;
+    }
+
+    // Only grows while the window is filling up or a straggler pins a chunk
+    Chunk chunk;
+    chunk.memory = new uint8_t[chunkSize];
+    chunk.used = 0;
+    chunk.live = 0;
+    chunks.push_back(chunk);
+    return (uint32_t)(chunks.size() - 1);
+}
+
+uint8_t* PacketArena::Allocate(uint32_t length, uint32_t* chunk)
+{
+    if (chunks.empty()) {
+        current = NextChunk();
+    }
+    else if (chunks[current].used + length > chunkSize) {
+        if (chunks[current].live == 0) {
+            chunks[current].used = 0;
+        }
+        else {
+            current = NextChunk();
+        }
+    }
+
+    Chunk& target = chunks[current];
+    uint8_t* data = target.memory + target.used;
+    target.used += length;
+    target.live++;
+    bytesHeld += length;
+
+    *chunk = current;
+    return data;
+}
+
+void PacketArena::Release(uint32_t chunk, uint32_t length)
+{
+    if (chunk == NoChunk) {
+        return;
+    }
+
+    Chunk& target = chunks[chunk];
+    target.live--;
+    bytesHeld -= length;
+
+    if (target.live == 0) {
+        target.used = 0;
+        if (chunk != current) {
+            freeChunks.push_back(chunk);
+        }
+    }
+}
@@ -0,0 +1,74 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Slab storage for packet payloads. Payloads are placed back to back in large
+ * chunks, sized to the captured length of each packet. A chunk is recycled as
+ * soon as every packet stored in it was released, so once the window is
+ * filled no further heap allocations happen.
+ */
+class PacketArena
+{
+private:
+    struct Chunk {
+        uint8_t*    memory;
+        size_t      used;
+        size_t      live;
+    };
+
+    vector<Chunk>       chunks;
+    vector<uint32_t>    freeChunks;
+    uint32_t            current;
+    size_t              chunkSize;
+    size_t              bytesHeld;
+
+    uint32_t NextChunk();
+
+public:
+    static const size_t DefaultChunkSize = 4 * 1024 * 1024;
+    // Chunk of packets which are not held by the arena, Release ignores them
+    static const uint32_t NoChunk = UINT32_MAX;
+
+    PacketArena(void);
+    virtual ~PacketArena(void);
+
+    // Chunks are at least as large as the biggest packet (i.e. max. snap length)
+    void Init(size_t maxPacketLength);
+    void Clear();
+
+    uint8_t* Allocate(uint32_t length, uint32_t* chunk);
+    void Release(uint32_t chunk, uint32_t length);
+
+    size_t BytesHeld() const {
+        return bytesHeld;
+    }
+
+    size_t ChunkSize() const {
+        return chunkSize;
+    }
+
+    size_t BytesReserved() const {
+        return chunks.size() * chunkSize;
+    }
+};
@@ -0,0 +1,124 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "Platform.h"
+
+/* Helpers of the format specialized decoders in PcapReader */
+
+template <bool Swap>
+inline uint32_t ToHost(uint32_t value) {
+    return Swap ? _byteswap_ulong(value) : value;
+}
+
+template <bool Swap>
+inline uint16_t ToHost(uint16_t value) {
+    return Swap ? _byteswap_ushort(value) : value;
+}
+
+// Upper 64 bit of the 128 bit product
+inline uint64_t MultiplyHigh(uint64_t a, uint64_t b) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    return __umulh(a, b);
+#elif defined(__SIZEOF_INT128__)
+    return (uint64_t)(((unsigned __int128)a * b) >> 64);
+#else
+    uint64_t aLow = (uint32_t)a, aHigh = a >> 32;
+    uint64_t bLow = (uint32_t)b, bHigh = b >> 32;
+    uint64_t cross = (aLow * bLow >> 32) + (uint32_t)(aHigh * bLow) + aLow * bHigh;
+    return aHigh * bHigh + (aHigh * bLow >> 32) + (cross >> 32);
+#endif
+}
+
+// floor(a * b / c) for a < c by a 128 bit long division, for the rare resolutions
+// which are too fine for the multiply and shift of TimestampScaleType
+inline uint64_t MultiplyDivide(uint64_t a, uint64_t b, uint64_t c) {
+    uint64_t high = MultiplyHigh(a, b);
+    uint64_t low = a * b;
+    uint64_t quotient = 0;
+    uint64_t remainder = 0;
+    for (int bit = 127; bit >= 0; bit--) {
+        uint64_t carry = remainder >> 63;
+        remainder = (remainder << 1) | (((bit >= 64) ? (high >> (bit - 64)) : (low >> bit)) & 1);
+        quotient <<= 1;
+        if (carry || remainder >= c) {
+            remainder -= c;
+            quotient |= 1;
+        }
+    }
+    return quotient;
+}
+
+/**
+ * Splits timestamps of a fixed number of ticks per second into seconds and
+ * nanoseconds by a multiply and a shift instead of a division. Exact for all
+ * tick counts below 2^62, e.g. nanoseconds up to the year 2116, larger counts
+ * are divided.
+ */
+struct TimestampScaleType {
+    uint64_t    ticksPerSecond;
+    uint64_t    multiplier;     // floor(2^(63 + shift) / ticksPerSecond) + 1
+    uint32_t    shift;          // floor(log2(ticksPerSecond))
+};
+
+// Up to this resolution the fraction in nanoseconds is split by the same multiply and shift
+static const uint64_t MaxScaledTicksPerSecond = 4000000000;
+
+inline TimestampScaleType MakeTimestampScale(uint64_t ticksPerSecond) {
+    TimestampScaleType scale;
+    scale.ticksPerSecond = ticksPerSecond;
+    scale.shift = 0;
+    while ((ticksPerSecond >> (scale.shift + 1)) != 0) {
+        scale.shift++;
+    }
+
+    // Long division of 2^(63 + shift), the quotient fits into 64 bit
+    uint64_t quotient = 0;
+    uint64_t remainder = 0;
+    for (int bit = 63 + (int)scale.shift; bit >= 0; bit--) {
+        remainder = (remainder << 1) | ((bit == 63 + (int)scale.shift) ? 1 : 0);
+        quotient <<= 1;
+        if (remainder >= ticksPerSecond) {
+            remainder -= ticksPerSecond;
+            quotient |= 1;
+        }
+    }
+    scale.multiplier = quotient + 1;
+    return scale;
+}
+
+// value / ticksPerSecond for values below 2^62
+inline uint64_t DivideByScale(uint64_t value, const TimestampScaleType& scale) {
+    return MultiplyHigh(value << 1, scale.multiplier) >> scale.shift;
+}
+
+inline void SplitTimestamp(uint64_t ticks, const TimestampScaleType& scale, uint32_t* seconds, uint32_t* nanoseconds) {
+    // Only resolutions finer than nanoseconds reach 2^62 ticks before 2116
+    uint64_t quotient = (ticks < (((uint64_t)1) << 62)) ? DivideByScale(ticks, scale) : ticks / scale.ticksPerSecond;
+    uint64_t remainder = ticks - quotient * scale.ticksPerSecond;
+    *seconds = (uint32_t)quotient;
+
+    // remainder * 10^9 stays below 2^62 up to MaxScaledTicksPerSecond
+    if (scale.ticksPerSecond <= MaxScaledTicksPerSecond) {
+        *nanoseconds = (uint32_t)DivideByScale(remainder * 1000000000, scale);
+    }
+    else {
+        *nanoseconds = (uint32_t)MultiplyDivide(remainder, 1000000000, scale.ticksPerSecond);
+    }
+}
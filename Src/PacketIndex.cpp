@@ -0,0 +1,264 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "PacketIndex.h"
+#include "PcapReader.h"
+#include "PcapPacket.h"
+#include "Logger.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <queue>
+
+static const unsigned int RadixBits = 16;
+static const unsigned int RadixDigits = 64 / RadixBits;
+static const size_t RadixBuckets = ((size_t)1) << RadixBits;
+// Record headers decoded per read call
+static const size_t ReadBatchSize = 1024;
+
+PacketIndex::PacketIndex(void)
+{
+    endOffset = 0;
+}
+
+PacketIndex::~PacketIndex(void)
+{
+}
+
+int PacketIndex::Build(PcapReader* pcapReader)
+{
+    entries.clear();
+    return BuildRange(pcapReader, UINT64_MAX, entries, &endOffset);
+}
+
+int PacketIndex::Build(PcapReader* pcapReader, const char* fileName, unsigned int threadCount)
+{
+    // Sections and interfaces of PCAP-NG are only known to a scan from the start
+    if (threadCount <= 1 || pcapReader->IsPcapng()) {
+        return Build(pcapReader);
+    }
+
+    // Byte ranges which start at a record boundary
+    vector<uint64_t> bounds;
+    uint64_t fileSize = pcapReader->FileSize();
+    for (unsigned int i = 0; i < threadCount; i++) {
+        uint64_t bound = pcapReader->FindRecordStart(fileSize / threadCount * i);
+        if (bounds.empty() || bound > bounds.back()) {
+            bounds.push_back(bound);
+        }
+    }
+    bounds.push_back(UINT64_MAX);
+
+    size_t rangeCount = bounds.size() - 1;
+    vector<vector<PacketIndexEntry>> ranges(rangeCount);
+    vector<uint64_t> scanEnds(rangeCount, 0);
+    vector<int> results(rangeCount, 0);
+    TaskGroup workers;
+
+    Logger::GetLogger().Log(LL_DEBUG, "Index byte ranges in parallel: ", (int)rangeCount);
+    for (size_t i = 0; i < rangeCount; i++) {
+        workers.Run([&, i]() {
+            PcapReader rangeReader;
+            rangeReader.SetLogProgress(false);
+            if (rangeReader.Open(fileName) != 0 || rangeReader.SeekRecord(bounds[i]) != 0) {
+                results[i] = -1;
+                return;
+            }
+            results[i] = BuildRange(&rangeReader, bounds[i + 1], ranges[i], &scanEnds[i]);
+            rangeReader.Close();
+        });
+    }
+    workers.Wait();
+
+    // Each range must end exactly where the next one starts. Otherwise a boundary was
+    // found inside a payload, or a range could not be read. The sequential scan then
+    // decides, so the index is always the one of a single reader.
+    for (size_t i = 0; i < rangeCount; i++) {
+        if (results[i] != 0 || (i + 1 < rangeCount && scanEnds[i] != bounds[i + 1])) {
+            Logger::GetLogger().Log(LL_INFO, "The byte ranges of the index do not chain up. Index the input in one pass instead.");
+            ranges.clear();
+            if (pcapReader->Rewind() != 0) {
+                return -1;
+            }
+            return Build(pcapReader);
+        }
+    }
+
+    // Concatenate in file order
+    entries.clear();
+    for (size_t i = 0; i < rangeCount; i++) {
+        entries.insert(entries.end(), ranges[i].begin(), ranges[i].end());
+        vector<PacketIndexEntry>().swap(ranges[i]);
+    }
+    endOffset = scanEnds[rangeCount - 1];
+
+    return 0;
+}
+
+int PacketIndex::BuildRange(PcapReader* pcapReader, uint64_t rangeEnd, vector<PacketIndexEntry>& range, uint64_t* scanEnd)
+{
+    PacketBatch readBatch;
+    PacketIndexEntry entry;
+    int result;
+
+    while ((result = pcapReader->ReadPackets(readBatch, ReadBatchSize)) > 0) {
+        for (size_t i = 0; i < readBatch.headers.size(); i++) {
+            if (readBatch.offsets[i] >= rangeEnd) {
+                Logger::GetLogger().SetReference(0, nullptr);
+                *scanEnd = readBatch.offsets[i];
+                return 0;
+            }
+
+            entry.key = PacketSortKey(readBatch.headers[i]);
+            entry.offset = readBatch.offsets[i];
+            range.push_back(entry);
+        }
+    }
+    Logger::GetLogger().SetReference(0, nullptr);
+
+    // At the end of the file the reader points behind the last record
+    *scanEnd = pcapReader->RecordOffset();
+
+    return (result < 0) ? result : 0;
+}
+
+size_t PacketIndex::FindInOrderRuns(vector<PacketRunType>& runs, size_t minRunLength)
+{
+    size_t size = entries.size();
+    size_t packetsInRuns = 0;
+
+    // A record stays where it is if no earlier record is newer and no later record is older
+    vector<bool> notAfterSuccessors(size);
+    uint64_t suffixMin = UINT64_MAX;
+    for (size_t i = size; i > 0; i--) {
+        notAfterSuccessors[i - 1] = (entries[i - 1].key <= suffixMin);
+        suffixMin = min(suffixMin, entries[i - 1].key);
+    }
+
+    runs.clear();
+    uint64_t prefixMax = 0;
+    size_t runStart = 0;
+    for (size_t i = 0; i <= size; i++) {
+        bool settled = (i < size) && notAfterSuccessors[i] && (prefixMax <= entries[i].key);
+
+        if (!settled) {
+            if (i - runStart >= minRunLength) {
+                PacketRunType run;
+                run.first = runStart;
+                run.count = i - runStart;
+                run.offset = entries[runStart].offset;
+                run.length = ((i < size) ? entries[i].offset : endOffset) - run.offset;
+                runs.push_back(run);
+                packetsInRuns += run.count;
+            }
+            runStart = i + 1;
+        }
+
+        if (i < size) {
+            prefixMax = max(prefixMax, entries[i].key);
+        }
+    }
+
+    return packetsInRuns;
+}
+
+void PacketIndex::Sort(unsigned int threadCount)
+{
+    size_t size = entries.size();
+    vector<PacketIndexEntry> buffer(size);
+
+    if (threadCount <= 1 || size < threadCount) {
+        RadixSort(entries.data(), size, buffer.data());
+        return;
+    }
+
+    // Sort slices in parallel, each using its part of the buffer
+    vector<size_t> sliceStarts;
+    TaskGroup workers;
+    for (unsigned int i = 0; i <= threadCount; i++) {
+        sliceStarts.push_back(size / threadCount * i + ((i == threadCount) ? size % threadCount : 0));
+    }
+    for (unsigned int i = 0; i < threadCount; i++) {
+        workers.Run([&, i]() {
+            RadixSort(entries.data() + sliceStarts[i], sliceStarts[i + 1] - sliceStarts[i], buffer.data() + sliceStarts[i]);
+        });
+    }
+    workers.Wait();
+
+    // K-way merge, ties are taken from the earlier slice to stay stable
+    typedef pair<uint64_t, unsigned int> MergeEntry; // (key, slice)
+    priority_queue<MergeEntry, vector<MergeEntry>, greater<MergeEntry>> mergeHeap;
+    vector<size_t> heads(sliceStarts.begin(), sliceStarts.end() - 1);
+
+    for (unsigned int i = 0; i < threadCount; i++) {
+        if (heads[i] < sliceStarts[i + 1]) {
+            mergeHeap.push(MergeEntry(entries[heads[i]].key, i));
+        }
+    }
+
+    size_t position = 0;
+    while (!mergeHeap.empty()) {
+        unsigned int i = mergeHeap.top().second;
+        mergeHeap.pop();
+
+        buffer[position++] = entries[heads[i]++];
+        if (heads[i] < sliceStarts[i + 1]) {
+            mergeHeap.push(MergeEntry(entries[heads[i]].key, i));
+        }
+    }
+
+    entries.swap(buffer);
+}
+
+void PacketIndex::RadixSort(PacketIndexEntry* entries, size_t size, PacketIndexEntry* buffer)
+{
+    vector<size_t> histogram(RadixDigits * RadixBuckets, 0);
+
+    // One pass to count all digits at once
+    for (size_t i = 0; i < size; i++) {
+        for (unsigned int digit = 0; digit < RadixDigits; digit++) {
+            histogram[digit * RadixBuckets + ((entries[i].key >> (digit * RadixBits)) & (RadixBuckets - 1))]++;
+        }
+    }
+
+    PacketIndexEntry* source = entries;
+    PacketIndexEntry* target = buffer;
+
+    for (unsigned int digit = 0; digit < RadixDigits; digit++) {
+        size_t* counts = &histogram[digit * RadixBuckets];
+        unsigned int shift = digit * RadixBits;
+
+        // All keys share this digit, the pass would not change the order
+        if (size == 0 || counts[(entries[0].key >> shift) & (RadixBuckets - 1)] == size)
+            continue;
+
+        size_t position = 0;
+        for (size_t bucket = 0; bucket < RadixBuckets; bucket++) {
+            size_t count = counts[bucket];
+            counts[bucket] = position;
+            position += count;
+        }
+
+        for (size_t i = 0; i < size; i++) {
+            target[counts[(source[i].key >> shift) & (RadixBuckets - 1)]++] = source[i];
+        }
+        swap(source, target);
+    }
+
+    if (source != entries) {
+        copy(source, source + size, entries);
+    }
+}
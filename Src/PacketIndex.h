@@ -0,0 +1,87 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+class PcapReader;
+
+/* Consecutive records which are already at their final position in the output */
+struct PacketRunType {
+    size_t      first;      // Position of the first record, equal in input and output
+    size_t      count;
+    uint64_t    offset;     // Byte range of the records in the input file
+    uint64_t    length;
+};
+
+/* One 16 byte entry per packet: sort key and the offset of its record in the input */
+struct PacketIndexEntry {
+    uint64_t    key;
+    uint64_t    offset;
+};
+
+/**
+ * Compact index of all packets of a file. Built from the record headers only,
+ * so its size does not depend on the snap length or the payload sizes.
+ */
+class PacketIndex
+{
+private:
+    vector<PacketIndexEntry> entries;
+    uint64_t endOffset;
+
+    static int BuildRange(PcapReader* pcapReader, uint64_t rangeEnd, vector<PacketIndexEntry>& range, uint64_t* scanEnd);
+    static void RadixSort(PacketIndexEntry* entries, size_t size, PacketIndexEntry* buffer);
+
+public:
+    PacketIndex(void);
+    virtual ~PacketIndex(void);
+
+    // Scans all record headers of the reader and skips over the payloads
+    int Build(PcapReader* pcapReader);
+
+    // Same as above, but splits the file into threadCount byte ranges aligned to
+    // record boundaries, which are scanned in parallel by readers of their own
+    int Build(PcapReader* pcapReader, const char* fileName, unsigned int threadCount);
+
+    // Finds runs of at least minRunLength records which the sort will not move.
+    // Must be called before Sort as it relies on the input order.
+    size_t FindInOrderRuns(vector<PacketRunType>& runs, size_t minRunLength);
+
+    // Stable LSD radix sort on the 64 bit key. Digits which are equal for all
+    // entries (e.g. the upper bits of the seconds) are skipped. With more than
+    // one thread, slices are sorted in parallel and combined by a k-way merge
+    // which prefers the earlier slice on equal keys, so the result is the same.
+    void Sort(unsigned int threadCount = 1);
+
+    vector<PacketIndexEntry>& Entries() {
+        return entries;
+    }
+
+    size_t Size() const {
+        return entries.size();
+    }
+
+    // End of the last indexed record in the input file
+    uint64_t EndOffset() const {
+        return endOffset;
+    }
+};
@@ -0,0 +1,172 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "PathFilter.h"
+#include <cctype>
+
+// File names of Windows do not care about the case
+static bool SameChar(char a, char b)
+{
+#ifdef _WIN32
+    return tolower((unsigned char)a) == tolower((unsigned char)b);
+#else
+    return a == b;
+#endif
+}
+
+// Matches one character against the set which starts after the '[' at pattern. Returns
+// the position after the closing ']', or nullptr if the set is not closed.
+static const char* MatchSet(const char* pattern, char c, bool* matched)
+{
+    bool negate = (*pattern == '!' || *pattern == '^');
+    if (negate) {
+        pattern++;
+    }
+
+    *matched = false;
+    const char* p = pattern;
+    do {
+        if (*p == 0) {
+            return nullptr;
+        }
+        if (p[1] == '-' && p[2] != ']' && p[2] != 0) {
+            if ((unsigned char)c >= (unsigned char)p[0] && (unsigned char)c <= (unsigned char)p[2]) {
+                *matched = true;
+            }
+            p += 3;
+        }
+        else {
+            if (SameChar(*p, c)) {
+                *matched = true;
+            }
+            p++;
+        }
+    } while (*p != ']');
+
+    *matched = (*matched != negate);
+    return p + 1;
+}
+
+bool PathFilter::Match(const char* pattern, const char* text)
+{
+    while (*pattern != 0) {
+        if (pattern[0] == '*' && pattern[1] == '*') {
+            pattern += 2;
+            // "**/" also stands for no directory at all
+            if (*pattern == '/' && Match(pattern + 1, text)) {
+                return true;
+            }
+            for (const char* rest = text; ; rest++) {
+                if (Match(pattern, rest)) {
+                    return true;
+                }
+                if (*rest == 0) {
+                    return false;
+                }
+            }
+        }
+        if (*pattern == '*') {
+            pattern++;
+            for (const char* rest = text; ; rest++) {
+                if (Match(pattern, rest)) {
+                    return true;
+                }
+                if (*rest == 0 || *rest == '/') {
+                    return false;
+                }
+            }
+        }
+
+        if (*text == 0) {
+            return false;
+        }
+        if (*pattern == '?') {
+            if (*text == '/') {
+                return false;
+            }
+        }
+        else if (*pattern == '[' && *text != '/') {
+            bool matched;
+            const char* next = MatchSet(pattern + 1, *text, &matched);
+            if (next != nullptr) {
+                if (!matched) {
+                    return false;
+                }
+                pattern = next;
+                text++;
+                continue;
+            }
+            if (!SameChar(*pattern, *text)) {   // Not closed, a plain '['
+                return false;
+            }
+        }
+        else if (!SameChar(*pattern, *text)) {
+            return false;
+        }
+        pattern++;
+        text++;
+    }
+    return *text == 0;
+}
+
+void PathFilter::AddInclude(const string& pattern)
+{
+    includes.push_back(pattern);
+}
+
+void PathFilter::AddExclude(const string& pattern)
+{
+    excludes.push_back(pattern);
+}
+
+bool PathFilter::MatchesAny(const vector<string>& patterns, const string& relativePath)
+{
+    size_t slash = relativePath.rfind('/');
+    const char* name = relativePath.c_str() + ((slash == string::npos) ? 0 : slash + 1);
+
+    for (const string& pattern : patterns) {
+        const char* text = (pattern.find('/') == string::npos) ? name : relativePath.c_str();
+        if (Match(pattern.c_str(), text)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PathFilter::IncludesFile(const string& relativePath) const
+{
+    if (!includes.empty() && !MatchesAny(includes, relativePath)) {
+        return false;
+    }
+    return !MatchesAny(excludes, relativePath);
+}
+
+bool PathFilter::ExcludesDirectory(const string& relativePath) const
+{
+    return MatchesAny(excludes, relativePath);
+}
+
+bool PathFilter::IncludesPath(const string& relativePath) const
+{
+    for (size_t separator = relativePath.find('/'); separator != string::npos; separator = relativePath.find('/', separator + 1)) {
+        if (ExcludesDirectory(relativePath.substr(0, separator))) {
+            return false;
+        }
+    }
+    return IncludesFile(relativePath);
+}
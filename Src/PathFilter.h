@@ -0,0 +1,57 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Include and exclude glob patterns for the files of an input directory.
+ *
+ * Patterns are matched against the path relative to the input directory, with '/'
+ * between its parts. A pattern without a '/' is matched against the name only.
+ * '*' matches within one part, '**' across parts, '?' one character and [a-z] or
+ * [!a-z] one character of (or not of) a set. Excluded directories are skipped.
+ */
+class PathFilter
+{
+private:
+    vector<string> includes;
+    vector<string> excludes;
+
+    static bool MatchesAny(const vector<string>& patterns, const string& relativePath);
+
+public:
+    void AddInclude(const string& pattern);
+    void AddExclude(const string& pattern);
+
+    bool IsEmpty() const {
+        return includes.empty() && excludes.empty();
+    }
+
+    // A file is taken if it matches an include pattern (or there are none) and no exclude pattern
+    bool IncludesFile(const string& relativePath) const;
+    bool ExcludesDirectory(const string& relativePath) const;
+    // Like IncludesFile, and none of the directories above the file is excluded
+    bool IncludesPath(const string& relativePath) const;
+
+    static bool Match(const char* pattern, const char* text);
+};
@@ -132,7 +132,8 @@ typedef enum {
     if_filter = 11,
     if_os = 12,
     if_fcslen = 13,
-    if_tsoffset = 14
+    if_tsoffset = 14,
+    if_hardware = 15
 } PcapngIfOptionCodesType;
 
 typedef enum {
@@ -151,5 +152,7 @@ typedef enum {
     interfaceDescription =  0x00000001,
     enhancedPacket =        0x00000006,
     simplePacket =          0x00000003,
-    packet =                0x00000002
+    packet =                0x00000002,
+    nameResolution =        0x00000004,
+    interfaceStatistics =   0x00000005
 } PcapngBlockTypesType;
\ No newline at end of file
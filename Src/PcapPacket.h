@@ -0,0 +1,77 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "PcapFormat.h"
+#include <vector>
+
+using namespace std;
+
+/* In-memory representation of a packet while it is held by the sorter */
+struct PcapPacketHdrData {
+    PcapPacketHeaderType hdr;
+    const uint8_t* data;    // Points into the PacketArena of the job or the mapped input
+    const uint8_t* record;  // Whole record as read, the payload lies within
+    uint32_t    recordLength;   // Bytes held for the packet
+    uint32_t    chunk;      // Arena chunk which holds the data, NoChunk for a view
+    uint64_t    key;        // Sort key derived from the timestamp
+    uint64_t    sequence;   // Read order, keeps packets with equal timestamps stable
+    uint32_t    interfaceId;    // Interface of the packet in its reader, see PcapReader::GetInterface
+};
+
+/* Capture interface of packets, a PCAP-NG interface description block or the header of a classic PCAP file */
+struct PcapInterfaceType {
+    uint16_t        linkType;
+    uint32_t        snapLength;     // 0 if unlimited
+    uint64_t        ticksPerSecond; // Timestamp resolution (if_tsresol)
+    int64_t         offsetSeconds;  // Added to every timestamp (if_tsoffset)
+    vector<uint8_t> options;        // Other options in host byte order, without opt_endofopt
+    vector<uint8_t> block;          // Original description block, only if the records of the interface
+                                    // can be copied unchanged (first PCAP-NG section in host byte order)
+};
+
+/* Packets decoded by one PcapReader::ReadPackets call, one entry per packet in each vector */
+struct PacketBatch {
+    vector<PcapPacketHeaderType>    headers;
+    vector<const uint8_t*>          data;       // Payload views into the reader
+    vector<uint64_t>                offsets;    // Record offsets in the input file
+    vector<uint32_t>                interfaceIds;
+    vector<const uint8_t*>          records;    // Whole records as read, e.g. to copy them unchanged
+    vector<uint32_t>                recordLengths;
+
+    void Clear() {
+        headers.clear();
+        data.clear();
+        offsets.clear();
+        interfaceIds.clear();
+        records.clear();
+        recordLengths.clear();
+    }
+};
+
+// Seconds in the upper and (micro- or nano-) fraction in the lower half.
+// Compares exactly like the lexicographic (seconds, fraction) order.
+inline uint64_t PacketSortKey(const PcapPacketHeaderType& hdr) {
+    return (((uint64_t)hdr.timestampSeconds) << 32) | hdr.timestampMicroSeconds;
+}
+
+// Nanoseconds since epoch, comparable between inputs of different resolution
+inline uint64_t PacketTimeNs(const PcapPacketHeaderType& hdr, bool nanoseconds) {
+    uint64_t fraction = nanoseconds ? hdr.timestampMicroSeconds : ((uint64_t)hdr.timestampMicroSeconds) * 1000;
+    return ((uint64_t)hdr.timestampSeconds) * 1000000000 + fraction;
+}
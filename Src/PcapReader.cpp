@@ -16,12 +16,32 @@
  */
 
 #include "PcapReader.h"
-#include <intrin.h>
+#include "Platform.h"
 #include "Logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Number of consecutive records which must be valid to accept a resync position
+static const uint32_t ResyncRecords = 8;
+// Max. distance of timestamps in a resync chain from the first packet (30 days)
+static const uint32_t ResyncMaxSeconds = 30 * 24 * 3600;
+// Size of the read buffer if the input is streamed instead of mapped
+static const size_t StreamBufferSize = 1024 * 1024;
+// Largest record header in front of the payload (PCAP-NG enhanced packet block)
+static const size_t MaxRecordHeaderLength = sizeof(PcapngEnhancedPacketBlockType);
+// Packet length limit of PCAP-NG interfaces with a snap length of 0
+static const uint32_t MaxUnlimitedSnapLength = 262144;
 
 
 PcapReader::PcapReader(void)
 {
+    asyncQueueDepth = 0;
+    asyncBufferSize = 0;
+    logProgress = true;
     Close();
 }
 
@@ -34,127 +54,118 @@ PcapReader::~PcapReader(void)
 int PcapReader::Open(const char* fileName) {
     Close();
 
-    file = ifstream(fileName, ios::in | ios::binary | ios::ate);
-    if(!file.is_open()) {
-        Logger::GetLogger().Log(LL_ERROR, "Can not open input PCAP file");
-        return -1;
-    }
-
-    fileSize = (unsigned int) file.tellg();
-    file.seekg(0, ios::beg);
-    lastInfoPrint = -1;
-
-    memset(&pcapHeader, 0, sizeof(pcapHeader));
-    file.read((char*) &pcapHeader, sizeof(pcapHeader));
-    
-    if (pcapHeader.magicNumber == PcapngBlockTypesType::sectionHeader) {
-        isPcapng = true;
-
-        // Parse Section Header Block
-        PcapngSectionHeaderBlockType sectionHeaderBlock;
-        file.seekg(0, ios::beg);
-        file.read((char*)&sectionHeaderBlock, sizeof(sectionHeaderBlock));
-        if (sectionHeaderBlock.magicNumber == 0x1A2B3C4D) {
-            swapByteOrder = false;
+    error_code errorCode;
+    if (asyncQueueDepth > 0 && fs::is_regular_file(fileName, errorCode) && uringFile.OpenRead(fileName, asyncQueueDepth, asyncBufferSize) == 0) {
+        fileSize = fs::file_size(fileName, errorCode);
+        if (errorCode) {
+            fileSize = 0;
         }
-        else if (sectionHeaderBlock.magicNumber == 0x4D3C2B1A) {
-            swapByteOrder = true;
+        isSeekable = true;
+        Logger::GetLogger().Log(LL_DEBUG, "Input is read ahead by io_uring");
+    }
+    else if (mappedFile.Open(fileName) == 0) {
+        if (asyncQueueDepth > 0) {
+            Logger::GetLogger().Log(LL_DEBUG, "io_uring is not available, map the input instead");
         }
-        else {
-            Logger::GetLogger().Log(LL_ERROR, "Not a valid PCAP-NG file. Magic number is wrong");
-            Close();
+        fileSize = mappedFile.Size();
+        isSeekable = true;
+    }
+    else {
+        file = ifstream(fileName, ios::in | ios::binary);
+        if (!file.is_open()) {
+            Logger::GetLogger().Log(LL_ERROR, "Can not open input PCAP file");
             return -1;
         }
-        file.seekg(sectionHeaderBlock.block.blockTotalLength - sizeof(sectionHeaderBlock), ios::cur);
+        Logger::GetLogger().Log(LL_DEBUG, "Input can not be mapped, read it as a stream");
 
-        if (swapByteOrder) {
-            sectionHeaderBlock.block.blockTotalLength = _byteswap_ulong(sectionHeaderBlock.block.blockTotalLength);
-            sectionHeaderBlock.versionMajor = _byteswap_ushort(sectionHeaderBlock.versionMajor);
-            sectionHeaderBlock.versionMinor = _byteswap_ushort(sectionHeaderBlock.versionMinor);
+        isSeekable = fs::is_regular_file(fileName, errorCode);
+        fileSize = isSeekable ? fs::file_size(fileName, errorCode) : 0;
+        if (errorCode) {
+            fileSize = 0;
         }
+    }
+    isOpen = true;
+    position = 0;
+    lastInfoPrint = -1;
 
-        // Fill pcapHeader for compatibility
-        pcapHeader.versionMajor = sectionHeaderBlock.versionMajor;
-        pcapHeader.versionMinor = sectionHeaderBlock.versionMinor;
-
-        // Parse Interface Description Block
-        PcapngInterfaceDescriptionBlockType ifDescBlock;
-        file.read((char*)&ifDescBlock, sizeof(ifDescBlock));
-        if (swapByteOrder) {
-            ifDescBlock.block.blockType = _byteswap_ulong(ifDescBlock.block.blockType);
-            ifDescBlock.block.blockTotalLength = _byteswap_ulong(ifDescBlock.block.blockTotalLength);
-            ifDescBlock.linkType = _byteswap_ushort(ifDescBlock.linkType);
-            ifDescBlock.snapLen = _byteswap_ulong(ifDescBlock.snapLen);
+    // A compressed capture is parsed like a pipe, its decompressor takes over the file
+    size_t available;
+    const uint8_t* magic = Peek(4, &available);
+    CompressedFile::CompressionType compression = CompressedFile::Detect(magic, available);
+    if (compression != CompressedFile::CT_NONE) {
+        int result;
+        if (file.is_open()) {
+            result = compressedFile.Open(&file, magic, available, compression);
         }
-
-        if (ifDescBlock.block.blockType != PcapngBlockTypesType::interfaceDescription) {
-            Logger::GetLogger().Log(LL_ERROR, "Not a valid PCAP-NG file. Interface-Description-Block is missing");
-            Close();
-            return -1;
+        else {
+            mappedFile.Close();
+            uringFile.Close();
+            result = compressedFile.Open(fileName, compression);
         }
-
-        if (ifDescBlock.linkType != 1) {
-            Logger::GetLogger().Log(LL_ERROR, "Not an useable PCAP-NG file. LinkType is not Ethernet (1)");
+        if (result != 0) {
             Close();
             return -1;
         }
+        Logger::GetLogger().Log(LL_INFO, "Input is decompressed while it is read: ", CompressedFile::Name(compression));
 
-        // Fill pcapHeader for compatibility
-        pcapHeader.maxSnapLength = ifDescBlock.snapLen;
-        pcapHeader.timestampAccuracy = 0;
-        pcapHeader.timezone = 0;
-        pcapHeader.network = ifDescBlock.linkType;
-        timeInMicros = true;
+        isSeekable = false;
+        fileSize = 0;
+        bufferBegin = 0;
+        bufferEnd = 0;
+    }
 
-        // Iterate over options
-        uint32_t remOptionsLen = ifDescBlock.block.blockTotalLength - sizeof(PcapngInterfaceDescriptionBlockType) - 4;
+    memset(&pcapHeader, 0, sizeof(pcapHeader));
+    ReadBytes(&pcapHeader, sizeof(pcapHeader));
+    
+    if (pcapHeader.magicNumber == PcapngBlockTypesType::sectionHeader) {
+        isPcapng = true;
+        timeInMicros = false;   // Every interface is converted to nanoseconds
 
-        while (remOptionsLen > 0) {
-            PcapngOptionType option;
-            file.read((char*)&option, sizeof(option));
-            remOptionsLen -= sizeof(option);
+        // Fill pcapHeader for compatibility
+        memset(&pcapHeader, 0, sizeof(pcapHeader));
 
-            if (swapByteOrder) {
-                option.optionCode = _byteswap_ushort(option.optionCode);
-                option.optionLength = _byteswap_ushort(option.optionLength);
+        // The section header is still buffered. Read it and all blocks in front
+        // of the first packet like any other block, which fills the tables.
+        SeekTo(0);
+        while (true) {
+            size_t available;
+            const uint8_t* record = Peek(sizeof(PcapngBlockType), &available);
+            if (available < sizeof(PcapngBlockType)) {
+                break;
             }
 
-            switch (option.optionCode) {
-            case PcapngIfOptionCodesType::if_tsresol:
-                uint8_t tsresol;
-                file.read((char*)&tsresol, sizeof(tsresol));
-                remOptionsLen -= sizeof(tsresol);
-
-                if (tsresol & 0x80) {
-                    Logger::GetLogger().Log(LL_WARNING, "Unknown time resolution. Assume microseconds");
-                }
-                else {
-                    if (tsresol != 6 && tsresol != 9) {
-                        Logger::GetLogger().Log(LL_WARNING, "Unknown time resolution. Assume microseconds");
-                    }
-                    else if (tsresol == 9) {
-                        timeInMicros = false; // In nanoseconds
-                    }
-                }
+            uint32_t blockType;
+            memcpy(&blockType, record, sizeof(blockType));
+            blockType = swapByteOrder ? _byteswap_ulong(blockType) : blockType;
+            if (!sections.empty() && (blockType == PcapngBlockTypesType::enhancedPacket || blockType == PcapngBlockTypesType::simplePacket || blockType == PcapngBlockTypesType::packet)) {
                 break;
+            }
 
-            case PcapngIfOptionCodesType::if_tzone:
-                int32_t timezone;
-                file.read((char*)&timezone, sizeof(timezone));
-                remOptionsLen -= sizeof(timezone);
-                if (swapByteOrder)
-                    timezone = _byteswap_ulong(timezone);
-                pcapHeader.timezone = timezone;
-                break;
+            if (ReadBlock() != 0) {
+                Logger::GetLogger().Log(LL_ERROR, "Not a valid PCAP-NG file. Can not read the blocks in front of the first packet");
+                Close();
+                return -1;
+            }
+        }
 
-            default:
-                if (option.optionLength & 0x0003) {
-                    option.optionLength = (option.optionLength & 0xFFFC) + 4;
-                }
-                file.seekg(option.optionLength, ios::cur);
+        if (interfaces.empty() && position < fileSize) {
+            Logger::GetLogger().Log(LL_ERROR, "Not a valid PCAP-NG file. Interface-Description-Block is missing");
+            Close();
+            return -1;
+        }
+        Logger::GetLogger().Log(LL_DEBUG, "PCAP-NG interfaces in front of the first packet: ", (int)interfaces.size());
+
+        // A preamble of host byte order is copied to the output if the records are kept as they are.
+        // Streamed input still holds it if it fits into the read buffer.
+        if (!swapByteOrder && sections.size() == 1) {
+            if (mappedFile.IsOpen()) {
+                preamble.assign(mappedFile.Data(), mappedFile.Data() + position);
+            }
+            else if (bufferBegin == position) {
+                preamble.assign(streamBuffer.data(), streamBuffer.data() + bufferBegin);
             }
         }
-        file.seekg(4, ios::cur);
+        preambleInterfaces = interfaces.size();
     }
     else {
         isPcapng = false;
@@ -189,197 +200,980 @@ int PcapReader::Open(const char* fileName) {
             pcapHeader.maxSnapLength = _byteswap_ulong(pcapHeader.maxSnapLength);
             pcapHeader.network = _byteswap_ulong(pcapHeader.network);
         }
+
+        // The file header describes the only interface
+        PcapInterfaceType interface;
+        interface.linkType = (uint16_t)pcapHeader.network;
+        interface.snapLength = pcapHeader.maxSnapLength;
+        interface.ticksPerSecond = timeInMicros ? 1000000 : 1000000000;
+        interface.offsetSeconds = 0;
+        AddInterface(interface);
     }
 
+    SelectDecoders();
     packetNumber = 0;
+    pcapngSkip = 0;
+    pendingDataLength = 0;
+    firstRecordOffset = position;
+    recordOffset = firstRecordOffset;
+
+    // Reference for the plausibility check of FindRecordStart
+    firstTimestampSeconds = 0;
+    if (!isPcapng && isSeekable) {
+        PcapPacketHeaderType firstHeader;
+        if (ReadBytes(&firstHeader, sizeof(firstHeader))) {
+            firstTimestampSeconds = swapByteOrder ? _byteswap_ulong(firstHeader.timestampSeconds) : firstHeader.timestampSeconds;
+        }
+        SeekTo(firstRecordOffset);
+    }
     return 0;
 }
 
 int PcapReader::Close() {
+    compressedFile.Close();     // Reads from file, so it stops first
+    mappedFile.Close();
+    uringFile.Close();
     if(file.is_open()) {
         file.close();
-        fileSize = 0;
-        lastInfoPrint = -1;
     }
+    isOpen = false;
+    isSeekable = false;
+    isPcapng = false;
+    swapByteOrder = false;
+    fileSize = 0;
+    position = 0;
+    bufferBegin = 0;
+    bufferEnd = 0;
+    lastInfoPrint = -1;
+    lastInterfaceId = 0;
+
+    lock_guard<mutex> lock(interfaceMutex);
+    interfaces.clear();
+    interfaceScales.clear();
+    sections.clear();
+    sectionInterfaceBase = 0;
+    blocksParsedEnd = 0;
+    preamble.clear();
+    preambleInterfaces = 0;
+    recordView = nullptr;
+    recordViewLength = 0;
     return 0;
 }
 
+const uint8_t* PcapReader::Peek(size_t length, size_t* available) {
+
+    if (mappedFile.IsOpen()) {
+        *available = (size_t)min<uint64_t>(fileSize - position, SIZE_MAX);
+        return mappedFile.Data() + position;
+    }
+
+    if (bufferEnd - bufferBegin < length) {
+        // Keep the unread rest and fill up the buffer behind it
+        if (bufferBegin > 0) {
+            memmove(streamBuffer.data(), streamBuffer.data() + bufferBegin, bufferEnd - bufferBegin);
+            bufferEnd -= bufferBegin;
+            bufferBegin = 0;
+        }
+        if (streamBuffer.size() < max(length, StreamBufferSize)) {
+            streamBuffer.resize(max(length, StreamBufferSize));
+        }
+
+        while (bufferEnd < length) {
+            size_t count = StreamRead(streamBuffer.data() + bufferEnd, streamBuffer.size() - bufferEnd);
+            if (count == 0) {
+                break;
+            }
+            bufferEnd += count;
+        }
+    }
+
+    *available = bufferEnd - bufferBegin;
+    return streamBuffer.data() + bufferBegin;
+}
+
+void PcapReader::Consume(size_t length) {
+
+    position += length;
+    if (!mappedFile.IsOpen()) {
+        bufferBegin += length;
+    }
+}
+
+size_t PcapReader::StreamRead(uint8_t* target, size_t length) {
+
+    if (compressedFile.IsOpen()) {
+        return compressedFile.Read(target, length);
+    }
+    if (uringFile.IsOpen()) {
+        return uringFile.Read(target, length);
+    }
+
+    file.read((char*)target, length);
+    return (size_t)file.gcount();
+}
+
+bool PcapReader::StreamSeek(uint64_t offset) {
+
+    if (compressedFile.IsOpen()) {
+        return false;
+    }
+    if (uringFile.IsOpen()) {
+        return uringFile.Seek(offset) == 0;
+    }
+
+    file.clear();
+    file.seekg(offset, ios::beg);
+    return !file.fail();
+}
+
+bool PcapReader::ReadBytes(void* target, size_t length) {
+
+    size_t available;
+    const uint8_t* source = Peek(length, &available);
+    if (available < length) {
+        Consume(available);
+        return false;
+    }
+
+    memcpy(target, source, length);
+    Consume(length);
+    return true;
+}
+
+void PcapReader::SkipBytes(uint64_t length) {
+
+    if (mappedFile.IsOpen()) {
+        position = min(position + length, fileSize);
+        return;
+    }
+
+    if (length <= bufferEnd - bufferBegin) {
+        Consume((size_t)length);
+        return;
+    }
+
+    // Skip behind the buffered bytes
+    length -= bufferEnd - bufferBegin;
+    Consume(bufferEnd - bufferBegin);
+    bufferBegin = 0;
+    bufferEnd = 0;
+
+    if (isSeekable) {
+        position += length;
+        StreamSeek(position);
+    }
+    else {
+        // A pipe can only be read, not seeked
+        if (streamBuffer.size() < StreamBufferSize) {
+            streamBuffer.resize(StreamBufferSize);
+        }
+        while (length > 0) {
+            size_t count = StreamRead(streamBuffer.data(), (size_t)min<uint64_t>(length, streamBuffer.size()));
+            if (count == 0) {
+                break;
+            }
+            position += count;
+            length -= count;
+        }
+    }
+}
+
+bool PcapReader::SeekTo(uint64_t offset) {
+
+    if (mappedFile.IsOpen()) {
+        if (offset > fileSize) {
+            return false;
+        }
+        if (offset < position) {
+            mappedFile.AdviseSequential(false); // No longer a straight scan, e.g. the second pass of the index sort
+        }
+        position = offset;
+        return true;
+    }
+
+    // Still within the read buffer, e.g. records close to each other in the index sort
+    uint64_t bufferOffset = position - bufferBegin;
+    if (offset >= bufferOffset && offset <= bufferOffset + bufferEnd) {
+        bufferBegin = (size_t)(offset - bufferOffset);
+        position = offset;
+        return true;
+    }
+
+    if (!isSeekable) {
+        return false;
+    }
+    bufferBegin = 0;
+    bufferEnd = 0;
+    position = offset;
+    return StreamSeek(offset);
+}
+
 int PcapReader::ReadPacket(PcapPacketHeaderType *packetHeader, uint8_t *packetData) {
 
-    uint32_t pcapng_skip = 0;
+    int result = ReadPacketHeader(packetHeader);
+    if (result <= 0) {
+        return result;
+    }
 
-    if(!file.is_open()) {
-        return -1;
+    int dataResult = ReadPacketData(packetData);
+    if (dataResult < 0) {
+        return dataResult;
     }
 
-    Logger::GetLogger().SetReference(packetNumber, nullptr);
+    return result;
+}
 
-    if (isPcapng) {
-        PcapngBlockType block;
-        file.read((char*)&block, sizeof(block));
-        if (file.eof()) {
-            Logger::GetLogger().Log(LL_INFO, "Read Progress ", 100, "%");
+template <bool Swap>
+int PcapReader::DecodeClassicRecord(const uint8_t* record, size_t available, PcapPacketHeaderType* packetHeader, uint32_t* interfaceId, uint32_t* dataOffset, uint32_t* recordLength) {
+
+    if (available < sizeof(PcapPacketHeaderType)) {
+        return 0;
+    }
+    memcpy(packetHeader, record, sizeof(PcapPacketHeaderType));
+    packetHeader->timestampSeconds = ToHost<Swap>(packetHeader->timestampSeconds);
+    packetHeader->timestampMicroSeconds = ToHost<Swap>(packetHeader->timestampMicroSeconds);
+    packetHeader->packetLength = ToHost<Swap>(packetHeader->packetLength);
+    packetHeader->originalLength = ToHost<Swap>(packetHeader->originalLength);
+
+    *interfaceId = 0;
+    *dataOffset = sizeof(PcapPacketHeaderType);
+    *recordLength = sizeof(PcapPacketHeaderType) + packetHeader->packetLength;
+    return (packetHeader->packetLength > pcapHeader.maxSnapLength) ? -3 : 1;
+}
+
+// Enhanced and obsolete packet blocks share the fields behind the interface.
+// The timestamp is converted to nanoseconds with the values of its interface.
+template <bool Swap, typename BlockType>
+int PcapReader::DecodeTimedBlock(const uint8_t* record, PcapPacketHeaderType* packetHeader, uint32_t* interfaceId) {
+
+    BlockType packet;
+    memcpy(&packet, record, sizeof(packet));
+
+    size_t index = sectionInterfaceBase + ToHost<Swap>(packet.interfaceId);
+    if (index >= interfaceScales.size()) {
+        return -4;
+    }
+    const InterfaceScaleType& interface = interfaceScales[index];
+
+    uint64_t timestamp = (((uint64_t)ToHost<Swap>(packet.timestampHigh)) << 32) | ToHost<Swap>(packet.timestampLow);
+    SplitTimestamp(timestamp, interface.scale, &packetHeader->timestampSeconds, &packetHeader->timestampMicroSeconds);
+    packetHeader->timestampSeconds += (uint32_t)interface.offsetSeconds;
+    packetHeader->packetLength = ToHost<Swap>(packet.capturedLen);
+    packetHeader->originalLength = ToHost<Swap>(packet.packetLen);
+
+    *interfaceId = (uint32_t)index;
+    return (packetHeader->packetLength > interface.maxPacketLength) ? -3 : 1;
+}
+
+template <bool Swap>
+int PcapReader::DecodePcapngRecord(const uint8_t* record, size_t available, PcapPacketHeaderType* packetHeader, uint32_t* interfaceId, uint32_t* dataOffset, uint32_t* recordLength) {
+
+    PcapngBlockType block;
+    if (available < sizeof(block)) {
+        return 0;
+    }
+    memcpy(&block, record, sizeof(block));
+    *recordLength = ToHost<Swap>(block.blockTotalLength);
+
+    int result;
+    switch (ToHost<Swap>(block.blockType)) {
+    case PcapngBlockTypesType::enhancedPacket:
+        if (available < sizeof(PcapngEnhancedPacketBlockType)) {
+            return 0;
+        }
+        result = DecodeTimedBlock<Swap, PcapngEnhancedPacketBlockType>(record, packetHeader, interfaceId);
+        *dataOffset = sizeof(PcapngEnhancedPacketBlockType);
+        break;
+
+    case PcapngBlockTypesType::simplePacket:
+    {
+        PcapngSimplePacketBlockType packet;
+        if (available < sizeof(packet)) {
+            return 0;
+        }
+        memcpy(&packet, record, sizeof(packet));
+
+        // Simple packets belong to the first interface of the section and have no timestamp
+        if (sectionInterfaceBase >= interfaceScales.size()) {
+            return -4;
+        }
+        packetHeader->timestampSeconds = 0;
+        packetHeader->timestampMicroSeconds = 0;
+        packetHeader->packetLength = *recordLength - sizeof(packet) - 4;
+        packetHeader->originalLength = ToHost<Swap>(packet.packetLen);
+        *interfaceId = (uint32_t)sectionInterfaceBase;
+        *dataOffset = sizeof(packet);
+        result = (packetHeader->packetLength > interfaceScales[sectionInterfaceBase].maxPacketLength) ? -3 : 1;
+    }
+        break;
+
+    case PcapngBlockTypesType::packet:
+        if (available < sizeof(PcapngPacketBlockType)) {
             return 0;
         }
+        result = DecodeTimedBlock<Swap, PcapngPacketBlockType>(record, packetHeader, interfaceId);
+        *dataOffset = sizeof(PcapngPacketBlockType);
+        break;
+
+    default:
+        return -1;
+    }
+
+    // The payload and the trailing length must fit into the block
+    if (result == 1 && (uint64_t)*dataOffset + packetHeader->packetLength + 4 > *recordLength) {
+        return -3;
+    }
+    return result;
+}
+
+template <PcapReader::RecordDecoderType Decode>
+size_t PcapReader::DecodeBatch(const uint8_t* buffer, size_t available, PacketBatch& batch, size_t maxPackets) {
+
+    PcapPacketHeaderType packetHeader;
+    uint32_t interfaceId;
+    uint32_t dataOffset;
+    uint32_t recordLength;
+    size_t used = 0;
+
+    while (batch.headers.size() < maxPackets) {
+        if ((this->*Decode)(buffer + used, available - used, &packetHeader, &interfaceId, &dataOffset, &recordLength) <= 0 || recordLength > available - used) {
+            break;
+        }
+        batch.headers.push_back(packetHeader);
+        batch.data.push_back(buffer + used + dataOffset);
+        batch.offsets.push_back(position + used);
+        batch.interfaceIds.push_back(interfaceId);
+        batch.records.push_back(buffer + used);
+        batch.recordLengths.push_back(recordLength);
+        used += recordLength;
+    }
+
+    return used;
+}
 
+void PcapReader::SelectDecoders() {
+
+    // One instantiation per format and byte order, no per packet checks of either.
+    // A PCAP-NG section of the other byte order selects them again.
+    if (isPcapng) {
+        if (swapByteOrder) {
+            recordDecoder = &PcapReader::DecodePcapngRecord<true>;
+            batchDecoder = &PcapReader::DecodeBatch<&PcapReader::DecodePcapngRecord<true>>;
+        }
+        else {
+            recordDecoder = &PcapReader::DecodePcapngRecord<false>;
+            batchDecoder = &PcapReader::DecodeBatch<&PcapReader::DecodePcapngRecord<false>>;
+        }
+    }
+    else {
+        // The fraction of classic PCAP is stored in the unit of the file (micro- or nanoseconds)
         if (swapByteOrder) {
-            block.blockType = _byteswap_ulong(block.blockType);
-            block.blockTotalLength = _byteswap_ulong(block.blockTotalLength);
+            recordDecoder = &PcapReader::DecodeClassicRecord<true>;
+            batchDecoder = &PcapReader::DecodeBatch<&PcapReader::DecodeClassicRecord<true>>;
+        }
+        else {
+            recordDecoder = &PcapReader::DecodeClassicRecord<false>;
+            batchDecoder = &PcapReader::DecodeBatch<&PcapReader::DecodeClassicRecord<false>>;
         }
+    }
+}
 
-        switch (block.blockType) {
-        case PcapngBlockTypesType::sectionHeader:
-            Logger::GetLogger().Log(LL_WARNING, "Unexpected section-header-block in PCAP-NG");
-            file.seekg(block.blockTotalLength - sizeof(block), ios::cur);
-            return -1;
+int PcapReader::ReadBlock() {
+
+    size_t available;
+    const uint8_t* record = Peek(sizeof(PcapngSectionHeaderBlockType), &available);
+    uint64_t blockOffset = position;
+    if (available < sizeof(PcapngBlockType)) {
+        Consume(available); // Truncated at the end of the file
+        return 0;
+    }
+
+    PcapngBlockType block;
+    memcpy(&block, record, sizeof(block));
+    bool swap = swapByteOrder;
 
-        case PcapngBlockTypesType::interfaceDescription:
-            Logger::GetLogger().Log(LL_WARNING, "Unexpected interface-description-block in PCAP-NG");
-            file.seekg(block.blockTotalLength - sizeof(block), ios::cur);
+    // Each section has its own byte order, given by the magic number of its header
+    if (block.blockType == PcapngBlockTypesType::sectionHeader) {
+        PcapngSectionHeaderBlockType sectionHeader;
+        if (available < sizeof(sectionHeader)) {
+            Consume(available);
+            return 0;
+        }
+        memcpy(&sectionHeader, record, sizeof(sectionHeader));
+        if (sectionHeader.magicNumber == 0x1A2B3C4D) {
+            swap = false;
+        }
+        else if (sectionHeader.magicNumber == 0x4D3C2B1A) {
+            swap = true;
+        }
+        else {
+            Logger::GetLogger().Log(LL_ERROR, "Invalid PCAP-NG section header. Magic number is wrong");
             return -1;
+        }
 
-        case PcapngBlockTypesType::enhancedPacket:
-        {
-            PcapngEnhancedPacketBlockType packet;
-            file.read((char*)&packet + sizeof(packet.block), sizeof(packet) - sizeof(packet.block));
-            packetNumber++;
+        if (sections.empty()) {
+            pcapHeader.versionMajor = swap ? _byteswap_ushort(sectionHeader.versionMajor) : sectionHeader.versionMajor;
+            pcapHeader.versionMinor = swap ? _byteswap_ushort(sectionHeader.versionMinor) : sectionHeader.versionMinor;
+        }
+    }
 
-            packet.block = block;
-            if (swapByteOrder) {
-                packet.interfaceId = _byteswap_ulong(packet.interfaceId);
-                packet.timestampHigh = _byteswap_ulong(packet.timestampHigh);
-                packet.timestampLow = _byteswap_ulong(packet.timestampLow);
-                packet.capturedLen = _byteswap_ulong(packet.capturedLen);
-                packet.packetLen = _byteswap_ulong(packet.packetLen);
+    uint32_t blockType = swap ? _byteswap_ulong(block.blockType) : block.blockType;
+    uint32_t blockLength = swap ? _byteswap_ulong(block.blockTotalLength) : block.blockTotalLength;
+    if (blockLength < sizeof(PcapngBlockType) + 4 || (blockLength & 0x3)) {
+        Logger::GetLogger().Log(LL_ERROR, "Invalid PCAP-NG block length ", blockLength);
+        return -1;
+    }
+
+    // Blocks before blocksParsedEnd are read again after a seek, they are in the tables already
+    bool known = (blockOffset < blocksParsedEnd);
+
+    switch (blockType) {
+    case PcapngBlockTypesType::sectionHeader:
+        if (known) {
+            for (SectionType& section : sections) {
+                if (section.offset == blockOffset) {
+                    EnterSection(section);
+                }
+            }
+        }
+        else {
+            SectionType section;
+            section.offset = blockOffset;
+            section.swapByteOrder = swap;
+            section.interfaceBase = interfaceScales.size();
+            sections.push_back(section);
+            EnterSection(section);
+            if (sections.size() > 1) {
+                Logger::GetLogger().Log(LL_DEBUG, "New PCAP-NG section at offset ", to_string(blockOffset).c_str());
             }
-            uint64_t timestamp = packet.timestampHigh;
-            timestamp = (timestamp << 32) + packet.timestampLow;
+        }
+        SkipBytes(blockLength);
+        break;
 
-            if (timeInMicros) {
-                packetHeader->timestampSeconds = (uint32_t) (timestamp / 1000000);
-                packetHeader->timestampMicroSeconds = (uint32_t)(timestamp % 1000000);
+    case PcapngBlockTypesType::interfaceDescription:
+        if (!known) {
+            vector<uint8_t> interfaceBlock(blockLength);
+            if (!ReadBytes(interfaceBlock.data(), blockLength)) {
+                return 0; // Truncated at the end of the file
             }
-            else {
-                packetHeader->timestampSeconds = (uint32_t)(timestamp / 1000000000);
-                packetHeader->timestampMicroSeconds = (uint32_t)(timestamp % 1000000000);
+            if (!AddInterface(interfaceBlock.data(), blockLength)) {
+                return -1;
             }
+        }
+        else {
+            SkipBytes(blockLength);
+        }
+        break;
 
-            packetHeader->packetLength = packet.capturedLen;
-            packetHeader->originalLength = packet.packetLen;
+    default:
+        // Name resolution, interface statistics and all other blocks without packets
+        SkipBytes(blockLength);
+    }
 
-            pcapng_skip = packet.block.blockTotalLength - sizeof(packet) - packetHeader->packetLength;
-        }
-            break;
+    if (!known && (blockType == PcapngBlockTypesType::sectionHeader || blockType == PcapngBlockTypesType::interfaceDescription)) {
+        blocksParsedEnd = position;
+    }
+    return 0;
+}
 
-        case PcapngBlockTypesType::simplePacket:
-        {
-            PcapngSimplePacketBlockType packet;
-            file.read((char*)&packet + sizeof(packet.block), sizeof(packet) - sizeof(packet.block));
-            packetNumber++;
+bool PcapReader::AddInterface(const uint8_t* block, uint32_t blockLength) {
 
-            packet.block = block;
-            if (swapByteOrder) {
-                packet.packetLen = _byteswap_ulong(packet.packetLen);
-            }
+    PcapngInterfaceDescriptionBlockType description;
+    if (blockLength < sizeof(description) + 4) {
+        Logger::GetLogger().Log(LL_ERROR, "Invalid PCAP-NG interface description block");
+        return false;
+    }
+    memcpy(&description, block, sizeof(description));
 
-            packetHeader->timestampSeconds = 0;
-            packetHeader->timestampMicroSeconds = 0;
-            packetHeader->packetLength = packet.block.blockTotalLength - sizeof(packet) - 4;
-            packetHeader->originalLength = packet.packetLen;
+    PcapInterfaceType interface;
+    interface.linkType = swapByteOrder ? _byteswap_ushort(description.linkType) : description.linkType;
+    interface.snapLength = swapByteOrder ? _byteswap_ulong(description.snapLen) : description.snapLen;
+    interface.ticksPerSecond = 1000000;
+    interface.offsetSeconds = 0;
+    if (!swapByteOrder && sections.size() == 1) {
+        interface.block.assign(block, block + blockLength);
+    }
 
-            pcapng_skip = packet.block.blockTotalLength - sizeof(packet) - packetHeader->packetLength;
+    // Options are padded to 32 bit, opt_endofopt is optional
+    size_t pos = sizeof(description);
+    size_t end = blockLength - 4;
+    while (pos + sizeof(PcapngOptionType) <= end) {
+        PcapngOptionType option;
+        memcpy(&option, block + pos, sizeof(option));
+        if (swapByteOrder) {
+            option.optionCode = _byteswap_ushort(option.optionCode);
+            option.optionLength = _byteswap_ushort(option.optionLength);
         }
+        if (option.optionCode == PcapngOptionCodesType::opt_endofopt) {
             break;
+        }
 
-        case PcapngBlockTypesType::packet:
-        {
-            PcapngPacketBlockType packet;
-            file.read((char*)&packet + sizeof(packet.block), sizeof(packet) - sizeof(packet.block));
-            packetNumber++;
+        const uint8_t* value = block + pos + sizeof(option);
+        size_t paddedLength = (option.optionLength + 3) & ~(size_t)0x3;
+        if (pos + sizeof(option) + option.optionLength > end) {
+            Logger::GetLogger().Log(LL_WARNING, "PCAP-NG interface options are truncated");
+            break;
+        }
 
-            packet.block = block;
-            if (swapByteOrder) {
-                packet.interfaceId = _byteswap_ushort(packet.interfaceId);
-                packet.dropsCount = _byteswap_ushort(packet.dropsCount);
-                packet.timestampHigh = _byteswap_ulong(packet.timestampHigh);
-                packet.timestampLow = _byteswap_ulong(packet.timestampLow);
-                packet.capturedLen = _byteswap_ulong(packet.capturedLen);
-                packet.packetLen = _byteswap_ulong(packet.packetLen);
+        switch (option.optionCode) {
+        case PcapngIfOptionCodesType::if_tsresol:
+            if (option.optionLength >= 1) {
+                // 10^-n or with the upper bit set 2^-n seconds
+                uint8_t exponent = value[0] & 0x7F;
+                if ((value[0] & 0x80) ? (exponent > 62) : (exponent > 18)) {
+                    Logger::GetLogger().Log(LL_WARNING, "Unknown time resolution. Assume microseconds");
+                }
+                else if (value[0] & 0x80) {
+                    interface.ticksPerSecond = ((uint64_t)1) << exponent;
+                }
+                else {
+                    interface.ticksPerSecond = 1;
+                    for (uint8_t i = 0; i < exponent; i++) {
+                        interface.ticksPerSecond *= 10;
+                    }
+                }
             }
-            uint64_t timestamp = packet.timestampHigh;
-            timestamp = (timestamp << 32) + packet.timestampLow;
+            break;
 
-            if (timeInMicros) {
-                packetHeader->timestampSeconds = (uint32_t)(timestamp / 1000000);
-                packetHeader->timestampMicroSeconds = (uint32_t)(timestamp % 1000000);
+        case PcapngIfOptionCodesType::if_tsoffset:
+            if (option.optionLength >= sizeof(int64_t)) {
+                uint64_t offset;
+                memcpy(&offset, value, sizeof(offset));
+                interface.offsetSeconds = (int64_t)(swapByteOrder ? _byteswap_uint64(offset) : offset);
             }
-            else {
-                packetHeader->timestampSeconds = (uint32_t)(timestamp / 1000000000);
-                packetHeader->timestampMicroSeconds = (uint32_t)(timestamp % 1000000000);
-            }
-
-            packetHeader->packetLength = packet.capturedLen;
-            packetHeader->originalLength = packet.packetLen;
+            break;
 
-            pcapng_skip = packet.block.blockTotalLength - sizeof(packet) - packetHeader->packetLength;
-        }
+        case PcapngIfOptionCodesType::if_tzone:
+            if (interfaces.empty() && option.optionLength >= sizeof(int32_t)) {
+                uint32_t timezone;
+                memcpy(&timezone, value, sizeof(timezone));
+                pcapHeader.timezone = swapByteOrder ? _byteswap_ulong(timezone) : timezone;
+            }
             break;
 
         default:
-            Logger::GetLogger().Log(LL_WARNING, "Unknown block-type in PCAP-NG: ", block.blockType);
-            file.seekg(block.blockTotalLength - sizeof(block), ios::cur);
-            return -1;
+            // Values of other byte order are only kept if they are bytes or text
+            if (!swapByteOrder || option.optionCode == PcapngOptionCodesType::opt_comment || option.optionCode == PcapngIfOptionCodesType::if_name ||
+                option.optionCode == PcapngIfOptionCodesType::if_description || option.optionCode == PcapngIfOptionCodesType::if_IPv4addr ||
+                option.optionCode == PcapngIfOptionCodesType::if_IPv6addr || option.optionCode == PcapngIfOptionCodesType::if_MACaddr ||
+                option.optionCode == PcapngIfOptionCodesType::if_EUIaddr || option.optionCode == PcapngIfOptionCodesType::if_filter ||
+                option.optionCode == PcapngIfOptionCodesType::if_os || option.optionCode == PcapngIfOptionCodesType::if_fcslen ||
+                option.optionCode == PcapngIfOptionCodesType::if_hardware) {
+                size_t optionOffset = interface.options.size();
+                interface.options.resize(optionOffset + sizeof(option) + paddedLength, 0);
+                memcpy(interface.options.data() + optionOffset, &option, sizeof(option));
+                memcpy(interface.options.data() + optionOffset + sizeof(option), value, option.optionLength);
+            }
         }
 
+        pos += sizeof(option) + paddedLength;
     }
-    else {
-        file.read((char*)packetHeader, sizeof(PcapPacketHeaderType));
-        if (file.eof()) {
-            Logger::GetLogger().Log(LL_INFO, "Read Progress ", 100, "%");
+
+    if (interfaces.empty()) {
+        pcapHeader.network = interface.linkType;
+    }
+    if (interface.ticksPerSecond != 1000000 && interface.ticksPerSecond != 1000000000) {
+        Logger::GetLogger().Log(LL_DEBUG, "PCAP-NG interface with ticks per second: ", (int)min<uint64_t>(interface.ticksPerSecond, INT32_MAX));
+    }
+    AddInterface(interface);
+    return true;
+}
+
+void PcapReader::AddInterface(const PcapInterfaceType& interface) {
+
+    InterfaceScaleType interfaceScale;
+    interfaceScale.scale = MakeTimestampScale(interface.ticksPerSecond);
+    interfaceScale.offsetSeconds = interface.offsetSeconds;
+    interfaceScale.maxPacketLength = (interface.snapLength > 0) ? interface.snapLength : MaxUnlimitedSnapLength;
+    interfaceScales.push_back(interfaceScale);
+
+    // The largest packet of all interfaces, e.g. for the arena of the sorter
+    pcapHeader.maxSnapLength = max(pcapHeader.maxSnapLength, interfaceScale.maxPacketLength);
+
+    lock_guard<mutex> lock(interfaceMutex);
+    interfaces.push_back(interface);
+}
+
+bool PcapReader::GetInterface(uint32_t interfaceId, PcapInterfaceType* interface) {
+
+    lock_guard<mutex> lock(interfaceMutex);
+    if (interfaceId >= interfaces.size()) {
+        return false;
+    }
+    *interface = interfaces[interfaceId];
+    return true;
+}
+
+void PcapReader::EnterSection(const SectionType& section) {
+
+    swapByteOrder = section.swapByteOrder;
+    sectionInterfaceBase = section.interfaceBase;
+    SelectDecoders();
+}
+
+int PcapReader::ReadPacketHeader(PcapPacketHeaderType *packetHeader) {
+
+    if(!isOpen) {
+        return -1;
+    }
+
+    Logger::GetLogger().SetReference(packetNumber, nullptr);
+
+    size_t available;
+    const uint8_t* record;
+    uint32_t dataOffset;
+    uint32_t recordLength;
+    int result;
+
+    while (true) {
+        recordOffset = position;
+        record = Peek(MaxRecordHeaderLength, &available);
+
+        result = (this->*recordDecoder)(record, available, packetHeader, &lastInterfaceId, &dataOffset, &recordLength);
+        if (result == 0) {
+            if (logProgress) {
+                Logger::GetLogger().Log(LL_INFO, "Read Progress ", 100, "%");
+            }
             return 0;
         }
 
-        packetNumber++;
+        if (result == -1) {
+            // Sections and interfaces update the tables, other blocks are skipped
+            if (ReadBlock() != 0) {
+                return -1;
+            }
+            continue;
+        }
 
-        if (swapByteOrder) {
-            packetHeader->timestampSeconds = _byteswap_ulong(packetHeader->timestampSeconds);
-            packetHeader->timestampMicroSeconds = _byteswap_ulong(packetHeader->timestampMicroSeconds);
-            if (!timeInMicros)
-                packetHeader->timestampMicroSeconds /= 1000;
-            packetHeader->packetLength = _byteswap_ulong(packetHeader->packetLength);
-            packetHeader->originalLength = _byteswap_ulong(packetHeader->originalLength);
+        if (result == -4) {
+            Logger::GetLogger().Log(LL_WARNING, "Packet of an undescribed PCAP-NG interface is skipped");
+            if (recordLength < sizeof(PcapngBlockType) + 4 || (recordLength & 0x3)) {
+                Logger::GetLogger().Log(LL_ERROR, "Invalid PCAP-NG block length ", recordLength);
+                return -1;
+            }
+            SkipBytes(recordLength);
+            continue;
         }
+        break;
     }
 
+    packetNumber++;
+    Consume(dataOffset);
+
     Logger::GetLogger().SetReference(packetNumber, packetHeader);
 
-    if (packetHeader->packetLength > pcapHeader.maxSnapLength) {
-        Logger::GetLogger().Log(LL_ERROR, "Packet contains more bytes than max. snap length ", pcapHeader.maxSnapLength);
+    if (result == -3) {
+        Logger::GetLogger().Log(LL_ERROR, "Packet length is invalid or exceeds the max. snap length ", pcapHeader.maxSnapLength);
         return -3;
     }
 
-    file.read((char*)packetData, packetHeader->packetLength);
-    if (file.eof()) {
+    pcapngSkip = recordLength - dataOffset - packetHeader->packetLength;
+    pendingDataLength = packetHeader->packetLength;
+    pendingDataOffset = dataOffset;
+    pendingRecordLength = recordLength;
+    return packetNumber;
+}
+
+int PcapReader::ReadPackets(PacketBatch& batch, size_t maxPackets) {
+
+    batch.Clear();
+    if (!isOpen) {
+        return -1;
+    }
+
+    // Decode every record which is complete in the buffer, the views point into it
+    size_t available;
+    const uint8_t* buffer = Peek(StreamBufferSize / 4, &available);
+    size_t used = (this->*batchDecoder)(buffer, available, batch, maxPackets);
+
+    if (batch.headers.empty()) {
+        // End of the input, a block which is no packet, an invalid or a very large record.
+        // The single packet path reports and handles all of them.
+        PcapPacketHeaderType packetHeader;
+        const uint8_t* packetData;
+        int result = ReadPacketHeader(&packetHeader);
+        if (result <= 0) {
+            return result;
+        }
+        batch.offsets.push_back(recordOffset);
+        batch.interfaceIds.push_back(lastInterfaceId);
+        if (ReadPacketDataView(&packetData) < 0) {
+            batch.Clear();
+            return -2;
+        }
+        batch.headers.push_back(packetHeader);
+        batch.data.push_back(packetData);
+        batch.records.push_back(recordView);
+        batch.recordLengths.push_back(recordViewLength);
+        return 1;
+    }
+
+    Consume(used);
+    packetNumber += (int32_t)batch.headers.size();
+    recordOffset = batch.offsets.back();
+    lastInterfaceId = batch.interfaceIds.back();
+    pendingDataLength = 0;
+    LogProgress();
+
+    return (int)batch.headers.size();
+}
+
+int PcapReader::ReadPacketData(uint8_t *packetData) {
+
+    if (!ReadBytes(packetData, pendingDataLength)) {
         Logger::GetLogger().Log(LL_ERROR, "Can not read the snap-data of packet. End of file reached");
         return -2;
     }
+    pendingDataLength = 0;
 
     if (isPcapng) {
-        
-        file.seekg(pcapng_skip, ios::cur);
+        SkipBytes(pcapngSkip);
+    }
+
+    Logger::GetLogger().Log(LL_DEBUG, "Packet read ok");
+    LogProgress();
+
+    return 0;
+}
+
+int PcapReader::ReadPacketView(PcapPacketHeaderType *packetHeader, const uint8_t **packetData) {
+
+    int result = ReadPacketHeader(packetHeader);
+    if (result <= 0) {
+        return result;
+    }
+
+    int dataResult = ReadPacketDataView(packetData);
+    if (dataResult < 0) {
+        return dataResult;
+    }
+
+    return result;
+}
+
+int PcapReader::ReadPacketDataView(const uint8_t **packetData) {
+
+    // The record header was consumed by ReadPacketHeader but is still buffered.
+    // Step back to it, so the view covers the whole record.
+    position -= pendingDataOffset;
+    if (!mappedFile.IsOpen()) {
+        bufferBegin -= pendingDataOffset;
+    }
+
+    size_t available;
+    const uint8_t* record = Peek(pendingRecordLength, &available);
+    if (available < (size_t)pendingDataOffset + pendingDataLength) {
+        Consume(available);
+        Logger::GetLogger().Log(LL_ERROR, "Can not read the snap-data of packet. End of file reached");
+        return -2;
     }
 
+    // The padding and trailer of a PCAP-NG block may be cut off at the end of the file.
+    // Such a record can not be copied unchanged.
+    recordViewLength = (uint32_t)min<size_t>(pendingRecordLength, available);
+    recordView = (recordViewLength == pendingRecordLength) ? record : nullptr;
+    *packetData = record + pendingDataOffset;
+    Consume(recordViewLength);
+    pendingDataLength = 0;
+
     Logger::GetLogger().Log(LL_DEBUG, "Packet read ok");
-    if ((lastInfoPrint < 0) || (lastInfoPrint + 0.1 * fileSize <= file.tellg())) {
-        Logger::GetLogger().Log(LL_INFO, "Read Progress ", (int)(file.tellg() / (float)fileSize * 100.0), "%");
-        lastInfoPrint = (unsigned int) file.tellg();
+    LogProgress();
+
+    return 0;
+}
+
+int PcapReader::SkipPacketData() {
+
+    uint64_t skip = pendingDataLength;
+    if (isPcapng) {
+        skip += pcapngSkip;
     }
+    pendingDataLength = 0;
 
-    return packetNumber;
+    SkipBytes(skip);
+    LogProgress();
+
+    return 0;
+}
+
+int PcapReader::SeekRecord(uint64_t offset) {
+
+    if (!isOpen || !SeekTo(offset)) {
+        return -1;
+    }
+
+    // Continue with the byte order and interfaces of the section of the record
+    if (sections.size() > 1) {
+        auto section = upper_bound(sections.begin(), sections.end(), offset, [](uint64_t offset, const SectionType& section) {
+            return offset < section.offset;
+        });
+        if (section != sections.begin()) {
+            EnterSection(*(section - 1));
+        }
+    }
+
+    pendingDataLength = 0;
+    return 0;
+}
+
+int PcapReader::Rewind() {
+
+    if (SeekRecord(firstRecordOffset) != 0) {
+        return -1;
+    }
+
+    packetNumber = 0;
+    lastInfoPrint = -1;
+    return 0;
+}
+
+uint64_t PcapReader::FindRecordStart(uint64_t offset) {
+
+    if (offset <= firstRecordOffset) {
+        return firstRecordOffset;
+    }
+    if (offset >= fileSize) {
+        return fileSize;
+    }
+
+    // A record boundary must follow within one max. record length
+    size_t recordLimit = pcapHeader.maxSnapLength + (isPcapng ? 256 : sizeof(PcapPacketHeaderType));
+    size_t bufferSize = (size_t)min<uint64_t>((ResyncRecords + 1) * (uint64_t)recordLimit, fileSize - offset);
+    bool endOfFile = (offset + bufferSize == fileSize);
+
+    // A mapped file is checked in place
+    const uint8_t* buffer;
+    vector<uint8_t> streamBuffer;
+    if (mappedFile.IsOpen()) {
+        buffer = mappedFile.Data() + offset;
+    }
+    else {
+        streamBuffer.resize(bufferSize);
+        if (!SeekTo(offset) || !ReadBytes(streamBuffer.data(), bufferSize)) {
+            return fileSize;
+        }
+        buffer = streamBuffer.data();
+    }
+
+    for (size_t pos = 0; pos < min(recordLimit, bufferSize); pos++) {
+        if (isPcapng && ((offset + pos) & 0x3)) {
+            continue; // PCAP-NG blocks are 32 bit aligned
+        }
+        if (IsRecordChain(buffer, bufferSize, pos, endOfFile)) {
+            return offset + pos;
+        }
+    }
+
+    return fileSize;
+}
+
+bool PcapReader::IsRecordChain(const uint8_t* buffer, size_t size, size_t pos, bool endOfFile) {
+
+    for (uint32_t records = 0; records < ResyncRecords; records++) {
+        if (pos == size) {
+            return endOfFile && records > 0;
+        }
+
+        size_t recordLength;
+        if (isPcapng) {
+            PcapngBlockType block;
+            if (pos + sizeof(block) > size)
+                return false;
+            memcpy(&block, buffer + pos, sizeof(block));
+            if (swapByteOrder) {
+                block.blockType = _byteswap_ulong(block.blockType);
+                block.blockTotalLength = _byteswap_ulong(block.blockTotalLength);
+            }
+
+            switch (block.blockType) {
+            case PcapngBlockTypesType::sectionHeader:
+            case PcapngBlockTypesType::interfaceDescription:
+            case PcapngBlockTypesType::enhancedPacket:
+            case PcapngBlockTypesType::simplePacket:
+            case PcapngBlockTypesType::packet:
+            case PcapngBlockTypesType::nameResolution:
+            case PcapngBlockTypesType::interfaceStatistics:
+                break;
+            default:
+                return false;
+            }
+
+            if (block.blockTotalLength < 12 || (block.blockTotalLength & 0x3) || pos + block.blockTotalLength > size)
+                return false;
+
+            uint32_t trailingLength;
+            memcpy(&trailingLength, buffer + pos + block.blockTotalLength - 4, sizeof(trailingLength));
+            if (swapByteOrder)
+                trailingLength = _byteswap_ulong(trailingLength);
+            if (trailingLength != block.blockTotalLength)
+                return false;
+
+            recordLength = block.blockTotalLength;
+        }
+        else {
+            PcapPacketHeaderType header;
+            if (pos + sizeof(header) > size)
+                return false;
+            memcpy(&header, buffer + pos, sizeof(header));
+            if (swapByteOrder) {
+                header.timestampSeconds = _byteswap_ulong(header.timestampSeconds);
+                header.timestampMicroSeconds = _byteswap_ulong(header.timestampMicroSeconds);
+                header.packetLength = _byteswap_ulong(header.packetLength);
+                header.originalLength = _byteswap_ulong(header.originalLength);
+            }
+
+            if (header.packetLength > pcapHeader.maxSnapLength || header.packetLength > header.originalLength)
+                return false;
+            if (header.timestampMicroSeconds >= (timeInMicros ? 1000000u : 1000000000u))
+                return false;
+            if (header.timestampSeconds > firstTimestampSeconds + (uint64_t)ResyncMaxSeconds || (uint64_t)header.timestampSeconds + ResyncMaxSeconds < firstTimestampSeconds)
+                return false;
+
+            recordLength = sizeof(header) + header.packetLength;
+            if (pos + recordLength > size)
+                return false;
+        }
+
+        pos += recordLength;
+    }
+
+    return true;
+}
+
+void PcapReader::LogProgress() {
+    // The decompressed size is not known, the compressed input tells the progress
+    uint64_t done = compressedFile.IsOpen() ? compressedFile.CompressedPosition() : position;
+    uint64_t total = compressedFile.IsOpen() ? compressedFile.CompressedSize() : fileSize;
+
+    if (total == 0 || !logProgress) {
+        return; // Unknown for pipes
+    }
+    if (lastInfoPrint < 0) {
+        progressStart = chrono::steady_clock::now();
+        progressStartDone = done;
+    }
+    if ((lastInfoPrint < 0) || (lastInfoPrint + 0.1 * total <= done)) {
+        const double megabyte = 1024.0 * 1024.0;
+        char text[160];
+        int length = snprintf(text, sizeof(text), "Read Progress %d%% (%.1f of %.1f MB", (int)(done / (double)total * 100.0), done / megabyte, total / megabyte);
+
+        // The remaining time assumes the throughput since the first progress of this pass
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - progressStart).count();
+        if (seconds > 0 && done > progressStartDone) {
+            double bytesPerSecond = (done - progressStartDone) / seconds;
+            uint64_t eta = (uint64_t)((total - min(done, total)) / bytesPerSecond);
+            snprintf(text + length, sizeof(text) - length, ", %.1f MB/s, ETA %llu:%02u:%02u", bytesPerSecond / megabyte,
+                (unsigned long long)(eta / 3600), (unsigned int)(eta / 60 % 60), (unsigned int)(eta % 60));
+        }
+        string message = string(text) + ")";
+
+        Logger::GetLogger().Log(LL_INFO, message.c_str());
+        lastInfoPrint = (int64_t)done;
+    }
 }
 
 uint32_t PcapReader::MaxSnapLength() {
-    if(file.is_open()) {
+    if(isOpen) {
         return pcapHeader.maxSnapLength;
     } else {
         return 0;
@@ -18,32 +18,235 @@
 #pragma once
 
 #include "PcapFormat.h"
+#include "PcapPacket.h"
+#include "PacketDecoder.h"
+#include "CompressedFile.h"
+#include "MappedFile.h"
+#include "UringFile.h"
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <vector>
 
 using namespace std;
 
 class PcapReader
 {
 protected:
-    ifstream        file;
-    unsigned int    fileSize;
+    MappedFile      mappedFile;     // Regular files are read in place ...
+    ifstream        file;           // ... everything else (e.g. pipes) is streamed
+    UringFile       uringFile;      // Replaces the mapping if asynchronous I/O is enabled
+    CompressedFile  compressedFile; // Compressed inputs are decompressed by a thread and streamed
+    unsigned int    asyncQueueDepth;
+    size_t          asyncBufferSize;
+    bool            isOpen;
+    bool            isSeekable;
+    uint64_t        fileSize;       // 0 if unknown
+    uint64_t        position;
+    vector<uint8_t> streamBuffer;   // Unread part of a streamed input is [bufferBegin, bufferEnd)
+    size_t          bufferBegin;
+    size_t          bufferEnd;
     PcapHeaderType  pcapHeader;
     bool            swapByteOrder;
     bool            timeInMicros;
     int32_t         packetNumber;
-    int             lastInfoPrint;
+    int64_t         lastInfoPrint;
+    chrono::steady_clock::time_point progressStart;    // Throughput of the progress is measured from here
+    uint64_t        progressStartDone;
+    bool            logProgress;
     bool            isPcapng;
+    uint32_t        pcapngSkip;
+    uint32_t        pendingDataLength;
+    uint32_t        pendingDataOffset;
+    uint32_t        pendingRecordLength;
+    const uint8_t*  recordView;
+    uint32_t        recordViewLength;
+    uint64_t        recordOffset;
+    uint64_t        firstRecordOffset;
+    uint32_t        firstTimestampSeconds;
+    uint32_t        lastInterfaceId;
+
+    // Interfaces of all PCAP-NG sections in file order, the interface ids of a
+    // section start at its interfaceBase. Classic PCAP has the one of the file header.
+    struct InterfaceScaleType {
+        TimestampScaleType  scale;
+        int64_t             offsetSeconds;
+        uint32_t            maxPacketLength;
+    };
+    struct SectionType {
+        uint64_t    offset;
+        bool        swapByteOrder;
+        size_t      interfaceBase;
+    };
+    vector<PcapInterfaceType>   interfaces;         // Read by GetInterface of other threads, guarded by interfaceMutex
+    vector<InterfaceScaleType>  interfaceScales;    // Values of the decoders for each interface
+    vector<SectionType>         sections;
+    size_t                      sectionInterfaceBase;
+    uint64_t                    blocksParsedEnd;    // Section and interface blocks before are in the tables
+    vector<uint8_t>             preamble;           // Blocks in front of the first packet, if they can be copied
+    size_t                      preambleInterfaces;
+    mutex                       interfaceMutex;
+
+    // Bytes at the read position, at least length unless the input ends before.
+    // For a streamed input the pointer is valid until the next Peek.
+    const uint8_t* Peek(size_t length, size_t* available);
+    void Consume(size_t length);
+    size_t StreamRead(uint8_t* target, size_t length);
+    bool StreamSeek(uint64_t offset);
+    bool ReadBytes(void* target, size_t length);
+    void SkipBytes(uint64_t length);
+    bool SeekTo(uint64_t offset);
+    void LogProgress();
+
+    int ReadBlock();
+    bool AddInterface(const uint8_t* block, uint32_t blockLength);
+    void AddInterface(const PcapInterfaceType& interface);
+    void EnterSection(const SectionType& section);
+
+    // Decodes the record header at the start of the given bytes. Returns 1 for
+    // a packet, 0 if more bytes are needed, -1 for a PCAP-NG block which is no
+    // packet, -3 if the packet length is invalid or exceeds the max. snap length
+    // and -4 for a packet of an interface which was not described.
+    typedef int (PcapReader::*RecordDecoderType)(const uint8_t* record, size_t available, PcapPacketHeaderType* packetHeader, uint32_t* interfaceId, uint32_t* dataOffset, uint32_t* recordLength);
+    // Decodes all complete records in the buffer, returns the bytes used
+    typedef size_t (PcapReader::*BatchDecoderType)(const uint8_t* buffer, size_t available, PacketBatch& batch, size_t maxPackets);
+
+    // Specialized for the format and byte order of the file by SelectDecoders in Open
+    RecordDecoderType   recordDecoder;
+    BatchDecoderType    batchDecoder;
+
+    void SelectDecoders();
+    template <bool Swap> int DecodeClassicRecord(const uint8_t* record, size_t available, PcapPacketHeaderType* packetHeader, uint32_t* interfaceId, uint32_t* dataOffset, uint32_t* recordLength);
+    template <bool Swap> int DecodePcapngRecord(const uint8_t* record, size_t available, PcapPacketHeaderType* packetHeader, uint32_t* interfaceId, uint32_t* dataOffset, uint32_t* recordLength);
+    template <bool Swap, typename BlockType> int DecodeTimedBlock(const uint8_t* record, PcapPacketHeaderType* packetHeader, uint32_t* interfaceId);
+    template <RecordDecoderType Decode> size_t DecodeBatch(const uint8_t* buffer, size_t available, PacketBatch& batch, size_t maxPackets);
+    bool IsRecordChain(const uint8_t* buffer, size_t size, size_t pos, bool endOfFile);
 
 public:
     PcapReader(void);
     virtual ~PcapReader(void);
 
+    // Read regular files through io_uring with queueDepth blocks of bufferSize
+    // bytes ahead of the parser instead of mapping them. 0 disables it.
+    void SetAsyncIo(unsigned int queueDepth, size_t bufferSize) {
+        asyncQueueDepth = queueDepth;
+        asyncBufferSize = bufferSize;
+    }
+    // Readers of a part of a file or of temporary files keep quiet, their progress is not the job's
+    void SetLogProgress(bool logProgress) {
+        this->logProgress = logProgress;
+    }
+
     virtual int Open(const char* fileName);
     virtual int Close();
 
     virtual int ReadPacket(PcapPacketHeaderType *packetHeader, uint8_t *packetData);
 
+    // Two step read: the caller learns the captured length from the header
+    // and provides a buffer of exactly that size for the payload.
+    virtual int ReadPacketHeader(PcapPacketHeaderType *packetHeader);
+    virtual int ReadPacketData(uint8_t *packetData);
+    virtual int SkipPacketData();
+
+    // Decodes up to maxPackets records in one go. The payloads are views like
+    // for ReadPacketView. Returns the number of packets, 0 at the end of the
+    // file or the error of the first record which could not be read.
+    virtual int ReadPackets(PacketBatch& batch, size_t maxPackets);
+
+    // Reads the payload without copying it. The view points into the mapped
+    // file and stays valid until Close, see HasStableViews. For streamed input
+    // it points into the read buffer of the reader and is valid until the next read.
+    virtual int ReadPacketView(PcapPacketHeaderType *packetHeader, const uint8_t **packetData);
+    virtual int ReadPacketDataView(const uint8_t **packetData);
+
+    // The whole record of the last ReadPacketDataView, valid like its payload view.
+    // Null if the record was cut off at the end of the file.
+    const uint8_t* RecordView() {
+        return recordView;
+    }
+
+    uint32_t RecordViewLength() {
+        return recordViewLength;
+    }
+
+    bool HasStableViews() {
+        return mappedFile.IsOpen();
+    }
+
+    // False for pipes, which can only be read once from start to end
+    bool IsSeekable() {
+        return isSeekable;
+    }
+
+    // File offset of the record returned by the last ReadPacketHeader
+    uint64_t RecordOffset() {
+        return recordOffset;
+    }
+
+    // Interface of the packet returned by the last ReadPacketHeader
+    uint32_t InterfaceId() {
+        return lastInterfaceId;
+    }
+
+    // Description of an interface id of a packet. The table grows while PCAP-NG
+    // blocks are read, so this may be called by another thread than the reader.
+    bool GetInterface(uint32_t interfaceId, PcapInterfaceType* interface);
+
+    // Continue reading at a record offset previously returned by RecordOffset
+    virtual int SeekRecord(uint64_t offset);
+
+    // Start again with the first packet of the file
+    virtual int Rewind();
+
+    // Offset of the first record which starts at or behind the given offset.
+    // Resynchronizes on a chain of plausible record headers (classic PCAP) or
+    // matching block lengths (PCAP-NG). Use SeekRecord afterwards.
+    virtual uint64_t FindRecordStart(uint64_t offset);
+
+    uint64_t FileSize() {
+        return fileSize;
+    }
+
+    // True if PcapWriter reproduces the file header (the preamble of PCAP-NG)
+    // and records of this input byte by byte, i.e. records can be copied without
+    // re-encoding. For PCAP-NG only the records of interfaces with a description
+    // block in PcapInterfaceType can be copied.
+    bool CanCopyRecords() {
+        if (isPcapng) {
+            return !preamble.empty();
+        }
+        return pcapHeader.versionMajor == 2 && pcapHeader.versionMinor == 4;
+    }
+
+    // Every record can be copied, so can byte ranges of records. A PCAP-NG file
+    // has one section and describes all interfaces in the preamble for it.
+    bool CanCopyRecordRanges() {
+        if (isPcapng) {
+            return CanCopyRecords() && sections.size() == 1 && interfaces.size() == preambleInterfaces;
+        }
+        return CanCopyRecords();
+    }
+
+    // Section header, interface descriptions and other blocks in front of the first packet
+    const vector<uint8_t>& GetPreamble() {
+        return preamble;
+    }
+
+    uint32_t PreambleInterfaces() {
+        return (uint32_t)preambleInterfaces;
+    }
+
+    bool IsPcapng() {
+        return isPcapng;
+    }
+
+    // The fraction of the packet timestamps is in nanoseconds instead of microseconds.
+    // Always true for PCAP-NG, whose timestamps are converted per interface.
+    bool IsNanosecondResolution() {
+        return !timeInMicros;
+    }
+
     virtual uint32_t MaxSnapLength();
 
     PcapHeaderType* GetPcapHeader() {
@@ -15,27 +15,134 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <filesystem>
+#include <functional>
 #include <iostream>
 #include <iomanip>
 #include "Logger.h"
-#include "Thread.h"
 #include "JobList.h"
+#include "ThreadPool.h"
+#include "MemoryBudget.h"
+#include "PathFilter.h"
+#include "Platform.h"
+#include "FolderWatcher.h"
+#include "JobJournal.h"
+#include "CaptureAnalysis.h"
+#include "WindowBenchmark.h"
 
 using namespace std;
 namespace fs = std::filesystem;
 
-static const unsigned int MaxThreadNumber = 4;
-static const unsigned int DefaultThreadNumber = 2;
+static const unsigned int DefaultJobCount = 2;
+// Jobs of a directory are pushed in batches while it is still walked, each batch largest first
+static const size_t DiscoveryBatchSize = 256;
+// The watch mode takes a capture which was not seen closed once it was not modified for this time
+static const int WatchSettleSeconds = 10;
+static const int WatchPollMs = 1000;
+// Window of the benchmark if -s is not given
+static const int DefaultBenchmarkWindow = 5000;
+
+static volatile sig_atomic_t stopWatching = 0;
+
+static void StopWatching(int) {
+    stopWatching = 1;
+}
+
+// Name of a capture without the suffix of its compression, e.g. "a.pcap" for
+// "a.pcap.gz". Empty if the file is no capture.
+static string CaptureFileName(const fs::path& path) {
+    static const char* captureExtensions[] = { ".pcap", ".pcapng" };
+    static const char* compressionExtensions[] = { ".gz", ".zst", ".zstd", ".lz4" };
+
+    fs::path capture = path.filename();
+    for (const char* compression : compressionExtensions) {
+        if (_stricmp(capture.extension().generic_string().c_str(), compression) == 0) {
+            capture = capture.stem();
+            break;
+        }
+    }
+    for (const char* extension : captureExtensions) {
+        if (_stricmp(capture.extension().generic_string().c_str(), extension) == 0) {
+            return capture.generic_string();
+        }
+    }
+    return string();
+}
+
+typedef function<void(const fs::path& path, const fs::path& relativeDirectory, const string& captureName)> CaptureFoundType;
+
+// Walks an input directory, if recursive with its subdirectories, and hands every capture
+// which passes the filter to found right away. skipDirectory (the output) is not entered.
+// Returns the number of captures found.
+static size_t DiscoverCaptures(const fs::path& inputDirectory, bool recursive, const PathFilter& pathFilter, const fs::path& skipDirectory, CaptureFoundType found)
+{
+    size_t count = 0;
+    error_code errorCode;
+    fs::recursive_directory_iterator entry(inputDirectory, fs::directory_options::skip_permission_denied, errorCode);
+
+    for (; !errorCode && entry != fs::recursive_directory_iterator(); entry.increment(errorCode)) {
+        fs::path relativePath = entry->path().lexically_relative(inputDirectory);
+        error_code entryError;
+
+        if (entry->is_directory(entryError)) {
+            if (!recursive || pathFilter.ExcludesDirectory(relativePath.generic_string()) || fs::equivalent(entry->path(), skipDirectory, entryError)) {
+                entry.disable_recursion_pending();
+            }
+            continue;
+        }
+
+        string captureName = CaptureFileName(entry->path());
+        if (!captureName.empty() && entry->is_regular_file(entryError) && pathFilter.IncludesFile(relativePath.generic_string())) {
+            found(entry->path(), relativePath.parent_path(), captureName);
+            count++;
+        }
+    }
+
+    if (errorCode) {
+        Logger::GetLogger().Log(LL_WARNING, "Searching the input directory stopped early: ", errorCode.message().c_str());
+    }
+    return count;
+}
 
 void printHelpAndWait() {
     cout << endl;
     cout << "Usage: " << endl;
-    cout << "PcapSorter.exe -i INPUT_PCAP -o OUTPUT_PCAP -s SORT_WINDOW [-l LOG_LEVEL] [-d] [-j JOBCOUNT]" << endl;
+    cout << "PcapSorter.exe -i INPUT_PCAP -o OUTPUT_PCAP -s SORT_WINDOW [-m SORT_MODE] [-r RAM_BUDGET] [-t THREADS] [-q QUEUE_DEPTH] [-b IO_BUFFER] [-c COMPRESSION] [-x SPLIT] [-l LOG_LEVEL] [-d] [-j JOBCOUNT] [-g MEMORY_LIMIT] [-R] [-f INCLUDE] [-e EXCLUDE] [-w]" << endl;
     cout << "----------------------------------------------------------------------------------------------------------------" << endl;
-    cout << "  INPUT_PCAP:  path and name to the input PCAP or PCAPNG file or directory.\n" << endl;
-    cout << "  OUTPUT_PCAP: path and name to the output PCAP or directory.\n" << endl;
-    cout << "  SORT_WINDOW: number of packets which are compared for the sort (neglectable effect on runtime, only on RAM usage). Example: 5000.\n" << endl;
+    cout << "  INPUT_PCAP:  path and name to the input PCAP or PCAPNG file or directory." << endl;
+    cout << "               Inputs compressed by gzip, zstd or LZ4 (e.g. .pcap.gz) are decompressed while they are read.\n" << endl;
+    cout << "  OUTPUT_PCAP: path and name to the output PCAP or directory." << endl;
+    cout << "               If INPUT_PCAP is a directory and OUTPUT_PCAP a file, all inputs are merged into one" << endl;
+    cout << "               time ordered output. Each input is sorted by a window of SORT_WINDOW packets," << endl;
+    cout << "               the sort modes exact and index can not merge." << endl;
+    cout << "               PCAPNG inputs are written as PCAPNG with all of their interfaces." << endl;
+    cout << "               The blocks of a single input are copied unchanged.\n" << endl;
+    cout << "  SORT_WINDOW: number of packets which are compared for the sort (logarithmic effect on runtime, linear on RAM usage). Example: 5000.\n" << endl;
+    cout << "  SORT_MODE:   optional sort algorithm:" << endl;
+    cout << "               * window: sliding window of SORT_WINDOW packets (default)" << endl;
+    cout << "               * exact:  external merge sort, handles any disorder. SORT_WINDOW is not needed" << endl;
+    cout << "               * index:  sorts an index of 16 bytes per packet, then copies the payloads. SORT_WINDOW is not needed" << endl;
+    cout << "               * adaptive: sliding window which starts at SORT_WINDOW packets (default " << SortJob::DefaultAdaptiveWindow << "), doubles" << endl;
+    cout << "                 on every late packet and halves in long stretches of ordered packets" << endl;
+    cout << "               Window sorts end with the number of packets which could not be placed in order\n" << endl;
+    cout << "  RAM_BUDGET:  optional memory in MB for one sorted run of the exact mode or the packets of the adaptive window (default " << (SortJob::DefaultRamBudget / 1024 / 1024) << ")\n" << endl;
+    cout << "  THREADS:     optional number of parallel tasks of one job: index ranges and sort slices in the index mode" << endl;
+    cout << "               and compressed frames of the output (default: one per worker thread)\n" << endl;
+    cout << "  QUEUE_DEPTH: optional number of buffers of asynchronous I/O in flight per file (Linux io_uring)." << endl;
+    cout << "               Default 0 reads by memory mapping and writes through one large buffer\n" << endl;
+    cout << "  IO_BUFFER:   optional size in KB of one output or asynchronous I/O buffer (default " << (SortJob::DefaultAsyncBufferSize / 1024) << ")\n" << endl;
+    cout << "  COMPRESSION: optional compression of the outputs as FORMAT[:LEVEL], e.g. zst:3 or gz:6" << endl;
+    cout << "               * zst: zstd, levels 1-22 (default 3)" << endl;
+    cout << "               * gz:  gzip, levels 1-9 (default 6)" << endl;
+    cout << "               Outputs of a directory get the extension of the format (e.g. .pcap.zst)\n" << endl;
+    cout << "  SPLIT:       optional rolling outputs, a new file starts every SPLIT:" << endl;
+    cout << "               * 1024MB: bytes (KB, MB or GB) before compression" << endl;
+    cout << "               * 100000p: packets" << endl;
+    cout << "               * 60s: seconds of capture time" << endl;
+    cout << "               The files are numbered (e.g. out_00000.pcap) and are named .part until they are complete\n" << endl;
 
     //cout << "  OUTPUT_H264: path and name to the output h264 file." << endl;
 
@@ -45,9 +152,45 @@ void printHelpAndWait() {
     cout << "               * 2: INFO (default)" << endl;
     cout << "               * 3: DEBUG (makes the magic quite slow)\n" << endl;
 
-    cout << "  -d:          execute in DRY mode i.e. nothing will be written\n" << endl;
+    cout << "  -d:          execute in DRY mode i.e. nothing will be written. Only the record headers of the inputs" << endl;
+    cout << "               are read to report how far packets are out of order (in packets and in time), the" << endl;
+    cout << "               in-order runs, the rates of the interfaces and the smallest SORT_WINDOW for an exact" << endl;
+    cout << "               output. Displacements of up to " << CaptureAnalysis::DefaultTrackedPackets << " packets are exact, the analysis" << endl;
+    cout << "               holds about " << (CaptureAnalysis::Memory(CaptureAnalysis::DefaultTrackedPackets) >> 20) << " MB within the MEMORY_LIMIT. SORT_WINDOW is not needed\n" << endl;
+
+    cout << "  JOBCOUNT:    Number of conversion jobs which shall be done in parallel (default " << DefaultJobCount << ")." << endl;
+    cout << "               All jobs share one pool of worker threads, one per hardware thread." << endl;
+    cout << "               The jobs of a directory start while it is still searched, each batch of 256 inputs" << endl;
+    cout << "               with the largest one. Jobs report their progress with the throughput and the remaining time\n" << endl;
+
+    cout << "  MEMORY_LIMIT: optional memory in MB for all jobs together. Each job reserves its window, runs or index" << endl;
+    cout << "               and its buffers before it opens its output. While the others hold too much it gives its job slot" << endl;
+    cout << "               to the next job and starts again when one of them has finished. A job which does" << endl;
+    cout << "               not fit alone runs with a smaller window or RAM budget. Default: the cgroup limit (Linux)" << endl;
+    cout << "               less a tenth for the program itself, otherwise none. 0 disables the limit\n" << endl;
+
+    cout << "  -R:          include the subdirectories of an INPUT_PCAP directory. The outputs of a directory" << endl;
+    cout << "               mirror them below OUTPUT_PCAP/sorted/, the output directory itself is skipped\n" << endl;
+
+    cout << "  INCLUDE:     optional glob of the files of an INPUT_PCAP directory which are taken, e.g. *.pcap.gz" << endl;
+    cout << "               or 2024-*/**. * matches within a directory, ** across directories, ? one character and" << endl;
+    cout << "               [a-z] one of a set. A glob without / is matched against the file name only." << endl;
+    cout << "               -f can be given more than once\n" << endl;
+
+    cout << "  EXCLUDE:     optional glob of files or directories which are skipped, like INCLUDE. -e can be given more than once\n" << endl;
+
+    cout << "  -w:          WATCH an INPUT_PCAP directory until Ctrl+C and sort every capture into the OUTPUT_PCAP directory" << endl;
+    cout << "               as soon as it was closed after writing or moved in (Linux inotify, Windows once no writer holds" << endl;
+    cout << "               it open, elsewhere once it was not modified for " << WatchSettleSeconds << " seconds). The captures which are there" << endl;
+    cout << "               already are sorted first." << endl;
+    cout << "               OUTPUT_PCAP/sorted/PcapSorter.journal records the sorted inputs, they are skipped after a" << endl;
+    cout << "               restart unless their size changed. At most JOBCOUNT captures are sorted at a time" << endl;
 
-    cout << "  JOBCOUNT:    Number of conversion jobs which shall be done in parallel (max. " << MaxThreadNumber << ", default " << DefaultThreadNumber << ")" << endl;
+    cout << endl;
+    cout << "PcapSorter.exe -B PACKETS [-s SORT_WINDOW]" << endl;
+    cout << "  PACKETS:     BENCHMARK the sort window with PACKETS synthetic packets of a fixed seed, SORT_WINDOW" << endl;
+    cout << "               packets at a time (default " << DefaultBenchmarkWindow << "). The list of the first versions and the heap" << endl;
+    cout << "               are timed and their orders compared" << endl;
 
     cout << endl;
     cout << "Press any key and then enter to end program..." << endl;
@@ -59,8 +202,7 @@ void printHelpAndWait() {
 int main(int argc, char* argv[])
 {
     // Locals for multi-threading
-    Thread* threads[MaxThreadNumber];
-    unsigned int jobCount = DefaultThreadNumber;
+    unsigned int jobCount = DefaultJobCount;
 
     cout << "********************************************" << endl;
     cout << "* PcapSorter.exe by Florian Hisch          *" << endl;
@@ -81,6 +223,37 @@ int main(int argc, char* argv[])
     Logger::GetLogger().Log(LL_INFO, "A warm welcome to my dear user!");
     Logger::GetLogger().Log(LL_INFO, "Let's start by checking your parameters:");
 
+    // The benchmark sorts synthetic packets, it needs no input or output
+    int benchmarkArg = -1;
+    for (int i = 0; i < argc-1; i++) {
+        if (strcmp(argv[i], "-B") == 0) {
+            benchmarkArg = i+1;
+            break;
+        }
+    }
+
+    if (benchmarkArg > 0) {
+        Logger::GetLogger().Log(LL_INFO, " * Checking optional BENCHMARK argument... ");
+        int benchmarkPackets = atoi(argv[benchmarkArg]);
+        int benchmarkWindow = DefaultBenchmarkWindow;
+        for (int i = 0; i < argc-1; i++) {
+            if (strcmp(argv[i], "-s") == 0) {
+                benchmarkWindow = atoi(argv[i+1]);
+                break;
+            }
+        }
+        if (benchmarkPackets <= 0 || benchmarkWindow <= 0) {
+            cout << "not ok. You specified an invalid number of packets or sort window for the benchmark";
+            printHelpAndWait();
+            return 1;
+        }
+        cout << "ok. Benchmark of the sort window with " << benchmarkPackets << " packets and a window of " << benchmarkWindow << endl;
+
+        bool same = WindowBenchmark::Run((size_t)benchmarkPackets, (size_t)benchmarkWindow);
+        Logger::DeinitLoggingSystem();
+        return same ? 0 : 1;
+    }
+
     // Search for input file name
     Logger::GetLogger().Log(LL_INFO, " * Checking input file... ");
     int inputFile = -1;
@@ -117,7 +290,232 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional sort-mode argument... ");
+    int sortModeArg = -1;
+    SortModeType sortMode = SM_WINDOW;
+    for (int i = 0; i < argc-1; i++) {
+        if (strcmp(argv[i], "-m") == 0) {
+            sortModeArg = i+1;
+            break;
+        }
+    }
+
+    if (sortModeArg > 0) {
+        if (_stricmp(argv[sortModeArg], "window") == 0) {
+            sortMode = SM_WINDOW;
+            cout << "ok. You specified the sliding sort window";
+        }
+        else if (_stricmp(argv[sortModeArg], "exact") == 0) {
+            sortMode = SM_EXACT;
+            cout << "ok. You specified the exact external merge sort";
+        }
+        else if (_stricmp(argv[sortModeArg], "index") == 0) {
+            sortMode = SM_INDEX;
+            cout << "ok. You specified the exact two-pass index sort";
+        }
+        else if (_stricmp(argv[sortModeArg], "adaptive") == 0) {
+            sortMode = SM_ADAPTIVE;
+            cout << "ok. You specified the adaptive sort window";
+        }
+        else {
+            cout << "not ok. You specified an unknown sort mode: " << argv[sortModeArg];
+            printHelpAndWait();
+            return 1;
+        }
+    }
+    else {
+        cout << "ok. You seem to like the default sliding sort window";
+    }
+
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional RAM budget argument... ");
+    int ramBudgetArg = -1;
+    size_t ramBudget = SortJob::DefaultRamBudget;
+    for (int i = 0; i < argc-1; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            ramBudgetArg = i+1;
+            break;
+        }
+    }
+
+    if (ramBudgetArg > 0) {
+        int ramBudgetMB = atoi(argv[ramBudgetArg]);
+        if (ramBudgetMB <= 0) {
+            cout << "not ok. You specified an invalid RAM budget: " << argv[ramBudgetArg];
+            printHelpAndWait();
+            return 1;
+        }
+        ramBudget = ((size_t)ramBudgetMB) * 1024 * 1024;
+        cout << "ok. You specified a RAM budget of " << ramBudgetMB << " MB";
+    }
+    else {
+        cout << "ok. You seem to like the default RAM budget of " << (ramBudget / 1024 / 1024) << " MB";
+    }
+
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional THREADS argument... ");
+    int threadCountArg = -1;
+    unsigned int threadCount = 0;   // One task per worker of the pool
+    for (int i = 0; i < argc-1; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            threadCountArg = i+1;
+            break;
+        }
+    }
+
+    if (threadCountArg > 0) {
+        int threads = atoi(argv[threadCountArg]);
+        if (threads <= 0) {
+            cout << "not ok. You specified an invalid number of threads: " << argv[threadCountArg];
+            printHelpAndWait();
+            return 1;
+        }
+        threadCount = threads;
+        cout << "ok. You specified " << threadCount << " threads per job";
+    }
+    else {
+        cout << "ok. You seem to like the default of one task per worker thread";
+    }
+
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional QUEUE_DEPTH argument... ");
+    int queueDepthArg = -1;
+    unsigned int queueDepth = 0;
+    for (int i = 0; i < argc-1; i++) {
+        if (strcmp(argv[i], "-q") == 0) {
+            queueDepthArg = i+1;
+            break;
+        }
+    }
+
+    if (queueDepthArg > 0) {
+        int depth = atoi(argv[queueDepthArg]);
+        if (depth < 0) {
+            cout << "not ok. You specified an invalid queue depth: " << argv[queueDepthArg];
+            printHelpAndWait();
+            return 1;
+        }
+        queueDepth = depth;
+        cout << "ok. You specified a queue depth of " << queueDepth;
+    }
+    else {
+        cout << "ok. You seem to like synchronous I/O";
+    }
+
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional IO_BUFFER argument... ");
+    int ioBufferArg = -1;
+    size_t ioBufferSize = SortJob::DefaultAsyncBufferSize;
+    for (int i = 0; i < argc-1; i++) {
+        if (strcmp(argv[i], "-b") == 0) {
+            ioBufferArg = i+1;
+            break;
+        }
+    }
+
+    if (ioBufferArg > 0) {
+        int ioBufferKB = atoi(argv[ioBufferArg]);
+        if (ioBufferKB <= 0) {
+            cout << "not ok. You specified an invalid I/O buffer size: " << argv[ioBufferArg];
+            printHelpAndWait();
+            return 1;
+        }
+        ioBufferSize = ((size_t)ioBufferKB) * 1024;
+        cout << "ok. You specified an I/O buffer size of " << ioBufferKB << " KB";
+    }
+    else {
+        cout << "ok. You seem to like the default I/O buffer size of " << (ioBufferSize / 1024) << " KB";
+    }
+
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional COMPRESSION argument... ");
+    int compressionArg = -1;
+    CompressedFile::CompressionType compression = CompressedFile::CT_NONE;
+    int compressionLevel = 0;
+    for (int i = 0; i < argc-1; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            compressionArg = i+1;
+            break;
+        }
+    }
+
+    if (compressionArg > 0) {
+        string compressionName = argv[compressionArg];
+        size_t levelSeparator = compressionName.find(':');
+        if (levelSeparator != string::npos) {
+            compressionLevel = atoi(compressionName.c_str() + levelSeparator + 1);
+            compressionName.resize(levelSeparator);
+        }
+
+        if (compressionName == "zst" || compressionName == "zstd") {
+            compression = CompressedFile::CT_ZSTD;
+        }
+        else if (compressionName == "gz" || compressionName == "gzip") {
+            compression = CompressedFile::CT_GZIP;
+        }
+        if (levelSeparator == string::npos) {
+            compressionLevel = CompressedFile::DefaultLevel(compression);
+        }
+
+        if (!CompressedFile::IsSupported(compression) || !CompressedFile::IsValidLevel(compression, compressionLevel)) {
+            cout << "not ok. You specified an unknown or unsupported compression: " << argv[compressionArg];
+            printHelpAndWait();
+            return 1;
+        }
+        cout << "ok. You specified " << CompressedFile::Name(compression) << " compression of level " << compressionLevel;
+    }
+    else {
+        cout << "ok. You seem to like uncompressed outputs";
+    }
+
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional SPLIT argument... ");
+    int splitArg = -1;
+    RotationType rotation = RT_NONE;
+    uint64_t rotationLimit = 0;
+    for (int i = 0; i < argc-1; i++) {
+        if (strcmp(argv[i], "-x") == 0) {
+            splitArg = i+1;
+            break;
+        }
+    }
+
+    if (splitArg > 0) {
+        char* unit = nullptr;
+        rotationLimit = strtoull(argv[splitArg], &unit, 10);
+        if (_stricmp(unit, "KB") == 0 || _stricmp(unit, "MB") == 0 || _stricmp(unit, "GB") == 0) {
+            rotation = RT_BYTES;
+            rotationLimit *= (toupper(unit[0]) == 'K') ? 1024 : ((toupper(unit[0]) == 'M') ? 1024 * 1024 : 1024 * 1024 * 1024);
+        }
+        else if (strcmp(unit, "p") == 0) {
+            rotation = RT_PACKETS;
+        }
+        else if (strcmp(unit, "s") == 0) {
+            rotation = RT_SECONDS;
+        }
+
+        if (rotation == RT_NONE || rotationLimit == 0) {
+            cout << "not ok. You specified an invalid split of the output: " << argv[splitArg];
+            printHelpAndWait();
+            return 1;
+        }
+        cout << "ok. You specified to split the outputs every " << argv[splitArg];
+    }
+    else {
+        cout << "ok. You seem to like one output file per job";
+    }
+
     Logger::GetLogger().Log(LL_INFO, " * Checking optional DRY-run argument... ");
+    bool dryRun = false;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0) {
+            dryRun = true;
+            break;
+        }
+    }
+
+    if (dryRun) {
+        cout << "ok. This will be a DRY-run. The inputs are analyzed, no output files will be written ";
+    }
+    else {
+        cout << "ok. This will be a NORMAL-run. All output files will be written ";
+    }
+
+    Logger::GetLogger().Log(LL_INFO, " * Checking sort-window argument... ");
     int sortWindowArg = -1;
     int sortWindowSize = 0;
     for (int i = 0; i < argc; i++) {
@@ -138,26 +536,17 @@ int main(int argc, char* argv[])
             cout << "ok. You specified a sort window size of: " << sortWindowSize;
         }
     }
-    else {
+    else if (sortMode == SM_ADAPTIVE) {
+        sortWindowSize = (int)SortJob::DefaultAdaptiveWindow;
+        cout << "ok. The adaptive sort window starts at " << sortWindowSize << " packets";
+    }
+    else if (sortMode == SM_WINDOW && !dryRun) {
         cout << "not ok. Can't find sort-window argument. Please specify a valid sort-window.";
         printHelpAndWait();
         return 1;
     }
-
-    Logger::GetLogger().Log(LL_INFO, " * Checking optional DRY-run argument... ");
-    bool dryRun = false;
-    for (int i = 0; i < argc; i++) {
-        if (strcmp(argv[i], "-d") == 0) {
-            dryRun = true;
-            break;
-        }
-    }
-
-    if (dryRun) {
-        cout << "ok. This will be a DRY-run. No output files will be written ";
-    }
     else {
-        cout << "ok. This will be a NORMAL-run. All output files will be written ";
+        cout << "ok. The sort-window is not needed for this sort mode";
     }
 
     Logger::GetLogger().Log(LL_INFO, " * Checking optional JOBCOUNT argument... ");
@@ -170,8 +559,9 @@ int main(int argc, char* argv[])
     }
 
     if (jobCountArg > 0) {
-        jobCount = atoi(argv[jobCountArg]);
-        if (jobCount > 0 && jobCount <= MaxThreadNumber) {
+        int jobs = atoi(argv[jobCountArg]);
+        if (jobs > 0) {
+            jobCount = jobs;
             cout << "ok. You specified " << jobCount << " jobs to run in parallel";
         }
         else {
@@ -186,6 +576,89 @@ int main(int argc, char* argv[])
     }
 
 
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional RECURSIVE argument... ");
+    bool recursive = false;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-R") == 0) {
+            recursive = true;
+            break;
+        }
+    }
+
+    if (recursive) {
+        cout << "ok. The subdirectories of an input directory are included";
+    }
+    else {
+        cout << "ok. Only the files directly in an input directory are taken";
+    }
+
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional WATCH argument... ");
+    bool watchMode = false;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0) {
+            watchMode = true;
+            break;
+        }
+    }
+
+    if (watchMode) {
+        if (!fs::is_directory(argv[inputFile]) || !fs::is_directory(argv[outputFile])) {
+            cout << "not ok. The watch mode needs an input and an output directory";
+            printHelpAndWait();
+            return 1;
+        }
+        cout << "ok. The input directory is watched until you stop me";
+    }
+    else {
+        cout << "ok. The inputs are sorted once";
+    }
+
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional INCLUDE and EXCLUDE arguments... ");
+    PathFilter pathFilter;
+    for (int i = 0; i < argc-1; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            pathFilter.AddInclude(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-e") == 0) {
+            pathFilter.AddExclude(argv[++i]);
+        }
+    }
+
+    if (!pathFilter.IsEmpty()) {
+        cout << "ok. The files of an input directory are filtered by your patterns";
+    }
+    else {
+        cout << "ok. All captures of an input directory are taken";
+    }
+
+    Logger::GetLogger().Log(LL_INFO, " * Checking optional MEMORY_LIMIT argument... ");
+    int memoryLimitArg = -1;
+    for (int i = 0; i < argc-1; i++) {
+        if (strcmp(argv[i], "-g") == 0) {
+            memoryLimitArg = i+1;
+            break;
+        }
+    }
+
+    if (memoryLimitArg > 0) {
+        int memoryLimitMB = atoi(argv[memoryLimitArg]);
+        if (memoryLimitMB < 0 || (memoryLimitMB == 0 && strcmp(argv[memoryLimitArg], "0") != 0)) {
+            cout << "not ok. You specified an invalid memory limit: " << argv[memoryLimitArg];
+            printHelpAndWait();
+            return 1;
+        }
+        MemoryBudget::GetMemoryBudget().SetLimit(((uint64_t)memoryLimitMB) * 1024 * 1024);
+        cout << "ok. You specified a memory limit of " << memoryLimitMB << " MB for all jobs";
+    }
+    else if (MemoryBudget::CgroupLimit() > 0) {
+        // The rest is left for the program itself and the memory which is not estimated
+        MemoryBudget::GetMemoryBudget().SetLimit(MemoryBudget::CgroupLimit() / 10 * 9);
+        cout << "ok. The jobs share the memory limit of the cgroup: " << (MemoryBudget::GetMemoryBudget().Limit() / 1024 / 1024) << " MB";
+    }
+    else {
+        cout << "ok. You seem to like running without a memory limit";
+    }
+
 	Logger::GetLogger().Log(LL_INFO, " * Checking optional log-level argument... ");
     int logArgument = -1;
     for(int i = 0; i < argc-1; i++) {
@@ -214,49 +687,207 @@ int main(int argc, char* argv[])
 
     
 
+    // Jobs start as soon as they are pushed
+    ThreadPool::GetThreadPool().Start(0, jobCount, []() {
+        return JobList::GetJobList().RunNextJob();
+    });
+    Logger::GetLogger().Log(LL_INFO, "All job-executers have been started.");
+    if (threadCount == 0) {
+        threadCount = ThreadPool::GetThreadPool().WorkerCount();
+    }
+
     Logger::GetLogger().Log(LL_INFO, "Prepare jobs...");
     if (fs::is_directory(argv[inputFile]) && fs::is_directory(argv[outputFile])) {
 
-        if (!fs::exists(argv[outputFile] + string("/sorted/"))) {
-            fs::create_directory(argv[outputFile] + string("/sorted/"));
-            Logger::GetLogger().Log(LL_INFO, "Output directory created: ", (argv[outputFile] + string("/sorted/")).c_str());
+        fs::path outputRoot = fs::path(argv[outputFile]) / "sorted";
+        if (!fs::exists(outputRoot)) {
+            fs::create_directory(outputRoot);
+            Logger::GetLogger().Log(LL_INFO, "Output directory created: ", outputRoot.generic_string().c_str());
         }
 
-        for (auto& p : fs::directory_iterator(argv[inputFile])) {
-            string extension_string = p.path().extension().generic_string();
-            string filename = p.path().filename().generic_string();
-            filename = filename.substr(0, filename.length() - extension_string.length());
-            const char* ext = extension_string.c_str();
-            if (p.is_regular_file() && ((_stricmp(ext, ".pcap") == 0) || (_stricmp(ext, ".pcapng") == 0))) {
-                SortJob* job = new SortJob();
-                job->CreateJob(p.path().generic_string(), argv[outputFile] + string("/sorted/") + filename + string(".pcap"), sortWindowSize, dryRun);
+        // Compressed captures are written uncompressed, unless COMPRESSION is given
+        fs::path lastDirectory = outputRoot;
+        auto createJob = [&](const fs::path& path, const fs::path& relativeDirectory, const string& captureName) {
+            fs::path outputDirectory = outputRoot / relativeDirectory;
+            if (outputDirectory != lastDirectory) {
+                error_code errorCode;
+                fs::create_directories(outputDirectory, errorCode);
+                lastDirectory = outputDirectory;
+            }
+
+            SortJob* job = new SortJob();
+            job->CreateJob(path.generic_string(), (outputDirectory / (captureName + CompressedFile::Extension(compression))).generic_string(), sortWindowSize, dryRun);
+            job->SetSortMode(sortMode, ramBudget);
+            job->SetThreadCount(threadCount);
+            job->SetAsyncIo(queueDepth, ioBufferSize);
+            job->SetCompression(compression, compressionLevel);
+            job->SetRotation(rotation, rotationLimit);
+            return job;
+        };
+
+        if (!watchMode) {
+            // The first batches run while the rest of the tree is still searched
+            vector<SortJob*> jobs;
+            size_t captureCount = DiscoverCaptures(argv[inputFile], recursive, pathFilter, outputRoot, [&](const fs::path& path, const fs::path& relativeDirectory, const string& captureName) {
+                jobs.push_back(createJob(path, relativeDirectory, captureName));
+                if (jobs.size() >= DiscoveryBatchSize) {
+                    JobList::GetJobList().PushSortJobs(jobs);
+                }
+            });
+            JobList::GetJobList().PushSortJobs(jobs);
+            Logger::GetLogger().Log(LL_INFO, "Captures found in the input directory: ", (int)captureCount);
+        }
+        else {
+            JobJournal journal;
+            FolderWatcher watcher;
+            if (journal.Open((outputRoot / "PcapSorter.journal").generic_string()) != 0 || watcher.Open(argv[inputFile], recursive, outputRoot) != 0) {
+                ThreadPool::GetThreadPool().Stop();
+                return 1;
+            }
+            Logger::GetLogger().Log(LL_INFO, "Inputs sorted before: ", (int)journal.CompletedCount());
+
+            // A capture is pushed once, the journal skips it while it runs and once it is sorted.
+            // The inputs are recorded by their absolute path, so a restart finds them again.
+            auto submit = [&](const fs::path& path) {
+                fs::path relativePath = path.lexically_relative(argv[inputFile]);
+                string captureName = CaptureFileName(path);
+                if (captureName.empty() || !pathFilter.IncludesPath(relativePath.generic_string())) {
+                    return;
+                }
+
+                error_code sizeError, pathError;
+                uintmax_t size = fs::file_size(path, sizeError);
+                fs::path inputPath = fs::absolute(path, pathError).lexically_normal();
+                if (sizeError || pathError || !journal.TryStart(inputPath.generic_string(), size)) {
+                    return;
+                }
+
+                SortJob* job = createJob(inputPath, relativePath.parent_path(), captureName);
+                job->SetJournal(&journal);
                 JobList::GetJobList().PushSortJob(job);
+            };
+
+            // Captures which may still be written wait until they were not modified for a while
+            map<fs::path, pair<uintmax_t, fs::file_time_type>> settling;
+            auto seen = [&](const fs::path& path) {
+                if (CaptureFileName(path).empty() || settling.find(path) != settling.end()) {
+                    return;
+                }
+                error_code sizeError, timeError;
+                uintmax_t size = fs::file_size(path, sizeError);
+                fs::file_time_type writeTime = fs::last_write_time(path, timeError);
+                if (!sizeError && !timeError) {
+                    settling[path] = make_pair(size, writeTime);
+                }
+            };
+
+            size_t captureCount = DiscoverCaptures(argv[inputFile], recursive, pathFilter, outputRoot, [&](const fs::path& path, const fs::path&, const string&) {
+                seen(path);
+            });
+            Logger::GetLogger().Log(LL_INFO, "Captures found in the input directory: ", (int)captureCount);
+            Logger::GetLogger().Log(LL_INFO, "Watching the input directory. Stop with Ctrl+C");
+
+            signal(SIGINT, StopWatching);
+            signal(SIGTERM, StopWatching);
+            while (!stopWatching) {
+                vector<FolderWatcher::WatchEventType> events;
+                bool rescan = false;
+                watcher.Wait(events, WatchPollMs, &rescan);
+
+                for (FolderWatcher::WatchEventType& event : events) {
+                    if (event.finished) {
+                        settling.erase(event.path);
+                        submit(event.path);
+                    }
+                    else {
+                        seen(event.path);
+                    }
+                }
+                if (rescan) {
+                    Logger::GetLogger().Log(LL_WARNING, "Too many changes of the input directory at once. Searching it again...");
+                    DiscoverCaptures(argv[inputFile], recursive, pathFilter, outputRoot, [&](const fs::path& path, const fs::path&, const string&) {
+                        seen(path);
+                    });
+                }
+
+                fs::file_time_type now = fs::file_time_type::clock::now();
+                for (auto entry = settling.begin(); entry != settling.end(); ) {
+                    error_code sizeError, timeError;
+                    uintmax_t size = fs::file_size(entry->first, sizeError);
+                    fs::file_time_type writeTime = fs::last_write_time(entry->first, timeError);
+                    if (sizeError || timeError) {
+                        entry = settling.erase(entry);  // Removed or moved away
+                    }
+                    else if (size != entry->second.first || writeTime != entry->second.second) {
+                        entry->second = make_pair(size, writeTime);
+                        ++entry;
+                    }
+                    else if (now - writeTime >= chrono::seconds(WatchSettleSeconds)) {
+                        submit(entry->first);
+                        entry = settling.erase(entry);
+                    }
+                    else {
+                        ++entry;
+                    }
+                }
             }
+            // A second Ctrl+C ends the program right away
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+
+            Logger::GetLogger().Log(LL_INFO, "Stopped watching. Wait for the pushed jobs to finish...\n");
+            JobList::GetJobList().WaitJobs();
+            watcher.Close();
         }
     }
+    else if (fs::is_directory(argv[inputFile]) && !fs::is_directory(argv[outputFile])) {
+        vector<string> mergeFiles;
+
+        DiscoverCaptures(argv[inputFile], recursive, pathFilter, fs::path(), [&](const fs::path& path, const fs::path&, const string&) {
+            mergeFiles.push_back(path.generic_string());
+        });
+        sort(mergeFiles.begin(), mergeFiles.end());
+
+        if (mergeFiles.empty()) {
+            Logger::GetLogger().Log(LL_ERROR, "Can't create the merge job. The input directory contains no PCAP files.");
+            printHelpAndWait();
+            return 1;
+        }
+        // Every input of a merge is sorted by its own window
+        if (!dryRun && (sortMode == SM_EXACT || sortMode == SM_INDEX)) {
+            Logger::GetLogger().Log(LL_ERROR, "Can't create the merge job. A merge into one file sorts by a window, use the sort mode window or adaptive.");
+            printHelpAndWait();
+            return 1;
+        }
+
+        SortJob* job = new SortJob();
+        job->CreateMergeJob(mergeFiles, argv[outputFile], sortWindowSize, dryRun);
+        job->SetSortMode(sortMode, ramBudget);
+        job->SetThreadCount(threadCount);
+        job->SetAsyncIo(queueDepth, ioBufferSize);
+        job->SetCompression(compression, compressionLevel);
+        job->SetRotation(rotation, rotationLimit);
+        JobList::GetJobList().PushSortJob(job);
+    }
     else if(!fs::is_directory(argv[inputFile]) && !fs::is_directory(argv[outputFile])){
         SortJob* job = new SortJob();
         job->CreateJob(argv[inputFile], argv[outputFile], sortWindowSize, dryRun);
+        job->SetSortMode(sortMode, ramBudget);
+        job->SetThreadCount(threadCount);
+        job->SetAsyncIo(queueDepth, ioBufferSize);
+        job->SetCompression(compression, compressionLevel);
+        job->SetRotation(rotation, rotationLimit);
         JobList::GetJobList().PushSortJob(job);
     }
     else {
-        Logger::GetLogger().Log(LL_ERROR, "Can't create jobs. Your input and output paths must specified either both files or directories.");
+        Logger::GetLogger().Log(LL_ERROR, "Can't create jobs. Your input and output paths must specified either both files or directories, or a directory and a file to merge into.");
         printHelpAndWait();
         return 1;
     } 
-    Logger::GetLogger().Log(LL_INFO, "Jobs created.\n");
+    Logger::GetLogger().Log(LL_INFO, "Jobs created. Wait for them to finish...\n");
 
-    for (unsigned int i = 0; i < jobCount; i++) {
-        threads[i] = new Thread();
-        threads[i]->Create();
-    }
-    Logger::GetLogger().Log(LL_INFO, "All job-executers have been started. Wait for them to finish...");
-
-    for (unsigned int i = 0; i < jobCount; i++) {
-        threads[i]->Remove();
-        delete(threads[i]);
-        threads[i] = 0;
-    }
+    JobList::GetJobList().WaitJobs();
+    ThreadPool::GetThreadPool().Stop();
     Logger::GetLogger().Log(LL_INFO, "All jobs have finished\n");
     
     Logger::GetLogger().SetLogLevel(LL_INFO);    
@@ -17,42 +17,308 @@
 
 #include "PcapWriter.h"
 #include "Logger.h"
+#include "Platform.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static const size_t CopyBlockSize = 1024 * 1024;
 
 PcapWriter::PcapWriter(void)
 {
+    swapByteOrder = false;
+    nanoseconds = false;
+    pcapng = false;
+    copyRecords = false;
+    interfaceCount = 0;
+    preambleInterfaces = 0;
+    asyncQueueDepth = 0;
+    asyncBufferSize = 0;
+    compression = CompressedFile::CT_NONE;
+    compressionLevel = 0;
+    compressionThreads = 1;
+    rotation = RT_NONE;
+    rotationLimit = 0;
+    segmentIndex = 0;
+    segmentBytes = 0;
+    segmentPackets = 0;
+    segmentEndSeconds = 0;
+    segmentCloseFailed.store(false);
+#ifdef __linux__
+    copySourceFd = -1;
+#endif
 }
 
 PcapWriter::~PcapWriter(void)
 {
+    Close();
+}
+
+string PcapWriter::SegmentName(const string& fileName, uint32_t index)
+{
+    char number[16];
+    snprintf(number, sizeof(number), "_%05u", index);
+
+    // The number goes in front of the capture extension, e.g. out_00001.pcap.zst
+    size_t nameStart = fileName.find_last_of("/\\");
+    nameStart = (nameStart == string::npos) ? 0 : nameStart + 1;
+    size_t extension = fileName.find(".pcap", nameStart);
+    if (extension == string::npos) {
+        return fileName + number;
+    }
+    return fileName.substr(0, extension) + number + fileName.substr(extension);
 }
 
 int PcapWriter::Open(const char* fileName)
 {
     Close();
+    this->fileName = fileName;
+    interfaceCount = 0;
+    preambleInterfaces = 0;
+    segmentIndex = 0;
+    segmentHeader.clear();
+    return OpenSegment();
+}
 
-    file = ofstream(fileName, ios::out | ios::binary);
-    if (!file.is_open()) {
+int PcapWriter::OpenSegment()
+{
+    output = make_unique<PcapOutputType>();
+    output->fileName = fileName;
+    if (rotation != RT_NONE) {
+        output->finalName = SegmentName(fileName, segmentIndex);
+        output->fileName = output->finalName + ".part";
+    }
+    segmentBytes = 0;
+    segmentPackets = 0;
+    segmentEndSeconds = 0;
+
+    const char* name = output->fileName.c_str();
+    if (compression != CompressedFile::CT_NONE) {
+        if (output->compressedFile.OpenWrite(name, compression, compressionLevel, compressionThreads, asyncBufferSize) != 0) {
+            Logger::GetLogger().Log(LL_ERROR, "Can not open output PCAP file");
+            output.reset();
+            return -1;
+        }
+        return 0;
+    }
+
+    if (asyncQueueDepth > 0) {
+        if (output->uringFile.OpenWrite(name, asyncQueueDepth, asyncBufferSize) == 0) {
+            return 0;
+        }
+        Logger::GetLogger().Log(LL_DEBUG, "io_uring is not available, write the output as a stream");
+    }
+
+    if (output->file.Open(name, asyncBufferSize) != 0) {
         Logger::GetLogger().Log(LL_ERROR, "Can not open output PCAP file");
+        output.reset();
         return -1;
     }
     return 0;
 }
 
+// Closes the file and gives a segment its final name
+bool PcapWriter::CloseOutput(PcapOutputType* output)
+{
+    bool result = true;
+
+    if (output->compressedFile.IsOpen() && output->compressedFile.Close() != 0) {
+        result = false;
+    }
+    if (output->uringFile.IsOpen() && output->uringFile.Close() != 0) {
+        result = false;
+    }
+    if (output->file.IsOpen() && output->file.Close() != 0) {
+        result = false;
+    }
+    if (!result) {
+        Logger::GetLogger().Log(LL_ERROR, "Can not write the output PCAP file completely: ", output->fileName.c_str());
+        return false;
+    }
+
+    if (!output->finalName.empty()) {
+        error_code errorCode;
+        fs::rename(output->fileName, output->finalName, errorCode);
+        if (errorCode) {
+            Logger::GetLogger().Log(LL_ERROR, "Can not rename the completed output PCAP file: ", output->fileName.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+void PcapWriter::CloseSegment(unique_ptr<PcapOutputType> segment, atomic<bool>* failed)
+{
+    if (!CloseOutput(segment.get())) {
+        failed->store(true);
+    }
+}
+
 int PcapWriter::Close()
 {
-    if (file.is_open()) {
-        file.close();
+    int result = 0;
+
+    CloseCopySource();
+    if (output && !CloseOutput(output.get())) {
+        result = -1;
+    }
+    output.reset();
+
+    if (segmentCloser.joinable()) {
+        segmentCloser.join();
+    }
+    if (segmentCloseFailed.exchange(false)) {
+        result = -1;
+    }
+    return result;
+}
+
+void PcapWriter::Preallocate(uint64_t size)
+{
+    // The size of a compressed output or of a segment is not known in advance
+    if (!output || output->compressedFile.IsOpen() || rotation != RT_NONE) {
+        return;
+    }
+
+    int result = output->uringFile.IsOpen() ? output->uringFile.Preallocate(size) : output->file.Preallocate(size);
+    if (result != 0) {
+        Logger::GetLogger().Log(LL_DEBUG, "The output can not be preallocated, it grows while it is written");
+    }
+}
+
+void PcapWriter::RotateIfNeeded(const PcapPacketHeaderType& packetHeader, uint32_t length)
+{
+    if (rotation == RT_NONE) {
+        return;
+    }
+
+    bool rotate = false;
+    if (segmentPackets > 0) {
+        switch (rotation) {
+        case RT_BYTES:
+            rotate = segmentBytes + length > rotationLimit;
+            break;
+        case RT_PACKETS:
+            rotate = segmentPackets >= rotationLimit;
+            break;
+        default:
+            rotate = packetHeader.timestampSeconds >= segmentEndSeconds;
+        }
+    }
+
+    if (rotate) {
+        CloseCopySource();
+
+        // One segment is closed at a time, which bounds the memory of their buffers
+        if (segmentCloser.joinable()) {
+            segmentCloser.join();
+        }
+        if (output) {
+            segmentCloser = thread(CloseSegment, move(output), &segmentCloseFailed);
+        }
+
+        segmentIndex++;
+        if (OpenSegment() != 0) {
+            segmentCloseFailed.store(true);
+        }
+        Write(segmentHeader.data(), segmentHeader.size());
+    }
+
+    // Segments of a time span start at multiples of it
+    if (segmentPackets == 0 && rotation == RT_SECONDS) {
+        segmentEndSeconds = (packetHeader.timestampSeconds / rotationLimit + 1) * rotationLimit;
+    }
+    segmentPackets++;
+}
+
+void PcapWriter::Write(const void* data, size_t length)
+{
+    segmentBytes += length;
+    if (!output) {
+        return;
+    }
+
+    if (output->compressedFile.IsOpen()) {
+        output->compressedFile.Write((const uint8_t*)data, length);
+    }
+    else if (output->uringFile.IsOpen()) {
+        output->uringFile.Write((const uint8_t*)data, length);
+    }
+    else {
+        output->file.Write((const uint8_t*)data, length);
+    }
+}
+
+uint8_t* PcapWriter::Reserve(size_t length)
+{
+    segmentBytes += length;
+    if (!output) {
+        // Written nowhere, the output failed already
+        discarded.resize(max(discarded.size(), length));
+        return discarded.data();
+    }
+
+    if (output->compressedFile.IsOpen()) {
+        return output->compressedFile.Reserve(length);
+    }
+    if (output->uringFile.IsOpen()) {
+        return output->uringFile.Reserve(length);
+    }
+    return output->file.Reserve(length);
+}
+
+void PcapWriter::WriteHeader(const void* data, size_t length)
+{
+    Write(data, length);
+    if (rotation != RT_NONE) {
+        segmentHeader.insert(segmentHeader.end(), (const uint8_t*)data, (const uint8_t*)data + length);
     }
-    return 0;
+}
+
+void PcapWriter::CloseCopySource()
+{
+    if (copySource.is_open()) {
+        copySource.close();
+    }
+#ifdef __linux__
+    if (copySourceFd >= 0) {
+        close(copySourceFd);
+        copySourceFd = -1;
+    }
+#endif
+    copySourceName.clear();
 }
 
 int PcapWriter::WritePcapHeader(PcapHeaderType* pcapHeader)
 {
+    if (pcapng) {
+        // One section of unknown length for all packets
+        PcapngSectionHeaderBlockType sectionHeader;
+        uint32_t blockLength = sizeof(sectionHeader) + 4;
+        sectionHeader.block.blockType = PcapngBlockTypesType::sectionHeader;
+        sectionHeader.block.blockTotalLength = blockLength;
+        sectionHeader.magicNumber = 0x1A2B3C4D;
+        sectionHeader.versionMajor = 1;
+        sectionHeader.versionMinor = 0;
+        sectionHeader.sectionLength = UINT64_MAX;
+
+        WriteHeader(&sectionHeader, sizeof(sectionHeader));
+        WriteHeader(&blockLength, sizeof(blockLength));
+        return 0;
+    }
+
     PcapHeaderType pcapHeaderCpy;
     memcpy(&pcapHeaderCpy, pcapHeader, sizeof(PcapHeaderType));
 
     if (swapByteOrder) {
-        pcapHeaderCpy.magicNumber = 0xD4C3B2A1;
+        pcapHeaderCpy.magicNumber = nanoseconds ? 0x4D3CB2A1 : 0xD4C3B2A1;
         pcapHeaderCpy.versionMajor = _byteswap_ushort(2);
         pcapHeaderCpy.versionMinor = _byteswap_ushort(4);
         pcapHeaderCpy.timezone = _byteswap_ulong(pcapHeaderCpy.timezone);
@@ -61,30 +327,215 @@ int PcapWriter::WritePcapHeader(PcapHeaderType* pcapHeader)
         pcapHeaderCpy.network = _byteswap_ulong(pcapHeaderCpy.network);
     }
     else {
-        pcapHeaderCpy.magicNumber = 0xA1B2C3D4;
+        pcapHeaderCpy.magicNumber = nanoseconds ? 0xA1B23C4D : 0xA1B2C3D4;
         pcapHeaderCpy.versionMajor = 2;
         pcapHeaderCpy.versionMinor = 4;
     }
 
-    file.write((const char*)&pcapHeaderCpy, sizeof(PcapHeaderType));
+    WriteHeader(&pcapHeaderCpy, sizeof(PcapHeaderType));
     return 0;
 }
 
-int PcapWriter::WritePacketHeader(PcapPacketHeaderType* packetHeader)
+int PcapWriter::WritePacketHeader(const PcapPacketHeaderType& packetHeader)
 {
+    // Byte swapped straight into the output, the header of the caller is left as it is
+    PcapPacketHeaderType* header = (PcapPacketHeaderType*)Reserve(sizeof(PcapPacketHeaderType));
     if (swapByteOrder) {
-        packetHeader->timestampSeconds = _byteswap_ulong(packetHeader->timestampSeconds);
-        packetHeader->timestampMicroSeconds = _byteswap_ulong(packetHeader->timestampMicroSeconds);
-        packetHeader->packetLength = _byteswap_ulong(packetHeader->packetLength);
-        packetHeader->originalLength = _byteswap_ulong(packetHeader->originalLength);
+        header->timestampSeconds = _byteswap_ulong(packetHeader.timestampSeconds);
+        header->timestampMicroSeconds = _byteswap_ulong(packetHeader.timestampMicroSeconds);
+        header->packetLength = _byteswap_ulong(packetHeader.packetLength);
+        header->originalLength = _byteswap_ulong(packetHeader.originalLength);
+    }
+    else {
+        *header = packetHeader;
+    }
+    return 0;
+}
+
+int PcapWriter::WriteData(const uint8_t* data, uint32_t len)
+{
+    Write(data, len);
+    return 0;
+}
+
+int PcapWriter::WritePreamble(const vector<uint8_t>& preamble, uint32_t interfaceCount)
+{
+    PcapngSectionHeaderBlockType sectionHeader;
+    if (preamble.size() < sizeof(sectionHeader)) {
+        return -1;
+    }
+
+    // Blocks may be dropped or reordered, so the section length becomes unknown
+    memcpy(&sectionHeader, preamble.data(), sizeof(sectionHeader));
+    sectionHeader.sectionLength = UINT64_MAX;
+    WriteHeader(&sectionHeader, sizeof(sectionHeader));
+    WriteHeader(preamble.data() + sizeof(sectionHeader), preamble.size() - sizeof(sectionHeader));
+
+    preambleInterfaces = interfaceCount;
+    return 0;
+}
+
+uint32_t PcapWriter::AddInterface(const PcapInterfaceType& interface)
+{
+    if (!pcapng) {
+        return 0;
+    }
+
+    // Described by the preamble already
+    if (interfaceCount < preambleInterfaces) {
+        return interfaceCount++;
+    }
+
+    // Records which are copied keep the timestamps of their interface
+    if (CopiesRecordsOf(interface)) {
+        WriteHeader(interface.block.data(), interface.block.size());
+        return interfaceCount++;
+    }
+
+    // Timestamps are written in the resolution of the writer, already shifted by the offset
+    // of the input. All other options are passed on.
+    PcapngInterfaceDescriptionBlockType description;
+    PcapngOptionType resolution = { PcapngIfOptionCodesType::if_tsresol, 1 };
+    uint8_t resolutionValue[4] = { 9, 0, 0, 0 };
+    PcapngOptionType endOfOptions = { PcapngOptionCodesType::opt_endofopt, 0 };
+    uint32_t blockLength = sizeof(description) + (uint32_t)interface.options.size() + sizeof(endOfOptions) + 4;
+    if (nanoseconds) {
+        blockLength += sizeof(resolution) + sizeof(resolutionValue);
     }
 
-    file.write((const char*)packetHeader, sizeof(PcapPacketHeaderType));
+    description.block.blockType = PcapngBlockTypesType::interfaceDescription;
+    description.block.blockTotalLength = blockLength;
+    description.linkType = interface.linkType;
+    description.reserved = 0;
+    description.snapLen = interface.snapLength;
+
+    WriteHeader(&description, sizeof(description));
+    WriteHeader(interface.options.data(), interface.options.size());
+    if (nanoseconds) {
+        WriteHeader(&resolution, sizeof(resolution));
+        WriteHeader(resolutionValue, sizeof(resolutionValue));
+    }
+    WriteHeader(&endOfOptions, sizeof(endOfOptions));
+    WriteHeader(&blockLength, sizeof(blockLength));
+
+    return interfaceCount++;
+}
+
+int PcapWriter::WriteRecord(const PcapPacketHeaderType& packetHeader, const uint8_t* record, uint32_t length)
+{
+    RotateIfNeeded(packetHeader, length);
+    Write(record, length);
+    return 0;
+}
+
+int PcapWriter::WriteRecords(const uint8_t* records, size_t length)
+{
+    Write(records, length);
     return 0;
 }
 
-int PcapWriter::WriteData(uint8_t* data, uint32_t len)
+int PcapWriter::WritePacket(const PcapPacketHeaderType& packetHeader, uint32_t interfaceId, const uint8_t* data)
 {
-    file.write((const char*)data, len);
+    if (pcapng) {
+        uint32_t paddingLength = (4 - (packetHeader.packetLength & 0x3)) & 0x3;
+        uint32_t blockLength = sizeof(PcapngEnhancedPacketBlockType) + packetHeader.packetLength + paddingLength + 4;
+        uint64_t timestamp = ((uint64_t)packetHeader.timestampSeconds) * (nanoseconds ? 1000000000 : 1000000) + packetHeader.timestampMicroSeconds;
+        RotateIfNeeded(packetHeader, blockLength);
+
+        PcapngEnhancedPacketBlockType* packet = (PcapngEnhancedPacketBlockType*)Reserve(sizeof(PcapngEnhancedPacketBlockType));
+        packet->block.blockType = PcapngBlockTypesType::enhancedPacket;
+        packet->block.blockTotalLength = blockLength;
+        packet->interfaceId = interfaceId;
+        packet->timestampHigh = (uint32_t)(timestamp >> 32);
+        packet->timestampLow = (uint32_t)timestamp;
+        packet->capturedLen = packetHeader.packetLength;
+        packet->packetLen = packetHeader.originalLength;
+
+        Write(data, packetHeader.packetLength);
+
+        // Padding and the trailing block length
+        uint8_t* trailer = Reserve(paddingLength + sizeof(blockLength));
+        memset(trailer, 0, paddingLength);
+        memcpy(trailer + paddingLength, &blockLength, sizeof(blockLength));
+        return 0;
+    }
+
+    RotateIfNeeded(packetHeader, sizeof(PcapPacketHeaderType) + packetHeader.packetLength);
+    WritePacketHeader(packetHeader);
+    Write(data, packetHeader.packetLength);
+    return 0;
+}
+
+int PcapWriter::CopyRange(const char* sourceFileName, uint64_t offset, uint64_t length)
+{
+    if (copySourceName != sourceFileName) {
+        CloseCopySource();
+        copySourceName = sourceFileName;
+    }
+    if (!output) {
+        return -1;
+    }
+
+    // A compressed output gets the range through Write, the kernel can not compress it
+    bool compressed = output->compressedFile.IsOpen();
+    if (output->uringFile.IsOpen()) {
+        output->uringFile.Flush();
+    }
+    else if (!compressed) {
+        output->file.Flush();
+    }
+
+#ifdef __linux__
+    int targetFd = compressed ? -1 : (output->uringFile.IsOpen() ? output->uringFile.Descriptor() : output->file.Descriptor());
+    if (copySourceFd < 0 && targetFd >= 0) {
+        copySourceFd = open(sourceFileName, O_RDONLY);
+    }
+
+    if (copySourceFd >= 0 && targetFd >= 0) {
+        loff_t sourceOffset = (loff_t)offset;
+        loff_t targetOffset = output->uringFile.IsOpen() ? (loff_t)output->uringFile.WriteOffset() : (loff_t)output->file.WriteOffset();
+
+        // The kernel copies (or reflinks) the range without passing it through user space
+        while (length > 0) {
+            ssize_t copied = copy_file_range(copySourceFd, &sourceOffset, targetFd, &targetOffset, length, 0);
+            if (copied <= 0)
+                break;
+            length -= copied;
+            segmentBytes += copied;
+        }
+        if (output->uringFile.IsOpen()) {
+            output->uringFile.SetWriteOffset((uint64_t)targetOffset);
+        }
+        else {
+            output->file.SetWriteOffset((uint64_t)targetOffset);
+        }
+        offset = (uint64_t)sourceOffset;
+    }
+#endif
+
+    if (length > 0) {
+        if (!copySource.is_open()) {
+            copySource.open(sourceFileName, ios::in | ios::binary);
+            if (!copySource.is_open()) {
+                Logger::GetLogger().Log(LL_ERROR, "Can not open the source of a copied range");
+                return -1;
+            }
+        }
+
+        vector<char> block((size_t)min<uint64_t>(length, CopyBlockSize));
+        copySource.clear();
+        copySource.seekg(offset, ios::beg);
+        while (length > 0) {
+            size_t blockLength = (size_t)min<uint64_t>(length, block.size());
+            copySource.read(block.data(), blockLength);
+            if ((size_t)copySource.gcount() != blockLength) {
+                Logger::GetLogger().Log(LL_ERROR, "Can not read the source of a copied range");
+                return -2;
+            }
+            Write(block.data(), blockLength);
+            length -= blockLength;
+        }
+    }
+
     return 0;
 }
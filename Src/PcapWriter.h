@@ -18,29 +18,175 @@
 #pragma once
 
 #include "PcapFormat.h"
+#include "PcapPacket.h"
+#include "CompressedFile.h"
+#include "GatherFile.h"
+#include "UringFile.h"
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
 
 using namespace std;
 
+enum RotationType {
+    RT_NONE = 0,    // One output file
+    RT_BYTES = 1,   // A new file before the one which would exceed the limit in bytes
+    RT_PACKETS = 2, // A new file every limit packets
+    RT_SECONDS = 3  // A new file every limit seconds of capture time
+};
+
+/* One output file, a segment of a rotated output */
+struct PcapOutputType {
+    GatherFile      file;
+    UringFile       uringFile;      // Used instead of file if asynchronous I/O is enabled
+    CompressedFile  compressedFile; // Used instead of both if the output is compressed
+    string          fileName;       // Name while it is written
+    string          finalName;      // Name once it is complete, if that is another one
+};
+
 class PcapWriter
 {
 private:
-    ofstream        file;
+    unique_ptr<PcapOutputType> output;
+    unsigned int    asyncQueueDepth;
+    size_t          asyncBufferSize;
+    CompressedFile::CompressionType compression;
+    int             compressionLevel;
+    unsigned int    compressionThreads;
+    string          fileName;
+
+    // Rotation of the output into segments. The file header and all interfaces
+    // are repeated at the start of every segment.
+    RotationType    rotation;
+    uint64_t        rotationLimit;
+    uint32_t        segmentIndex;
+    uint64_t        segmentBytes;
+    uint64_t        segmentPackets;
+    uint64_t        segmentEndSeconds;
+    vector<uint8_t> segmentHeader;
+    thread          segmentCloser;  // Closes the previous segment while the next one is written
+    atomic<bool>    segmentCloseFailed;
+    vector<uint8_t> discarded;      // Room of Reserve once the output failed
     bool    swapByteOrder;    
+    bool    nanoseconds;
+    bool    pcapng;
+    bool    copyRecords;
+    uint32_t interfaceCount;    // Interface description blocks written so far
+    uint32_t preambleInterfaces;
+
+    // Source of CopyRange, kept open between calls
+    string          copySourceName;
+    ifstream        copySource;
+#ifdef __linux__
+    int             copySourceFd;
+#endif
+
+    void CloseCopySource();
+    int OpenSegment();
+    void RotateIfNeeded(const PcapPacketHeaderType& packetHeader, uint32_t length);
+    static bool CloseOutput(PcapOutputType* output);
+    static void CloseSegment(unique_ptr<PcapOutputType> segment, atomic<bool>* failed);
+    void Write(const void* data, size_t length);
+    // Writes a part of the file header or an interface, which all segments start with
+    void WriteHeader(const void* data, size_t length);
+    // Room at the end of the output, e.g. to byte swap a header into it
+    uint8_t* Reserve(size_t length);
 
 public:
     PcapWriter(void);
     virtual ~PcapWriter(void);
 
+    // Write through io_uring with up to queueDepth buffers of bufferSize bytes
+    // in flight. 0 disables it, as does a system without io_uring. The output
+    // is then gathered in one buffer of bufferSize bytes.
+    void SetAsyncIo(unsigned int queueDepth, size_t bufferSize) {
+        asyncQueueDepth = queueDepth;
+        asyncBufferSize = bufferSize;
+    }
+
+    // Compress the output into independent frames, compressed by threads workers
+    // in parallel and written in order. CT_NONE writes the plain output.
+    void SetCompression(CompressedFile::CompressionType compression, int level, unsigned int threads) {
+        this->compression = compression;
+        compressionLevel = level;
+        compressionThreads = threads;
+    }
+
+    // Split the output into files of limit bytes, packets or seconds of capture
+    // time. The segments are named like the output with a running number
+    // (e.g. out_00000.pcap) and carry the suffix .part until they are complete.
+    void SetRotation(RotationType rotation, uint64_t limit) {
+        this->rotation = (limit > 0) ? rotation : RT_NONE;
+        rotationLimit = limit;
+    }
+
+    bool IsRotating() {
+        return rotation != RT_NONE;
+    }
+
+    // Name of a segment of a rotated output
+    static string SegmentName(const string& fileName, uint32_t index);
+
     int Open(const char* fileName);
     int Close();
 
+    // Reserves the disk space of the expected output size, e.g. the size of the input
+    void Preallocate(uint64_t size);
+
     void SetSwapByteOrder(bool swapByteOrder) {
         this->swapByteOrder = swapByteOrder;
     }
 
+    // Timestamp fractions are written (and expected) in nanoseconds
+    void SetNanosecondResolution(bool nanoseconds) {
+        this->nanoseconds = nanoseconds;
+    }
+
+    // Write PCAP-NG: a section header, the interfaces added by AddInterface and
+    // enhanced packet blocks. The byte order is the one of the host.
+    void SetPcapng(bool pcapng) {
+        this->pcapng = pcapng;
+    }
+
+    // Records of the input are written unchanged by WriteRecord where possible, see
+    // PcapReader::CanCopyRecords. The file header must be the one of the input then.
+    void SetCopyRecords(bool copyRecords) {
+        this->copyRecords = copyRecords;
+    }
+
     int WritePcapHeader(PcapHeaderType* pcapHeader);
-    int WritePacketHeader(PcapPacketHeaderType* packetHeader);
-    int WriteData(uint8_t* data, uint32_t len);
+
+    // Copies the PCAP-NG blocks in front of the first packet of the input instead of
+    // WritePcapHeader. The first interfaceCount AddInterface calls refer to its interfaces.
+    int WritePreamble(const vector<uint8_t>& preamble, uint32_t interfaceCount);
+    int WritePacketHeader(const PcapPacketHeaderType& packetHeader);
+    int WriteData(const uint8_t* data, uint32_t len);
+
+    // Describes the interface of following packets and returns its id for WritePacket.
+    // Classic PCAP only has the interface of the file header, which is always 0.
+    uint32_t AddInterface(const PcapInterfaceType& interface);
+
+    // True if the records of the interface are written by WriteRecord
+    bool CopiesRecordsOf(const PcapInterfaceType& interface) {
+        return copyRecords && (!pcapng || !interface.block.empty());
+    }
+
+    // Writes a record of the input as it is, the header is the one of the record
+    int WriteRecord(const PcapPacketHeaderType& packetHeader, const uint8_t* record, uint32_t length);
+
+    // Writes a packet record, the header is left as it is
+    int WritePacket(const PcapPacketHeaderType& packetHeader, uint32_t interfaceId, const uint8_t* data);
+
+    // Writes records of the input which follow each other as they are, e.g. a run
+    // of packets which is already in order. The range is not split by the rotation.
+    int WriteRecords(const uint8_t* records, size_t length);
+
+    // Appends a byte range of another file, e.g. a run of records which are
+    // already in order. On Linux the kernel copies it into the descriptor of
+    // the output (copy_file_range), otherwise and into a compressed output it
+    // is copied in blocks. The range is not split by the rotation.
+    int CopyRange(const char* sourceFileName, uint64_t offset, uint64_t length);
 };
\ No newline at end of file
@@ -0,0 +1,50 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+/* Compiler intrinsics and C runtime names of MSVC for the other compilers */
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <strings.h>
+
+inline uint16_t _byteswap_ushort(uint16_t value) {
+    return __builtin_bswap16(value);
+}
+
+inline uint32_t _byteswap_ulong(uint32_t value) {
+    return __builtin_bswap32(value);
+}
+
+inline uint64_t _byteswap_uint64(uint64_t value) {
+    return __builtin_bswap64(value);
+}
+
+inline int _stricmp(const char* a, const char* b) {
+    return strcasecmp(a, b);
+}
+
+inline int _strnicmp(const char* a, const char* b, size_t count) {
+    return strncasecmp(a, b, count);
+}
+#endif
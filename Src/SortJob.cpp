@@ -17,15 +17,51 @@
 
 #include "SortJob.h"
 #include "Logger.h"
+#include "Platform.h"
 #include "PcapReader.h"
 #include "PcapWriter.h"
-#include <list>
+#include "SortWindow.h"
+#include "PacketArena.h"
+#include "PacketIndex.h"
+#include "CaptureAnalysis.h"
+#include "SpscRing.h"
+#include "ThreadPool.h"
+#include "MemoryBudget.h"
+#include "JobJournal.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <queue>
+#include <thread>
 
+namespace fs = std::filesystem;
 
-struct PcapPacketHdrData {
-    PcapPacketHeaderType hdr;
-    uint8_t* data;
-};
+// Upper limit of run files which are merged at once (open file handles)
+static const size_t MaxMergeFanIn = 64;
+
+// Shorter runs of in-order records are not worth a separate range copy
+static const size_t MinCopyRunLength = 16;
+
+// Batches in flight between the stages of the window sort and their size
+static const size_t PipelineBatches = 16;
+static const size_t PipelineBatchSize = 256;
+// Packets decoded per read call outside of the pipeline
+static const size_t ReadBatchSize = 256;
+
+// The adaptive window shrinks after an ordered stretch of this many times its size
+// (and at least MinShrinkStretch packets), in which no packet lagged behind the
+// newest one by more than a quarter of the time the window spans
+static const size_t ShrinkStretchWindows = 8;
+static const size_t MinShrinkStretch = 65536;
+static const size_t MinAdaptiveWindow = 64;
+
+// Memory estimates for the memory limit: packets are assumed no larger than this (snap lengths
+// like 262144 of tcpdump are far beyond real packets) and index records this large on average
+static const uint64_t MaxPacketEstimate = 65535;
+static const uint64_t IndexRecordEstimate = 128;
+// Sorts which can work with a smaller RAM budget start with a quarter of it rather than wait
+static const uint64_t MinBudgetShare = 4;
+static const size_t MinRamBudget = 16 * 1024 * 1024;
 
 bool str_ends_with(const char* str, const char* suffix) {
 
@@ -41,31 +77,448 @@ bool str_ends_with(const char* str, const char* suffix) {
     return (0 == _strnicmp(str + str_len - suffix_len, suffix, suffix_len));
 }
 
+/**
+ * Output interfaces of the interfaces of one reader. They are described to the
+ * writer in the order of their ids before the first packet which needs them,
+ * so a single input keeps its interface ids and its records can be copied.
+ */
+struct InterfaceMapType {
+    vector<uint32_t>    outputIds;
+    vector<bool>        copyRecords;
+};
+
+static void WritePacket(PcapWriter* pcapWriter, PcapReader* pcapReader, InterfaceMapType& interfaceMap, const PcapPacketHdrData& packet)
+{
+    if (pcapWriter == nullptr) {
+        return;
+    }
+
+    while (interfaceMap.outputIds.size() <= packet.interfaceId) {
+        PcapInterfaceType interface;
+        pcapReader->GetInterface((uint32_t)interfaceMap.outputIds.size(), &interface);
+        interfaceMap.copyRecords.push_back(pcapWriter->CopiesRecordsOf(interface));
+        interfaceMap.outputIds.push_back(pcapWriter->AddInterface(interface));
+    }
+
+    if (interfaceMap.copyRecords[packet.interfaceId] && packet.record != nullptr) {
+        pcapWriter->WriteRecord(packet.hdr, packet.record, packet.recordLength);
+    }
+    else {
+        pcapWriter->WritePacket(packet.hdr, interfaceMap.outputIds[packet.interfaceId], packet.data);
+    }
+}
+
+static bool CopiesRecord(const InterfaceMapType& interfaceMap, const PcapPacketHdrData& packet)
+{
+    return packet.record != nullptr && packet.interfaceId < interfaceMap.copyRecords.size() && interfaceMap.copyRecords[packet.interfaceId];
+}
+
+// Writes sorted packets. Records which follow each other in memory, e.g. a run in the
+// order of a mapped input, are written as one range instead of packet by packet.
+static void WritePackets(PcapWriter* pcapWriter, PcapReader* pcapReader, InterfaceMapType& interfaceMap, const vector<PcapPacketHdrData>& packets)
+{
+    if (pcapWriter == nullptr) {
+        return;
+    }
+
+    bool copyRanges = !pcapWriter->IsRotating();
+    size_t first = 0;
+    while (first < packets.size()) {
+        size_t end = first + 1;
+        const uint8_t* rangeEnd = nullptr;
+        if (copyRanges && CopiesRecord(interfaceMap, packets[first])) {
+            rangeEnd = packets[first].record + packets[first].recordLength;
+            while (end < packets.size() && packets[end].record == rangeEnd && CopiesRecord(interfaceMap, packets[end])) {
+                rangeEnd += packets[end].recordLength;
+                end++;
+            }
+        }
+
+        if (end - first > 1) {
+            pcapWriter->WriteRecords(packets[first].record, rangeEnd - packets[first].record);
+        }
+        else {
+            WritePacket(pcapWriter, pcapReader, interfaceMap, packets[first]);
+        }
+        first = end;
+    }
+}
+
+// The output has the format of the input, PCAP-NG stays PCAP-NG to keep all of
+// its interfaces. Records are copied unchanged where the input allows it.
+static void WriteFileHeader(PcapWriter* pcapWriter, PcapReader* pcapReader)
+{
+    pcapWriter->SetSwapByteOrder(pcapReader->IsSwapedbyteOrder());
+    pcapWriter->SetNanosecondResolution(pcapReader->IsNanosecondResolution());
+    pcapWriter->SetPcapng(pcapReader->IsPcapng());
+    pcapWriter->SetCopyRecords(pcapReader->CanCopyRecords());
+
+    if (pcapReader->IsPcapng() && pcapReader->CanCopyRecords()) {
+        pcapWriter->WritePreamble(pcapReader->GetPreamble(), pcapReader->PreambleInterfaces());
+    }
+    else {
+        pcapWriter->WritePcapHeader(pcapReader->GetPcapHeader());
+    }
+}
+
+// Appends up to maxPackets packets read as one batch. Packets of a mapped input are used
+// in place, streamed records are copied into the arena before the read buffer is reused.
+static int ReadHeldPackets(PcapReader* pcapReader, PacketArena& packetArena, PacketBatch& readBatch, size_t maxPackets, vector<PcapPacketHdrData>& packets)
+{
+    PcapPacketHdrData packet;
+    bool stableViews = pcapReader->HasStableViews();
+
+    int result = pcapReader->ReadPackets(readBatch, maxPackets);
+    for (size_t i = 0; i < readBatch.headers.size(); i++) {
+        packet.hdr = readBatch.headers[i];
+        packet.interfaceId = readBatch.interfaceIds[i];
+        packet.recordLength = readBatch.recordLengths[i];
+        if (stableViews) {
+            packet.record = readBatch.records[i];
+            packet.data = readBatch.data[i];
+            packet.chunk = PacketArena::NoChunk;
+        }
+        else if (readBatch.records[i] != nullptr && packet.recordLength <= packetArena.ChunkSize()) {
+            uint8_t* record = packetArena.Allocate(packet.recordLength, &packet.chunk);
+            memcpy(record, readBatch.records[i], packet.recordLength);
+            packet.record = record;
+            packet.data = record + (readBatch.data[i] - readBatch.records[i]);
+        }
+        else {
+            // Cut off record or one with huge options, only the payload is held and written anew
+            uint8_t* data = packetArena.Allocate(packet.hdr.packetLength, &packet.chunk);
+            memcpy(data, readBatch.data[i], packet.hdr.packetLength);
+            packet.record = nullptr;
+            packet.recordLength = packet.hdr.packetLength;
+            packet.data = data;
+        }
+        packets.push_back(packet);
+    }
+
+    return result;
+}
+
+// Packets older than one written before them are out of order in the output
+static void LogLatePackets(uint64_t latePackets)
+{
+    if (latePackets > 0) {
+        Logger::GetLogger().Log(LL_WARNING, (to_string(latePackets) + string(" packets could not be placed in order. Use a larger or the adaptive sort window, the dry run tells the size.")).c_str());
+    }
+    else {
+        Logger::GetLogger().Log(LL_INFO, "All packets were placed in order");
+    }
+}
+
+/**
+ * The window sort runs in three stages on their own threads, connected by SPSC
+ * rings which pass batches of packet handles. A fixed set of batches circulates
+ * reader -> sorter -> writer -> reader, which bounds the packets in flight and
+ * lets the reader release the arena slots of written packets, so the arena is
+ * only ever touched by the reader thread.
+ */
+struct PipelineBatch {
+    vector<PcapPacketHdrData> packets;
+    bool endOfStream;   // Set by the reader after the last packet, by the sorter on the last batch
+};
+
+struct WindowPipeline {
+    PcapReader*             pcapReader;
+    PcapWriter*             pcapWriter;
+    PacketArena             packetArena;
+    SortWindow              sortWindow;
+    vector<PipelineBatch>   batches;
+    SpscRing<PipelineBatch*> readBatches;      // Reader -> sorter
+    SpscRing<PipelineBatch*> sortedBatches;    // Sorter -> writer
+    SpscRing<PipelineBatch*> writtenBatches;   // Writer -> reader
+    InterfaceMapType        interfaceMap;       // Used by the writer only
+    uint64_t                packetCount;
+    size_t                  peakBytesHeld;
+
+    // Used by the sorter only
+    bool                    adaptive;           // The window size follows the disorder of the input
+    size_t                  windowSize;
+    size_t                  maxWindowSize;
+    size_t                  windowBytesCap;     // Packet bytes which the adaptive window may hold
+    uint64_t                latePackets;        // Older than a packet which left the window before them
+
+    WindowPipeline(PcapReader* pcapReader, PcapWriter* pcapWriter) :
+        batches(PipelineBatches), readBatches(PipelineBatches), sortedBatches(PipelineBatches), writtenBatches(PipelineBatches) {
+        this->pcapReader = pcapReader;
+        this->pcapWriter = pcapWriter;
+        packetCount = 0;
+        peakBytesHeld = 0;
+        adaptive = false;
+        windowSize = 1;
+        maxWindowSize = 1;
+        windowBytesCap = SIZE_MAX;
+        latePackets = 0;
+    }
+};
+
+static void ReadStage(WindowPipeline& pipeline)
+{
+    PacketBatch readBatch;
+    bool endOfFile = false;
+
+    while (true) {
+        PipelineBatch* batch = pipeline.writtenBatches.Pop();
+
+        // The packets of a returned batch are written, their slots can be reused
+        for (PcapPacketHdrData& packet : batch->packets) {
+            pipeline.packetArena.Release(packet.chunk, packet.recordLength);
+        }
+        batch->packets.clear();
+
+        if (batch->endOfStream && endOfFile) {
+            break; // The last batch made it through the writer
+        }
+
+        while (!endOfFile && batch->packets.size() < PipelineBatchSize) {
+            if (ReadHeldPackets(pipeline.pcapReader, pipeline.packetArena, readBatch, PipelineBatchSize - batch->packets.size(), batch->packets) <= 0) {
+                endOfFile = true;
+            }
+        }
+        pipeline.packetCount += batch->packets.size();
+
+        if (pipeline.packetArena.BytesHeld() > pipeline.peakBytesHeld) {
+            pipeline.peakBytesHeld = pipeline.packetArena.BytesHeld();
+        }
+
+        batch->endOfStream = endOfFile;
+        pipeline.readBatches.Push(batch);
+    }
+    Logger::GetLogger().SetReference(0, nullptr);
+}
+
+static size_t HeldBytes(const PcapPacketHdrData& packet)
+{
+    return sizeof(PcapPacketHdrData) + packet.recordLength;
+}
+
+static void SortStage(WindowPipeline& pipeline)
+{
+    SortWindow& sortWindow = pipeline.sortWindow;
+    bool nanoseconds = pipeline.pcapReader->IsNanosecondResolution();
+    size_t windowBytes = 0;
+    uint64_t lastEmittedKey = 0;
+    uint64_t lastEmittedNs = 0;
+    uint64_t newestNs = 0;
+
+    // Ordered stretch of the adaptive window: largest lag of a packet behind the newest
+    // one and the shortest time between the newest and the last emitted packet
+    uint64_t stretchPackets = 0;
+    uint64_t stretchMaxLag = 0;
+    uint64_t stretchMinSpan = UINT64_MAX;
+
+    while (true) {
+        PipelineBatch* batch = pipeline.readBatches.Pop();
+        vector<PcapPacketHdrData>& packets = batch->packets;
+        size_t written = 0;
+
+        // Same order of push and pop as one packet at a time. Never more packets
+        // leave than entered, so the oldest ones can replace them in place.
+        for (size_t i = 0; i < packets.size(); i++) {
+            uint64_t ns = PacketTimeNs(packets[i].hdr, nanoseconds);
+            if (PacketSortKey(packets[i].hdr) < lastEmittedKey) {
+                pipeline.latePackets++;
+                // A grown window first has to fill up, until then the late packets of the same burst do not count
+                if (pipeline.adaptive && sortWindow.Size() + 1 >= pipeline.windowSize && windowBytes * 2 <= pipeline.windowBytesCap) {
+                    pipeline.windowSize *= 2;
+                    pipeline.maxWindowSize = max(pipeline.maxWindowSize, pipeline.windowSize);
+                    Logger::GetLogger().Log(LL_DEBUG, "A late packet grows the sort window to ", (int)pipeline.windowSize);
+                }
+                stretchPackets = 0;
+                stretchMaxLag = 0;
+                stretchMinSpan = UINT64_MAX;
+            }
+            newestNs = max(newestNs, ns);
+            stretchPackets++;
+            stretchMaxLag = max(stretchMaxLag, newestNs - ns);
+
+            windowBytes += HeldBytes(packets[i]);
+            sortWindow.Push(packets[i]);
+            if (sortWindow.Size() >= pipeline.windowSize || windowBytes > pipeline.windowBytesCap) {
+                packets[written] = sortWindow.Top();
+                sortWindow.Pop();
+                windowBytes -= HeldBytes(packets[written]);
+                lastEmittedKey = packets[written].key;
+                lastEmittedNs = PacketTimeNs(packets[written].hdr, nanoseconds);
+                stretchMinSpan = min(stretchMinSpan, newestNs - lastEmittedNs);
+                written++;
+            }
+        }
+        packets.resize(written);
+
+        if (pipeline.adaptive) {
+            // A shrunk window hands its surplus on behind the packets of the batch
+            while (sortWindow.Size() > pipeline.windowSize && packets.size() < 2 * PipelineBatchSize) {
+                packets.push_back(sortWindow.Top());
+                sortWindow.Pop();
+                windowBytes -= HeldBytes(packets.back());
+                lastEmittedKey = packets.back().key;
+                lastEmittedNs = PacketTimeNs(packets.back().hdr, nanoseconds);
+            }
+
+            if (stretchPackets >= max(MinShrinkStretch, ShrinkStretchWindows * pipeline.windowSize)) {
+                if (pipeline.windowSize > MinAdaptiveWindow && stretchMinSpan != UINT64_MAX && stretchMaxLag * 4 < stretchMinSpan) {
+                    pipeline.windowSize = max(MinAdaptiveWindow, pipeline.windowSize / 2);
+                    Logger::GetLogger().Log(LL_DEBUG, "An ordered stretch shrinks the sort window to ", (int)pipeline.windowSize);
+                }
+                stretchPackets = 0;
+                stretchMaxLag = 0;
+                stretchMinSpan = UINT64_MAX;
+            }
+        }
+
+        if (batch->endOfStream) {
+            // Drain the window, the reader keeps sending empty batches until it is empty
+            while (!sortWindow.Empty() && packets.size() < PipelineBatchSize) {
+                packets.push_back(sortWindow.Top());
+                sortWindow.Pop();
+            }
+            batch->endOfStream = sortWindow.Empty();
+            pipeline.sortedBatches.Push(batch);
+            if (batch->endOfStream) {
+                break;
+            }
+        }
+        else {
+            pipeline.sortedBatches.Push(batch);
+        }
+    }
+}
+
+static void WriteStage(WindowPipeline& pipeline)
+{
+    while (true) {
+        PipelineBatch* batch = pipeline.sortedBatches.Pop();
+        bool last = batch->endOfStream;
+
+        WritePackets(pipeline.pcapWriter, pipeline.pcapReader, pipeline.interfaceMap, batch->packets);
+
+        pipeline.writtenBatches.Push(batch);
+        if (last) {
+            break;
+        }
+    }
+}
+
 void SortJob::CreateJob(string inputFile, string outputFile, size_t sortWindowSize, bool dryRun)
 {
     this->inputFile = inputFile;
     this->outputFile = outputFile;
     this->sortWindowSize = sortWindowSize;
     this->dryRun = dryRun;
+    this->sortMode = SM_WINDOW;
+    this->ramBudget = DefaultRamBudget;
+    this->threadCount = 1;
+    this->asyncQueueDepth = 0;
+    this->asyncBufferSize = DefaultAsyncBufferSize;
+    this->compression = CompressedFile::CT_NONE;
+    this->compressionLevel = 0;
+    this->rotation = RT_NONE;
+    this->rotationLimit = 0;
+    this->journal = nullptr;
+    this->waitingForMemory = false;
+    this->waitLogged = false;
 
     Logger::GetLogger().Log(LL_INFO, (string("Job created with input-file: ") + this->inputFile + string(" output-file: ") + outputFile).c_str());
 }
 
+void SortJob::CreateMergeJob(vector<string> inputFiles, string outputFile, size_t sortWindowSize, bool dryRun)
+{
+    // Without a window no packet would ever be read
+    CreateJob(inputFiles.empty() ? string() : inputFiles.front(), outputFile, max<size_t>(1, sortWindowSize), dryRun);
+    this->mergeFiles = inputFiles;
+
+    Logger::GetLogger().Log(LL_INFO, "The job merges all input files. Number of inputs: ", (int)inputFiles.size());
+}
+
+uint64_t SortJob::InputSize() const
+{
+    uint64_t size = 0;
+    for (const string& file : mergeFiles.empty() ? vector<string>(1, inputFile) : mergeFiles) {
+        error_code errorCode;
+        uint64_t fileSize = fs::file_size(file, errorCode);
+        if (!errorCode) {
+            size += fileSize;
+        }
+    }
+    return size;
+}
+
+void SortJob::SetJournal(JobJournal* journal)
+{
+    this->journal = journal;
+}
+
+void SortJob::Finish(bool succeeded)
+{
+    if (journal != nullptr) {
+        journal->Finish(inputFile, succeeded);
+    }
+}
+
+void SortJob::SetSortMode(SortModeType sortMode, size_t ramBudget)
+{
+    this->sortMode = sortMode;
+    this->ramBudget = ramBudget;
+}
+
+void SortJob::SetThreadCount(unsigned int threadCount)
+{
+    this->threadCount = (threadCount > 0) ? threadCount : 1;
+}
+
+void SortJob::SetAsyncIo(unsigned int queueDepth, size_t bufferSize)
+{
+    this->asyncQueueDepth = queueDepth;
+    this->asyncBufferSize = bufferSize;
+}
+
+void SortJob::SetCompression(CompressedFile::CompressionType compression, int level)
+{
+    this->compression = compression;
+    this->compressionLevel = level;
+}
+
+void SortJob::SetRotation(RotationType rotation, uint64_t limit)
+{
+    this->rotation = rotation;
+    this->rotationLimit = limit;
+}
+
 bool SortJob::ExecuteJob()
 {
     // Locals for the PCAP interface
     PcapReader* pcapReader;
     PcapWriter pcapWriter;
-    int32_t packetNumber;
-    PcapPacketHdrData newPacket;
+    bool result;
+
+    // Locals for statistics
+    uint64_t packetCount = 0;
+    auto startTime = chrono::steady_clock::now();
+
+    waitingForMemory = false;
+
+    // The dry run only reads the record headers and reports how much they are out of order
+    if (dryRun) {
+        return ExecuteAnalysis();
+    }
 
-    // Locals for sorter
-    std::list<PcapPacketHdrData> sortWindow;
+    if (!mergeFiles.empty()) {
+        return ExecuteMerge();
+    }
 
     Logger::GetLogger().Log(LL_INFO, "Start sorting file ", inputFile.c_str());
 
     Logger::GetLogger().Log(LL_DEBUG, "Now let's open the input file...");
     pcapReader = new PcapReader();
+    // The second pass of the index sort reads in random order, read-ahead does not help there
+    pcapReader->SetAsyncIo((sortMode == SM_INDEX) ? 0 : asyncQueueDepth, asyncBufferSize);
+    pcapWriter.SetAsyncIo(asyncQueueDepth, asyncBufferSize);
+    pcapWriter.SetCompression(compression, compressionLevel, threadCount);
+    pcapWriter.SetRotation(rotation, rotationLimit);
 
     if (pcapReader->Open(inputFile.c_str()) == 0) {
         Logger::GetLogger().Log(LL_DEBUG, "Great. Your input file is ready to use.");
@@ -76,71 +529,708 @@ bool SortJob::ExecuteJob()
         return false;
     }
 
-    if (!dryRun) {
-        Logger::GetLogger().Log(LL_DEBUG, "Now let's open the output file...");
+    if (sortMode == SM_INDEX && !pcapReader->IsSeekable()) {
+        Logger::GetLogger().Log(LL_WARNING, "The index sort needs to seek in the input. Use the exact sort instead.");
+        sortMode = SM_EXACT;
+    }
 
-        if (pcapWriter.Open(outputFile.c_str()) == 0) {
-            Logger::GetLogger().Log(LL_DEBUG, "Great. Your output file is ready to use.");
-        }
-        else {
-            Logger::GetLogger().Log(LL_ERROR, "I was not able to open the output PCAP file. Check the path and access rights.");
+    // A sorted input is copied as a whole, which would skip the compression and rotation.
+    // The other modes copy in-order records as byte ranges in their first pass already,
+    // only the runs of the exact sort would write and read the packets once more.
+    if (sortMode == SM_EXACT && pcapReader->CanCopyRecords() && pcapReader->IsSeekable() && compression == CompressedFile::CT_NONE && !pcapWriter.IsRotating()) {
+        Logger::GetLogger().Log(LL_DEBUG, "Check if the input is sorted already...");
+        if (IsAlreadySorted(pcapReader, &packetCount)) {
+            pcapReader->Close();
             delete(pcapReader);
-            return false;
+
+            error_code errorCode;
+            fs::copy_file(inputFile, outputFile, fs::copy_options::overwrite_existing, errorCode);
+            if (errorCode) {
+                Logger::GetLogger().Log(LL_ERROR, "I was not able to copy the sorted input file. Check the path and access rights.");
+                return false;
+            }
+            Logger::GetLogger().Log(LL_INFO, "Input is already sorted. Copied it as a whole: ", inputFile.c_str());
+            return true;
         }
+        packetCount = 0;
+        pcapReader->Rewind();
     }
 
-    newPacket.data = new uint8_t[pcapReader->MaxSnapLength()];
+    // Held until the job has finished, reserved before the output is created. A job which
+    // does not fit gives back its slot until another job has finished, or shrinks if it
+    // does not even fit alone.
+    uint64_t buffers = BufferMemory(1);
+    uint64_t wanted = buffers + SortMemory(pcapReader);
+    bool canShrink = (sortMode == SM_EXACT || sortMode == SM_ADAPTIVE);
+    uint64_t minimum = canShrink ? min(wanted, max(wanted / MinBudgetShare, buffers + MinRamBudget)) : wanted;
+    MemoryReservation reservation;
+    if (!reservation.TryReserve(wanted, minimum)) {
+        pcapReader->Close();
+        delete(pcapReader);
+        return WaitForMemory(wanted);
+    }
+    if (reservation.Bytes() < wanted) {
+        FitMemory(reservation.Bytes() - min(buffers, reservation.Bytes()), pcapReader);
+    }
 
-    pcapWriter.SetSwapByteOrder(pcapReader->IsSwapedbyteOrder());
-    if (!dryRun) {
-        pcapWriter.WritePcapHeader(pcapReader->GetPcapHeader()); // Copy paste the pcap header
+    Logger::GetLogger().Log(LL_DEBUG, "Now let's open the output file...");
+
+    if (pcapWriter.Open(outputFile.c_str()) == 0) {
+        Logger::GetLogger().Log(LL_DEBUG, "Great. Your output file is ready to use.");
+    }
+    else {
+        Logger::GetLogger().Log(LL_ERROR, "I was not able to open the output PCAP file. Check the path and access rights.");
+        delete(pcapReader);
+        return false;
     }
 
+    // Sorting keeps the size of the input (unknown for pipes)
+    if (pcapReader->FileSize() > 0) {
+        pcapWriter.Preallocate(pcapReader->FileSize());
+    }
+    WriteFileHeader(&pcapWriter, pcapReader);
+
     Logger::GetLogger().Log(LL_DEBUG, "Read all the packets in the given PCAP:");
     cout << flush;
 
+    switch (sortMode) {
+    case SM_EXACT:
+        result = SortExternal(pcapReader, &pcapWriter, &packetCount);
+        break;
 
-    while ((packetNumber = pcapReader->ReadPacket(&newPacket.hdr, newPacket.data)) > 0) {
+    case SM_INDEX:
+        result = SortWithIndex(pcapReader, &pcapWriter, &packetCount);
+        break;
 
-        std::list< PcapPacketHdrData>::iterator it;
-        for (it = sortWindow.begin(); it != sortWindow.end(); ++it) {
-            if ((it->hdr.timestampSeconds < newPacket.hdr.timestampSeconds) || ((it->hdr.timestampSeconds == newPacket.hdr.timestampSeconds) && (it->hdr.timestampMicroSeconds <= newPacket.hdr.timestampMicroSeconds)))
-                break;
+    default:
+        result = SortWithWindow(pcapReader, &pcapWriter, &packetCount);
+    }
+
+    Logger::GetLogger().Log(LL_DEBUG, "Everything was writen to the output file. Close files and clean up the magic stuff.");
+    // A job which failed is not recorded in the journal of the watch mode, so it is tried again
+    if (pcapWriter.Close() != 0) {
+        Logger::GetLogger().Log(LL_ERROR, "I was not able to write the output PCAP file. Check the free space.");
+        result = false;
+    }
+    pcapReader->Close();
+    delete(pcapReader);
+
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime).count();
+    Logger::GetLogger().Log(LL_INFO, (string("Sorted ") + to_string(packetCount) + string(" packets in ") + to_string(elapsed) + string(" ms")).c_str());
+    Logger::GetLogger().Log(LL_INFO, "Finished sorting file ", inputFile.c_str());
+    return result;
+}
+
+// Bytes one held packet costs: its window entry and, for streamed input, its copy in the arena
+static uint64_t PacketMemory(PcapReader* pcapReader)
+{
+    uint64_t bytes = sizeof(PcapPacketHdrData);
+    if (!pcapReader->HasStableViews()) {
+        bytes += min<uint64_t>(pcapReader->MaxSnapLength(), MaxPacketEstimate) + sizeof(PcapPacketHeaderType);
+    }
+    return bytes;
+}
+
+uint64_t SortJob::BufferMemory(unsigned int readers) const
+{
+    uint64_t bytes = (uint64_t)readers * asyncQueueDepth * asyncBufferSize;
+    bytes += (uint64_t)max(asyncQueueDepth, 1u) * asyncBufferSize;
+    if (compression != CompressedFile::CT_NONE) {
+        bytes += CompressedFile::WriteMemory(threadCount);
+    }
+    return bytes;
+}
+
+uint64_t SortJob::SortMemory(PcapReader* pcapReader) const
+{
+    switch (sortMode) {
+    case SM_EXACT:
+    case SM_ADAPTIVE:
+        return ramBudget;
+    case SM_INDEX:
+        // The entries and the buffer of their radix sort
+        return pcapReader->FileSize() / IndexRecordEstimate * sizeof(PacketIndexEntry) * 2;
+    default:
+        return (sortWindowSize + PipelineBatches * PipelineBatchSize) * PacketMemory(pcapReader);
+    }
+}
+
+bool SortJob::WaitForMemory(uint64_t wanted)
+{
+    if (!waitLogged) {
+        Logger::GetLogger().Log(LL_INFO, "Waiting for other jobs to free memory. MB needed: ", (int)(wanted / 1024 / 1024));
+        waitLogged = true;
+    }
+    waitingForMemory = true;
+    return false;
+}
+
+void SortJob::FitMemory(uint64_t bytes, PcapReader* pcapReader)
+{
+    switch (sortMode) {
+    case SM_EXACT:
+    case SM_ADAPTIVE:
+        ramBudget = max<size_t>((size_t)bytes, MinRamBudget);
+        Logger::GetLogger().Log(LL_INFO, "The RAM budget is reduced to fit the memory limit. MB: ", (int)(ramBudget / 1024 / 1024));
+        break;
+    case SM_INDEX:
+        Logger::GetLogger().Log(LL_WARNING, "The index of this input may exceed the memory limit");
+        break;
+    default: {
+        // The batches of the pipeline are held next to the window
+        size_t packets = (size_t)(bytes / PacketMemory(pcapReader));
+        sortWindowSize = max<size_t>(1, packets - min(packets, PipelineBatches * PipelineBatchSize));
+        Logger::GetLogger().Log(LL_WARNING, "The sort window is reduced to fit the memory limit. Packets further out of order are written late. Packets: ", (int)sortWindowSize);
+    }
+    }
+}
+
+/* One input of a merge job with its own small sort window */
+struct MergeInput {
+    PcapReader  pcapReader;
+    SortWindow  sortWindow;
+    PacketArena packetArena;
+    PacketBatch readBatch;
+    vector<PcapPacketHdrData> readPackets;
+    InterfaceMapType interfaceMap;
+    bool        endOfFile;
+    bool        readError;
+};
+
+static void FillMergeInput(MergeInput& input, size_t sortWindowSize, uint64_t* packetCount)
+{
+    while (!input.endOfFile && input.sortWindow.Size() < sortWindowSize) {
+        input.readPackets.clear();
+        int readResult = ReadHeldPackets(&input.pcapReader, input.packetArena, input.readBatch, sortWindowSize - input.sortWindow.Size(), input.readPackets);
+        if (readResult <= 0) {
+            input.endOfFile = true;
+            input.readError = (readResult < 0);
         }
-        sortWindow.insert(it, newPacket);
-        newPacket.data = new uint8_t[pcapReader->MaxSnapLength()];
 
-        if (sortWindow.size() >= sortWindowSize && !dryRun) {
-            PcapPacketHdrData oldestPacket = sortWindow.back();
+        for (PcapPacketHdrData& packet : input.readPackets) {
+            input.sortWindow.Push(packet);
+        }
+        (*packetCount) += input.readPackets.size();
+    }
+}
+
+bool SortJob::ExecuteMerge()
+{
+    typedef pair<uint64_t, size_t> MergeEntry; // (time in ns, input index)
+    vector<MergeInput> inputs(mergeFiles.size());
+    priority_queue<MergeEntry, vector<MergeEntry>, greater<MergeEntry>> mergeHeap;
+    PcapWriter pcapWriter;
+    PcapHeaderType pcapHeader;
+    bool nanoseconds = false;
+    bool pcapng = false;
+    bool result = true;
+    uint64_t packetCount = 0;
+    auto startTime = chrono::steady_clock::now();
+
+    Logger::GetLogger().Log(LL_INFO, "Start merging into file ", outputFile.c_str());
 
-            pcapWriter.WritePacketHeader(&oldestPacket.hdr);
-            pcapWriter.WriteData(oldestPacket.data, oldestPacket.hdr.packetLength);
-            delete[](oldestPacket.data);
-            sortWindow.pop_back();
+    for (size_t i = 0; i < inputs.size(); i++) {
+        inputs[i].pcapReader.SetAsyncIo(asyncQueueDepth, asyncBufferSize);
+        if (inputs[i].pcapReader.Open(mergeFiles[i].c_str()) != 0) {
+            Logger::GetLogger().Log(LL_ERROR, "I was not able to open the input PCAP file ", mergeFiles[i].c_str());
+            return false;
         }
+        nanoseconds = nanoseconds || inputs[i].pcapReader.IsNanosecondResolution();
+        pcapng = pcapng || inputs[i].pcapReader.IsPcapng();
+    }
+
+    // Classic PCAP has one link-type for all packets, PCAP-NG one per interface
+    for (size_t i = 0; i < inputs.size() && !pcapng; i++) {
+        if (inputs[i].pcapReader.GetPcapHeader()->network != inputs[0].pcapReader.GetPcapHeader()->network) {
+            Logger::GetLogger().Log(LL_ERROR, "The link-types of the inputs differ. Can not merge ", mergeFiles[i].c_str());
+            return false;
+        }
+    }
+
+    // The first input defines the output format, the snap length must fit all inputs
+    memcpy(&pcapHeader, inputs[0].pcapReader.GetPcapHeader(), sizeof(pcapHeader));
+    for (MergeInput& input : inputs) {
+        pcapHeader.maxSnapLength = max(pcapHeader.maxSnapLength, input.pcapReader.MaxSnapLength());
+    }
+
+    // Every input holds a window, the merge is a job of its own and only waits for other jobs
+    uint64_t buffers = BufferMemory((unsigned int)inputs.size());
+    uint64_t packetMemory = 0;
+    for (MergeInput& input : inputs) {
+        packetMemory += PacketMemory(&input.pcapReader);
+    }
+    uint64_t wanted = buffers + (sortWindowSize + ReadBatchSize) * packetMemory;
+    MemoryReservation reservation;
+    if (!reservation.TryReserve(wanted, wanted)) {
+        return WaitForMemory(wanted);
+    }
+    if (reservation.Bytes() < wanted) {
+        sortWindowSize = max<size_t>(1, (size_t)((reservation.Bytes() - min(buffers, reservation.Bytes())) / packetMemory));
+        Logger::GetLogger().Log(LL_WARNING, "The sort window is reduced to fit the memory limit. Packets further out of order are written late. Packets: ", (int)sortWindowSize);
+    }
 
+    pcapWriter.SetAsyncIo(asyncQueueDepth, asyncBufferSize);
+    pcapWriter.SetCompression(compression, compressionLevel, threadCount);
+    pcapWriter.SetRotation(rotation, rotationLimit);
+    if (pcapWriter.Open(outputFile.c_str()) != 0) {
+        Logger::GetLogger().Log(LL_ERROR, "I was not able to open the output PCAP file. Check the path and access rights.");
+        return false;
+    }
+    uint64_t outputSize = 0;
+    for (MergeInput& input : inputs) {
+        outputSize += input.pcapReader.FileSize();
+    }
+    if (outputSize > 0) {
+        pcapWriter.Preallocate(outputSize);
+    }
+    pcapWriter.SetSwapByteOrder(inputs[0].pcapReader.IsSwapedbyteOrder());
+    pcapWriter.SetNanosecondResolution(nanoseconds);
+    pcapWriter.SetPcapng(pcapng);
+    pcapWriter.WritePcapHeader(&pcapHeader);
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        inputs[i].endOfFile = false;
+        inputs[i].readError = false;
+        inputs[i].packetArena.Init(inputs[i].pcapReader.MaxSnapLength());
+        inputs[i].sortWindow.Reserve(sortWindowSize);
+        FillMergeInput(inputs[i], sortWindowSize, &packetCount);
+        if (!inputs[i].sortWindow.Empty()) {
+            mergeHeap.push(MergeEntry(PacketTimeNs(inputs[i].sortWindow.Top().hdr, inputs[i].pcapReader.IsNanosecondResolution()), i));
+        }
+    }
+
+    // Every input is window sorted on its own, the heap picks the oldest of their heads
+    uint64_t lastWrittenNs = 0;
+    uint64_t latePackets = 0;
+    while (!mergeHeap.empty()) {
+        size_t i = mergeHeap.top().second;
+        MergeInput& input = inputs[i];
+        if (mergeHeap.top().first < lastWrittenNs) {
+            latePackets++;
+        }
+        lastWrittenNs = max(lastWrittenNs, mergeHeap.top().first);
+        mergeHeap.pop();
+
+        PcapPacketHdrData oldestPacket = input.sortWindow.Top();
+        input.sortWindow.Pop();
+
+        if (nanoseconds && !input.pcapReader.IsNanosecondResolution()) {
+            oldestPacket.hdr.timestampMicroSeconds *= 1000;
+        }
+        WritePacket(&pcapWriter, &input.pcapReader, input.interfaceMap, oldestPacket);
+        input.packetArena.Release(oldestPacket.chunk, oldestPacket.recordLength);
+
+        FillMergeInput(input, sortWindowSize, &packetCount);
+        if (!input.sortWindow.Empty()) {
+            mergeHeap.push(MergeEntry(PacketTimeNs(input.sortWindow.Top().hdr, input.pcapReader.IsNanosecondResolution()), i));
+        }
     }
     Logger::GetLogger().SetReference(0, nullptr);
 
-    Logger::GetLogger().Log(LL_DEBUG, "Everything was read from the PCAP. Empty buffers and finish output file.");
-    while(!sortWindow.empty() && !dryRun) {
-        PcapPacketHdrData oldestPacket = sortWindow.back();
+    // A failed merge is not recorded in the journal of the watch mode, so it is tried again
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (!inputs[i].endOfFile || inputs[i].readError) {
+            Logger::GetLogger().Log(LL_ERROR, "I was not able to read the input PCAP file to its end ", mergeFiles[i].c_str());
+            result = false;
+        }
+    }
+    if (pcapWriter.Close() != 0) {
+        Logger::GetLogger().Log(LL_ERROR, "I was not able to write the output PCAP file. Check the free space.");
+        result = false;
+    }
+    for (MergeInput& input : inputs) {
+        input.pcapReader.Close();
+    }
+
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime).count();
+    Logger::GetLogger().Log(LL_INFO, (string("Merged ") + to_string(packetCount) + string(" packets of ") + to_string(inputs.size()) + string(" files in ") + to_string(elapsed) + string(" ms")).c_str());
+    LogLatePackets(latePackets);
+    Logger::GetLogger().Log(LL_INFO, "Finished merging into file ", outputFile.c_str());
+    return result;
+}
+
+bool SortJob::ExecuteAnalysis()
+{
+    vector<string> inputFiles = mergeFiles.empty() ? vector<string>(1, inputFile) : mergeFiles;
+    size_t sortWindowSize = 1;
+    bool result = true;
+    auto startTime = chrono::steady_clock::now();
 
-        pcapWriter.WritePacketHeader(&oldestPacket.hdr);
-        pcapWriter.WriteData(oldestPacket.data, oldestPacket.hdr.packetLength);
-        delete[](oldestPacket.data);
-        sortWindow.pop_back();
+    // The analysis holds a bounded number of sort keys, reserved like the memory of a sort
+    uint64_t buffers = BufferMemory(1);
+    uint64_t wanted = buffers + CaptureAnalysis::Memory(CaptureAnalysis::DefaultTrackedPackets);
+    uint64_t minimum = buffers + CaptureAnalysis::Memory(CaptureAnalysis::MinTrackedPackets);
+    MemoryReservation reservation;
+    if (!reservation.TryReserve(wanted, minimum)) {
+        return WaitForMemory(wanted);
+    }
+    size_t trackedPackets = CaptureAnalysis::DefaultTrackedPackets;
+    if (reservation.Bytes() < wanted) {
+        trackedPackets = CaptureAnalysis::TrackedPackets(reservation.Bytes() - min(buffers, reservation.Bytes()));
+        Logger::GetLogger().Log(LL_INFO, "The analysis tracks fewer packets to fit the memory limit. Packets: ", (int)trackedPackets);
     }
 
-    Logger::GetLogger().Log(LL_DEBUG, "Everything was writen to the output file. Close files and clean up the magic stuff.");
-    if (!dryRun) {
-        pcapWriter.Close();
+    for (string& fileName : inputFiles) {
+        PcapReader pcapReader;
+        CaptureAnalysis analysis;
+        PacketBatch readBatch;
+        int readResult;
+
+        pcapReader.SetAsyncIo(asyncQueueDepth, asyncBufferSize);
+        if (pcapReader.Open(fileName.c_str()) != 0) {
+            Logger::GetLogger().Log(LL_ERROR, "I was not able to open the input PCAP file. Check the path and access rights.");
+            result = false;
+            continue;
+        }
+
+        analysis.Start(pcapReader.IsNanosecondResolution(), trackedPackets);
+        while ((readResult = pcapReader.ReadPackets(readBatch, ReadBatchSize)) > 0) {
+            analysis.Add(readBatch);
+        }
+        Logger::GetLogger().SetReference(0, nullptr);
+        if (readResult < 0) {
+            Logger::GetLogger().Log(LL_WARNING, "The analysis stopped at an unreadable record. Report what was read so far.");
+        }
+
+        sortWindowSize = max(sortWindowSize, analysis.Report(fileName.c_str(), &pcapReader));
+        pcapReader.Close();
     }
-    pcapReader->Close();
-    delete(pcapReader);
 
-    delete[](newPacket.data);
+    if (inputFiles.size() > 1) {
+        Logger::GetLogger().Log(LL_INFO, (string("Smallest SORT_WINDOW for an exact merge: ") + to_string(sortWindowSize)).c_str());
+    }
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime).count();
+    Logger::GetLogger().Log(LL_INFO, (string("Analyzed ") + to_string(inputFiles.size()) + string(" input(s) in ") + to_string(elapsed) + string(" ms")).c_str());
+    return result;
+}
 
-    Logger::GetLogger().Log(LL_INFO, "Finished sorting file ", inputFile.c_str());
+bool SortJob::IsAlreadySorted(PcapReader* pcapReader, uint64_t* packetCount)
+{
+    PacketBatch readBatch;
+    uint64_t lastKey = 0;
+    int result;
+
+    // Header-only scan which stops at the first packet out of order
+    while ((result = pcapReader->ReadPackets(readBatch, ReadBatchSize)) > 0) {
+        for (PcapPacketHeaderType& packetHeader : readBatch.headers) {
+            uint64_t key = PacketSortKey(packetHeader);
+            if (key < lastKey) {
+                Logger::GetLogger().SetReference(0, nullptr);
+                return false;
+            }
+            lastKey = key;
+        }
+        (*packetCount) += readBatch.headers.size();
+    }
+    Logger::GetLogger().SetReference(0, nullptr);
+
+    return result == 0;
+}
+
+bool SortJob::SortWithWindow(PcapReader* pcapReader, PcapWriter* pcapWriter, uint64_t* packetCount)
+{
+    WindowPipeline pipeline(pcapReader, pcapWriter);
+
+    pipeline.packetArena.Init(pcapReader->MaxSnapLength());
+    pipeline.sortWindow.Reserve(sortWindowSize);
+    pipeline.adaptive = (sortMode == SM_ADAPTIVE);
+    pipeline.windowSize = sortWindowSize;
+    pipeline.maxWindowSize = sortWindowSize;
+    if (pipeline.adaptive) {
+        pipeline.windowBytesCap = ramBudget;
+    }
+
+    // All batches start at the reader and travel reader -> sorter -> writer -> reader.
+    // The adaptive sorter may pass up to twice their size.
+    for (PipelineBatch& batch : pipeline.batches) {
+        batch.packets.reserve(pipeline.adaptive ? 2 * PipelineBatchSize : PipelineBatchSize);
+        pipeline.writtenBatches.Push(&batch);
+    }
+
+    thread readStage(ReadStage, ref(pipeline));
+    thread writeStage(WriteStage, ref(pipeline));
+    SortStage(pipeline);
+    readStage.join();
+    writeStage.join();
+
+    *packetCount = pipeline.packetCount;
+    if (pipeline.adaptive) {
+        Logger::GetLogger().Log(LL_INFO, (string("The adaptive sort window ended at ") + to_string(pipeline.windowSize) + string(" packets, it held up to ") + to_string(pipeline.maxWindowSize)).c_str());
+    }
+    LogLatePackets(pipeline.latePackets);
+    Logger::GetLogger().Log(LL_DEBUG, (string("Sort window held up to ") + to_string(pipeline.peakBytesHeld / 1024) + string(" KiB in ") + to_string(pipeline.packetArena.BytesReserved() / 1024) + string(" KiB of arena")).c_str());
     return true;
 }
+
+/**
+ * Run files of the external sort. A name is added before its file is created and
+ * every file is removed when the sort ends, on any path. Files which were merged
+ * already are gone, removing them again does no harm.
+ */
+struct TemporaryFiles {
+    vector<string> files;
+
+    ~TemporaryFiles() {
+        for (string& file : files) {
+            error_code errorCode;
+            fs::remove(file, errorCode);
+        }
+    }
+
+    const string& Add(const string& file) {
+        files.push_back(file);
+        return files.back();
+    }
+};
+
+bool SortJob::SortExternal(PcapReader* pcapReader, PcapWriter* pcapWriter, uint64_t* packetCount)
+{
+    PacketBatch readBatch;
+    PacketArena packetArena;
+    vector<PcapPacketHdrData> run;
+    vector<string> runFiles;
+    TemporaryFiles temporaryFiles;
+    InterfaceMapType interfaceMap;
+    uint64_t runBytes = 0;
+    bool endOfFile = false;
+    bool result = true;
+
+    packetArena.Init(pcapReader->MaxSnapLength());
+
+    while (!endOfFile) {
+
+        // Fill one run until the RAM budget is used up
+        // Payloads count against the budget whether copied or mapped, mapped pages are resident as well
+        while (runBytes + run.size() * sizeof(PcapPacketHdrData) < ramBudget) {
+            size_t first = run.size();
+            if (ReadHeldPackets(pcapReader, packetArena, readBatch, ReadBatchSize, run) <= 0) {
+                endOfFile = true;
+            }
+
+            for (size_t i = first; i < run.size(); i++) {
+                runBytes += run[i].recordLength;
+                run[i].key = PacketSortKey(run[i].hdr);
+            }
+            (*packetCount) += run.size() - first;
+
+            if (endOfFile) {
+                break;
+            }
+        }
+        Logger::GetLogger().SetReference(0, nullptr);
+
+        stable_sort(run.begin(), run.end(), [](const PcapPacketHdrData& a, const PcapPacketHdrData& b) {
+            return a.key < b.key;
+        });
+
+        if (endOfFile && runFiles.empty()) {
+            // Everything fit into memory, no need for temporary files
+            for (PcapPacketHdrData& packet : run) {
+                WritePacket(pcapWriter, pcapReader, interfaceMap, packet);
+            }
+        }
+        else if (!run.empty() && pcapWriter != nullptr) {
+            string runFile = temporaryFiles.Add(outputFile + string(".run") + to_string(runFiles.size()) + string(".tmp"));
+            PcapWriter runWriter;
+            InterfaceMapType runInterfaceMap;
+
+            Logger::GetLogger().Log(LL_INFO, "Spill sorted run to ", runFile.c_str());
+            runWriter.SetAsyncIo(asyncQueueDepth, asyncBufferSize);
+            if (runWriter.Open(runFile.c_str()) != 0) {
+                Logger::GetLogger().Log(LL_ERROR, "I was not able to open the temporary run file. Check the free space and access rights.");
+                result = false;
+                break;
+            }
+            runWriter.Preallocate(runBytes);
+            WriteFileHeader(&runWriter, pcapReader);
+            for (PcapPacketHdrData& packet : run) {
+                WritePacket(&runWriter, pcapReader, runInterfaceMap, packet);
+            }
+            if (runWriter.Close() != 0) {
+                Logger::GetLogger().Log(LL_ERROR, "I was not able to write the temporary run file. Check the free space.");
+                result = false;
+                break;
+            }
+            runFiles.push_back(runFile);
+        }
+
+        run.clear();
+        runBytes = 0;
+        packetArena.Init(pcapReader->MaxSnapLength());
+    }
+
+    if (result && !runFiles.empty()) {
+        Logger::GetLogger().Log(LL_INFO, "Merge sorted runs: ", (int)runFiles.size());
+        result = MergeRuns(runFiles, temporaryFiles, pcapReader, pcapWriter);
+    }
+
+    return result;
+}
+
+bool SortJob::SortWithIndex(PcapReader* pcapReader, PcapWriter* pcapWriter, uint64_t* packetCount)
+{
+    PacketIndex packetIndex;
+    PcapPacketHdrData packet;
+    InterfaceMapType interfaceMap;
+    bool result = true;
+
+    Logger::GetLogger().Log(LL_DEBUG, "First pass: index all record headers");
+    if (packetIndex.Build(pcapReader, inputFile.c_str(), threadCount) < 0) {
+        Logger::GetLogger().Log(LL_WARNING, "Indexing stopped at an unreadable record. Sort what was read so far.");
+    }
+
+    // Records which already are in place are copied as whole byte ranges, unless they are split into segments
+    vector<PacketRunType> runs;
+    if (pcapReader->CanCopyRecordRanges() && (pcapWriter == nullptr || !pcapWriter->IsRotating())) {
+        size_t packetsInRuns = packetIndex.FindInOrderRuns(runs, MinCopyRunLength);
+        Logger::GetLogger().Log(LL_INFO, (to_string(packetsInRuns) + string(" of ") + to_string(packetIndex.Size()) + string(" packets are in in-order runs")).c_str());
+    }
+
+    packetIndex.Sort(threadCount);
+    *packetCount = packetIndex.Size();
+
+    if (pcapWriter == nullptr) {
+        return true;
+    }
+
+    Logger::GetLogger().Log(LL_DEBUG, "Second pass: copy the payloads in index order");
+
+    vector<PacketIndexEntry>& entries = packetIndex.Entries();
+    size_t nextRun = 0;
+    size_t position = 0;
+    while (position < entries.size()) {
+        if (nextRun < runs.size() && runs[nextRun].first == position) {
+            if (pcapWriter->CopyRange(inputFile.c_str(), runs[nextRun].offset, runs[nextRun].length) != 0) {
+                result = false;
+                break;
+            }
+            position += runs[nextRun].count;
+            nextRun++;
+            continue;
+        }
+
+        if (pcapReader->SeekRecord(entries[position].offset) != 0 || pcapReader->ReadPacketView(&packet.hdr, &packet.data) <= 0) {
+            Logger::GetLogger().Log(LL_ERROR, "Can not read an indexed packet again");
+            result = false;
+            break;
+        }
+        packet.interfaceId = pcapReader->InterfaceId();
+        packet.record = pcapReader->RecordView();
+        packet.recordLength = pcapReader->RecordViewLength();
+        WritePacket(pcapWriter, pcapReader, interfaceMap, packet);
+        position++;
+    }
+    Logger::GetLogger().SetReference(0, nullptr);
+
+    return result;
+}
+
+bool SortJob::MergeRuns(vector<string>& runFiles, TemporaryFiles& temporaryFiles, PcapReader* pcapReader, PcapWriter* pcapWriter)
+{
+    // Cascade the merge if there are more runs than file handles we like to use.
+    // Neighboured runs are combined, so packets with equal timestamps keep their order.
+    while (runFiles.size() > MaxMergeFanIn) {
+        size_t groupCount = (runFiles.size() + MaxMergeFanIn - 1) / MaxMergeFanIn;
+        vector<string> mergedFiles(groupCount);
+        vector<char> merged(groupCount, false);
+        TaskGroup merges;
+
+        // The groups of one level are independent, they are merged by the workers of the pool
+        for (size_t i = 0; i < groupCount; i++) {
+            size_t first = i * MaxMergeFanIn;
+            size_t last = min(first + MaxMergeFanIn, runFiles.size());
+            mergedFiles[i] = temporaryFiles.Add(outputFile + string(".run") + to_string(runFiles.size() + first) + string(".merged.tmp"));
+            merges.Run([&, i, first, last]() {
+                vector<string> group(runFiles.begin() + first, runFiles.begin() + last);
+                merged[i] = MergeToRunFile(group, mergedFiles[i], pcapReader);
+            });
+        }
+        merges.Wait();
+
+        runFiles = mergedFiles;
+        if (find(merged.begin(), merged.end(), false) != merged.end()) {
+            return false;
+        }
+    }
+
+    return MergeRunGroup(runFiles, pcapWriter);
+}
+
+bool SortJob::MergeToRunFile(vector<string>& group, const string& mergedFile, PcapReader* pcapReader)
+{
+    PcapWriter mergedWriter;
+    bool merged = false;
+
+    mergedWriter.SetAsyncIo(asyncQueueDepth, asyncBufferSize);
+    if (mergedWriter.Open(mergedFile.c_str()) != 0) {
+        Logger::GetLogger().Log(LL_ERROR, "I was not able to open the temporary run file. Check the free space and access rights.");
+    }
+    else {
+        uint64_t mergedSize = 0;
+        for (string& runFile : group) {
+            error_code errorCode;
+            uint64_t runSize = fs::file_size(runFile, errorCode);
+            if (!errorCode) {
+                mergedSize += runSize;
+            }
+        }
+        mergedWriter.Preallocate(mergedSize);
+        WriteFileHeader(&mergedWriter, pcapReader);
+        merged = MergeRunGroup(group, &mergedWriter);
+        if (mergedWriter.Close() != 0) {
+            merged = false;
+        }
+    }
+
+    // The merged runs are not needed by the next level, free their space right away
+    for (string& runFile : group) {
+        error_code errorCode;
+        fs::remove(runFile, errorCode);
+    }
+    return merged;
+}
+
+bool SortJob::MergeRunGroup(vector<string>& runFiles, PcapWriter* pcapWriter)
+{
+    typedef pair<uint64_t, size_t> MergeEntry; // (key, run index)
+    vector<PcapReader> runReaders(runFiles.size());
+    vector<PcapPacketHdrData> heads(runFiles.size());
+    InterfaceMapType interfaceMap;      // All runs have the interface ids of the input
+    priority_queue<MergeEntry, vector<MergeEntry>, greater<MergeEntry>> mergeHeap;
+    bool result = true;
+
+    for (size_t i = 0; i < runFiles.size(); i++) {
+        runReaders[i].SetAsyncIo(asyncQueueDepth, asyncBufferSize);
+        runReaders[i].SetLogProgress(false);
+        if (runReaders[i].Open(runFiles[i].c_str()) != 0) {
+            Logger::GetLogger().Log(LL_ERROR, "I was not able to open the temporary run file ", runFiles[i].c_str());
+            result = false;
+            break;
+        }
+        if (runReaders[i].ReadPacketView(&heads[i].hdr, &heads[i].data) > 0) {
+            heads[i].interfaceId = runReaders[i].InterfaceId();
+            heads[i].record = runReaders[i].RecordView();
+            heads[i].recordLength = runReaders[i].RecordViewLength();
+            mergeHeap.push(MergeEntry(PacketSortKey(heads[i].hdr), i));
+        }
+    }
+
+    while (result && !mergeHeap.empty()) {
+        size_t i = mergeHeap.top().second;
+        mergeHeap.pop();
+
+        WritePacket(pcapWriter, &runReaders[i], interfaceMap, heads[i]);
+        if (runReaders[i].ReadPacketView(&heads[i].hdr, &heads[i].data) > 0) {
+            heads[i].interfaceId = runReaders[i].InterfaceId();
+            heads[i].record = runReaders[i].RecordView();
+            heads[i].recordLength = runReaders[i].RecordViewLength();
+            mergeHeap.push(MergeEntry(PacketSortKey(heads[i].hdr), i));
+        }
+    }
+    Logger::GetLogger().SetReference(0, nullptr);
+
+    for (size_t i = 0; i < runFiles.size(); i++) {
+        runReaders[i].Close();
+    }
+    return result;
+}
@@ -16,22 +16,92 @@
  */
 
 #pragma once
+#include "CompressedFile.h"
+#include "PcapWriter.h"
+#include <cstdint>
 #include <string>
+#include <vector>
 
 using namespace std;
 
+class PcapReader;
+class JobJournal;
+struct TemporaryFiles;
+
+enum SortModeType {
+    SM_WINDOW = 0,  // Sliding sort window of SORT_WINDOW packets
+    SM_EXACT = 1,   // External merge sort of RAM budget sized runs
+    SM_INDEX = 2,   // Sort an index of all record headers, then copy the payloads
+    SM_ADAPTIVE = 3 // Sliding window which grows on late packets and shrinks while they are in order
+};
+
 class SortJob
 {
 
 private:
     string inputFile;
     string outputFile;
+    vector<string> mergeFiles;
     bool dryRun;
     size_t sortWindowSize;
+    SortModeType sortMode;
+    size_t ramBudget;
+    unsigned int threadCount;
+    unsigned int asyncQueueDepth;
+    size_t asyncBufferSize;
+    CompressedFile::CompressionType compression;
+    int compressionLevel;
+    RotationType rotation;
+    uint64_t rotationLimit;
+    JobJournal* journal;
+    bool waitingForMemory;  // The last ExecuteJob could not reserve its memory
+    bool waitLogged;
+
+    bool IsAlreadySorted(PcapReader* pcapReader, uint64_t* packetCount);
+    bool ExecuteMerge();
+    bool ExecuteAnalysis();
+    bool SortWithWindow(PcapReader* pcapReader, PcapWriter* pcapWriter, uint64_t* packetCount);
+    bool SortExternal(PcapReader* pcapReader, PcapWriter* pcapWriter, uint64_t* packetCount);
+    bool SortWithIndex(PcapReader* pcapReader, PcapWriter* pcapWriter, uint64_t* packetCount);
+    bool MergeRuns(vector<string>& runFiles, TemporaryFiles& temporaryFiles, PcapReader* pcapReader, PcapWriter* pcapWriter);
+    bool MergeRunGroup(vector<string>& runFiles, PcapWriter* pcapWriter);
+    bool MergeToRunFile(vector<string>& group, const string& mergedFile, PcapReader* pcapReader);
+    // Estimated memory of the I/O buffers and of the sort, see MemoryBudget
+    uint64_t BufferMemory(unsigned int readers) const;
+    uint64_t SortMemory(PcapReader* pcapReader) const;
+    // Shrinks the sort to the reserved bytes
+    void FitMemory(uint64_t bytes, PcapReader* pcapReader);
+    // Marks the job to be retried once another job released memory, returns false
+    bool WaitForMemory(uint64_t wanted);
 
 public:
+    static const size_t DefaultRamBudget = 1024 * 1024 * 1024;
+    static const size_t DefaultAsyncBufferSize = 1024 * 1024;
+    static const size_t DefaultAdaptiveWindow = 1024;
+
     void CreateJob(string inputFile, string outputFile, size_t sortWindowSize, bool dryRun);
+    // Merges several inputs into one output, each input sorted by its own window
+    void CreateMergeJob(vector<string> inputFiles, string outputFile, size_t sortWindowSize, bool dryRun);
+    void SetSortMode(SortModeType sortMode, size_t ramBudget);
+    void SetThreadCount(unsigned int threadCount);
+    // io_uring queue depth (0 = off) and buffer size of all readers and writers of the job
+    void SetAsyncIo(unsigned int queueDepth, size_t bufferSize);
+    // Compresses the output on the threads of the job, temporary files stay uncompressed
+    void SetCompression(CompressedFile::CompressionType compression, int level);
+    // Splits the output into segments, see PcapWriter::SetRotation
+    void SetRotation(RotationType rotation, uint64_t limit);
+    // Bytes of all inputs as stored (compressed inputs by their compressed size)
+    uint64_t InputSize() const;
+    // Records the input in the journal of the watch mode when the job ends
+    void SetJournal(JobJournal* journal);
 
     bool ExecuteJob();
+    // True if ExecuteJob gave up before it opened the output because the other jobs hold
+    // too much memory. The job is executed again after one of them has finished.
+    bool IsWaitingForMemory() const {
+        return waitingForMemory;
+    }
+    // Called once the job has ended
+    void Finish(bool succeeded);
 };
 
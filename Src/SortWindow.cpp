@@ -0,0 +1,106 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "SortWindow.h"
+
+static const size_t HeapArity = 4;
+
+SortWindow::SortWindow(void)
+{
+    sequence = 0;
+}
+
+SortWindow::~SortWindow(void)
+{
+}
+
+void SortWindow::Reserve(size_t windowSize)
+{
+    heap.reserve(windowSize + 1);
+}
+
+void SortWindow::Push(const PcapPacketHdrData& packet)
+{
+    uint64_t key = PacketSortKey(packet.hdr);
+
+    if (ordered.empty() || key >= ordered.back().key) {
+        ordered.push_back(packet);
+        ordered.back().key = key;
+        ordered.back().sequence = sequence++;
+        return;
+    }
+
+    heap.push_back(packet);
+    heap.back().key = key;
+    heap.back().sequence = sequence++;
+    SiftUp(heap.size() - 1);
+}
+
+void SortWindow::Pop()
+{
+    if (OrderedFirst()) {
+        ordered.pop_front();
+    }
+    else if (heap.size() > 1) {
+        heap.front() = heap.back();
+        heap.pop_back();
+        SiftDown(0);
+    }
+    else {
+        heap.clear();
+    }
+}
+
+void SortWindow::SiftUp(size_t pos)
+{
+    PcapPacketHdrData packet = heap[pos];
+
+    while (pos > 0) {
+        size_t parent = (pos - 1) / HeapArity;
+        if (!Less(packet, heap[parent]))
+            break;
+        heap[pos] = heap[parent];
+        pos = parent;
+    }
+    heap[pos] = packet;
+}
+
+void SortWindow::SiftDown(size_t pos)
+{
+    PcapPacketHdrData packet = heap[pos];
+    size_t size = heap.size();
+
+    while (true) {
+        size_t first = pos * HeapArity + 1;
+        if (first >= size)
+            break;
+
+        // Find the smallest child
+        size_t last = (first + HeapArity < size) ? first + HeapArity : size;
+        size_t smallest = first;
+        for (size_t child = first + 1; child < last; child++) {
+            if (Less(heap[child], heap[smallest]))
+                smallest = child;
+        }
+
+        if (!Less(heap[smallest], packet))
+            break;
+        heap[pos] = heap[smallest];
+        pos = smallest;
+    }
+    heap[pos] = packet;
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "PcapPacket.h"
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Reorder buffer of the sorter. A 4-ary min-heap ordered by (key, sequence),
+ * so Push and Pop cost O(log W) independent of how far a packet is displaced.
+ * Packets with equal timestamps leave the window in the order they were pushed.
+ * Packets which arrive in order bypass the heap in a FIFO, so an ordered input
+ * costs O(1) per packet and the heap only holds the packets out of order.
+ */
+class SortWindow
+{
+private:
+    vector<PcapPacketHdrData> heap;
+    deque<PcapPacketHdrData> ordered;   // Not older than the packet in front of them
+    uint64_t sequence;
+
+    static bool Less(const PcapPacketHdrData& a, const PcapPacketHdrData& b) {
+        return (a.key < b.key) || ((a.key == b.key) && (a.sequence < b.sequence));
+    }
+
+    void SiftUp(size_t pos);
+    void SiftDown(size_t pos);
+
+    // The oldest packet is the front of the FIFO
+    bool OrderedFirst() const {
+        return heap.empty() || (!ordered.empty() && Less(ordered.front(), heap.front()));
+    }
+
+public:
+    SortWindow(void);
+    virtual ~SortWindow(void);
+
+    void Reserve(size_t windowSize);
+
+    void Push(const PcapPacketHdrData& packet);
+    void Pop();
+
+    const PcapPacketHdrData& Top() const {
+        return OrderedFirst() ? ordered.front() : heap.front();
+    }
+
+    size_t Size() const {
+        return heap.size() + ordered.size();
+    }
+
+    bool Empty() const {
+        return heap.empty() && ordered.empty();
+    }
+};
@@ -0,0 +1,121 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "WaitEvent.h"
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Bounded lock-free ring for exactly one producer and one consumer thread.
+ * Push and Pop block while the ring is full or empty, the other side wakes them.
+ */
+template <typename T>
+class SpscRing
+{
+private:
+    vector<T>       slots;
+    size_t          mask;
+
+    // Separate cache lines, the producer only writes tail and the consumer only head
+    alignas(64) atomic<size_t> head;
+    alignas(64) atomic<size_t> tail;
+    WaitEvent       changed;
+
+    bool Insert(const T& value) {
+        size_t position = tail.load(memory_order_relaxed);
+        if (position - head.load(memory_order_acquire) == slots.size())
+            return false;
+        slots[position & mask] = value;
+        tail.store(position + 1, memory_order_release);
+        return true;
+    }
+
+    bool Remove(T& value) {
+        size_t position = head.load(memory_order_relaxed);
+        if (position == tail.load(memory_order_acquire))
+            return false;
+        value = slots[position & mask];
+        head.store(position + 1, memory_order_release);
+        return true;
+    }
+
+public:
+    SpscRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots.resize(size);
+        mask = size - 1;
+        head.store(0);
+        tail.store(0);
+    }
+
+    bool TryPush(const T& value) {
+        if (!Insert(value))
+            return false;
+        changed.Notify();
+        return true;
+    }
+
+    bool TryPop(T& value) {
+        if (!Remove(value))
+            return false;
+        changed.Notify();
+        return true;
+    }
+
+    void Push(const T& value) {
+        changed.Wait([&]() { return Insert(value); });
+        changed.Notify();
+    }
+
+    T Pop() {
+        T value;
+        changed.Wait([&]() { return Remove(value); });
+        changed.Notify();
+        return value;
+    }
+
+    // Like Push and Pop, but give up and return false once stopping is set, see Wake
+    bool Push(const T& value, const atomic<bool>& stopping) {
+        bool pushed = false;
+        changed.Wait([&]() { pushed = Insert(value); return pushed || stopping.load(); });
+        if (pushed) {
+            changed.Notify();
+        }
+        return pushed;
+    }
+
+    bool Pop(T& value, const atomic<bool>& stopping) {
+        bool popped = false;
+        changed.Wait([&]() { popped = Remove(value); return popped || stopping.load(); });
+        if (popped) {
+            changed.Notify();
+        }
+        return popped;
+    }
+
+    // Lets the waiting threads check their stopping flag
+    void Wake() {
+        changed.Notify();
+    }
+};
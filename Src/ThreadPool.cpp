@@ -0,0 +1,234 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "ThreadPool.h"
+#include "Logger.h"
+#include <chrono>
+
+// Tasks beyond these wait in the ring of injected tasks
+static const size_t WorkerDequeSize = 4096;
+static const size_t InjectedTaskRingSize = 4096;
+static const chrono::milliseconds IdleTimeout(10);
+
+static ThreadPool singleton;
+
+// Worker of the calling thread, nullptr outside of the pool
+static thread_local ThreadPool* currentPool = nullptr;
+static thread_local unsigned int currentWorker = 0;
+
+ThreadPool::WorkerType::WorkerType()
+    : tasks(WorkerDequeSize)
+{
+}
+
+ThreadPool::ThreadPool()
+    : injectedTasks(InjectedTaskRingSize)
+{
+    jobSlots = 0;
+    runningJobs.store(0);
+    stopping.store(false);
+    sleepers.store(0);
+    submittedTasks.store(0);
+}
+
+ThreadPool::~ThreadPool()
+{
+    Stop();
+}
+
+ThreadPool& ThreadPool::GetThreadPool()
+{
+    return singleton;
+}
+
+void ThreadPool::Start(unsigned int workerCount, unsigned int jobSlots, JobSourceType jobSource)
+{
+    if (workerCount == 0) {
+        workerCount = thread::hardware_concurrency();
+    }
+    // Every job holds a worker, at least one more is left for their tasks
+    workerCount = max(workerCount, jobSlots + 1);
+
+    this->jobSlots = jobSlots;
+    this->jobSource = jobSource;
+    stopping.store(false);
+
+    for (unsigned int i = 0; i < workerCount; i++) {
+        workers.emplace_back(new WorkerType());
+    }
+    // All deques exist before the first worker may steal from them
+    for (unsigned int i = 0; i < workerCount; i++) {
+        workers[i]->worker = thread(&ThreadPool::WorkerLoop, this, i);
+    }
+    Logger::GetLogger().Log(LL_DEBUG, "Worker threads started: ", (int)workerCount);
+}
+
+void ThreadPool::Stop()
+{
+    if (workers.empty()) {
+        return;
+    }
+
+    stopping.store(true);
+    idle.notify_all();
+    for (unique_ptr<WorkerType>& worker : workers) {
+        worker->worker.join();
+    }
+    workers.clear();
+    jobSource = nullptr;
+}
+
+void ThreadPool::Submit(TaskType task)
+{
+    if (workers.empty()) {
+        task();
+        return;
+    }
+
+    TaskType* pending = new TaskType(move(task));
+    if ((currentPool != this || !workers[currentWorker]->tasks.Push(pending)) && !injectedTasks.TryPush(pending)) {
+        // Everything is full, the caller does the work itself
+        (*pending)();
+        delete pending;
+        return;
+    }
+    submittedTasks.fetch_add(1);
+    tasksChanged.Notify();
+    Wake();
+}
+
+void ThreadPool::NotifyJobs()
+{
+    Wake();
+}
+
+void ThreadPool::TaskFinished()
+{
+    tasksChanged.Notify();
+}
+
+void ThreadPool::Wake()
+{
+    if (sleepers.load() > 0) {
+        idle.notify_one();
+    }
+}
+
+ThreadPool::TaskType* ThreadPool::NextTask()
+{
+    TaskType* task = nullptr;
+
+    if (currentPool == this && (task = workers[currentWorker]->tasks.Pop()) != nullptr) {
+        return task;
+    }
+    if (injectedTasks.TryPop(task)) {
+        return task;
+    }
+
+    // Steal the oldest task of another worker, the largest one of a split usually
+    size_t start = (currentPool == this) ? currentWorker + 1 : 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+        WorkerType& victim = *workers[(start + i) % workers.size()];
+        if ((task = victim.tasks.Steal()) != nullptr) {
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+bool ThreadPool::RunPendingTask()
+{
+    TaskType* task = NextTask();
+    if (task == nullptr) {
+        return false;
+    }
+
+    (*task)();
+    delete task;
+    return true;
+}
+
+bool ThreadPool::RunNextJob()
+{
+    unsigned int running = runningJobs.load();
+    do {
+        if (running >= jobSlots || !jobSource) {
+            return false;
+        }
+    } while (!runningJobs.compare_exchange_weak(running, running + 1));
+
+    bool executed = jobSource();
+    runningJobs.fetch_sub(1);
+    return executed;
+}
+
+void ThreadPool::WorkerLoop(unsigned int index)
+{
+    currentPool = this;
+    currentWorker = index;
+
+    while (true) {
+        // Tasks first, they belong to jobs which are running already
+        if (RunPendingTask() || RunNextJob()) {
+            continue;
+        }
+        if (stopping.load()) {
+            break;
+        }
+
+        unique_lock<mutex> lock(idleMutex);
+        sleepers.fetch_add(1);
+        idle.wait_for(lock, IdleTimeout);
+        sleepers.fetch_sub(1);
+    }
+
+    currentPool = nullptr;
+}
+
+TaskGroup::TaskGroup()
+{
+    pending.store(0);
+}
+
+TaskGroup::~TaskGroup()
+{
+    Wait();
+}
+
+void TaskGroup::Run(ThreadPool::TaskType task)
+{
+    pending.fetch_add(1);
+    ThreadPool::GetThreadPool().Submit([this, task]() {
+        task();
+        pending.fetch_sub(1);   // The group may be gone right after this, the pool is not
+        ThreadPool::GetThreadPool().TaskFinished();
+    });
+}
+
+void TaskGroup::Wait()
+{
+    ThreadPool& pool = ThreadPool::GetThreadPool();
+    while (pending.load() > 0) {
+        uint64_t submitted = pool.SubmittedTasks();
+        if (!pool.RunPendingTask()) {
+            // The tasks of the group run on other workers, sleep until they are done or
+            // until a new task was submitted which this thread can take meanwhile
+            pool.WaitForTasks([&]() { return pending.load() == 0 || pool.SubmittedTasks() != submitted; });
+        }
+    }
+}
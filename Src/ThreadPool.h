@@ -0,0 +1,131 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "MpmcRing.h"
+#include "WaitEvent.h"
+#include "WorkStealingDeque.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * One pool of worker threads for the whole process, sized by the hardware threads.
+ *
+ * Jobs (whole conversions) and the tasks within a job (index ranges, sort slices,
+ * merges, compressed frames) share the workers. A task submitted by a worker goes
+ * to the deque of that worker, idle workers steal from the others. Tasks of other
+ * threads go through a lock-free ring. At most jobSlots jobs run at the same time,
+ * so the remaining workers are left for their tasks.
+ */
+class ThreadPool
+{
+public:
+    typedef function<void()> TaskType;
+    // Runs the next job, false if there is none
+    typedef function<bool()> JobSourceType;
+
+private:
+    struct WorkerType {
+        WorkStealingDeque<TaskType> tasks;
+        thread                      worker;
+
+        WorkerType();
+    };
+
+    vector<unique_ptr<WorkerType>> workers;
+    MpmcRing<TaskType*>     injectedTasks;  // Tasks of threads outside the pool
+    JobSourceType           jobSource;
+    unsigned int            jobSlots;
+    atomic<unsigned int>    runningJobs;
+    atomic<bool>            stopping;
+
+    // Idle workers sleep here, with a timeout so a missed wake-up only costs a moment
+    mutex                   idleMutex;
+    condition_variable      idle;
+    atomic<unsigned int>    sleepers;
+
+    // Threads in TaskGroup::Wait sleep here until a task was submitted or finished
+    WaitEvent               tasksChanged;
+    atomic<uint64_t>        submittedTasks;
+
+    void WorkerLoop(unsigned int index);
+    bool RunNextJob();
+    TaskType* NextTask();
+    void Wake();
+
+public:
+    ThreadPool();
+    virtual ~ThreadPool();
+
+    static ThreadPool& GetThreadPool();
+
+    // workerCount 0 uses one worker per hardware thread
+    void Start(unsigned int workerCount, unsigned int jobSlots, JobSourceType jobSource);
+    // Waits for the running jobs and tasks
+    void Stop();
+
+    unsigned int WorkerCount() const {
+        return (unsigned int)workers.size();
+    }
+
+    // Runs the task on any worker. Without workers it runs right away.
+    void Submit(TaskType task);
+    // Runs one queued task on the calling thread, false if none was found
+    bool RunPendingTask();
+    // Tells sleeping workers that jobs were added
+    void NotifyJobs();
+
+    // Changes with every queued task, e.g. to tell if there may be a task to run
+    uint64_t SubmittedTasks() const {
+        return submittedTasks.load();
+    }
+    // Returns once done() is true, done is checked again when a task was submitted or finished
+    template <typename Predicate>
+    void WaitForTasks(Predicate done) {
+        tasksChanged.Wait(done);
+    }
+    // Wakes the threads in WaitForTasks
+    void TaskFinished();
+};
+
+/**
+ * Tasks which are waited for together. Wait runs queued tasks of the pool meanwhile,
+ * so a job waiting for its tasks never blocks a worker, and sleeps while its last
+ * tasks run on other workers.
+ */
+class TaskGroup
+{
+private:
+    atomic<size_t> pending;
+
+public:
+    TaskGroup();
+    virtual ~TaskGroup();
+
+    void Run(ThreadPool::TaskType task);
+    void Wait();
+};
@@ -0,0 +1,478 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "UringFile.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef PCAPSORTER_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+// Buffers are page aligned, which the kernel copies fastest
+static const size_t BufferAlignment = 4096;
+static const unsigned int MaxQueueDepth = 4096;
+
+UringFile::UringFile(void)
+{
+    ringFd = -1;
+    fileFd = -1;
+    forWrite = false;
+    failed = false;
+    bufferSize = 0;
+    current = 0;
+    currentUsed = 0;
+    nextOffset = 0;
+    endOfFile = false;
+    sqRing = nullptr;
+    sqRingSize = 0;
+    cqRing = nullptr;
+    cqRingSize = 0;
+    sqEntries = nullptr;
+    sqEntriesSize = 0;
+}
+
+UringFile::~UringFile(void)
+{
+    Close();
+}
+
+#ifdef PCAPSORTER_IO_URING
+
+int UringFile::Setup(unsigned int queueDepth, size_t bufferSize)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    queueDepth = max(1u, min(queueDepth, MaxQueueDepth));
+    ringFd = (int)syscall(__NR_io_uring_setup, queueDepth, &params);
+    if (ringFd < 0) {
+        return -1;
+    }
+
+    // Plain read and write operations came together with this feature (Linux 5.6)
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        return -1;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sqEntriesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    sqEntries = mmap(nullptr, sqEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqEntries == MAP_FAILED) {
+        return -1;
+    }
+
+    sqTail = (unsigned*)((uint8_t*)sqRing + params.sq_off.tail);
+    sqMask = (unsigned*)((uint8_t*)sqRing + params.sq_off.ring_mask);
+    sqArray = (unsigned*)((uint8_t*)sqRing + params.sq_off.array);
+    cqHead = (unsigned*)((uint8_t*)cqRing + params.cq_off.head);
+    cqTail = (unsigned*)((uint8_t*)cqRing + params.cq_off.tail);
+    cqMask = (unsigned*)((uint8_t*)cqRing + params.cq_off.ring_mask);
+    cqEntries = (uint8_t*)cqRing + params.cq_off.cqes;
+
+    this->bufferSize = (bufferSize + BufferAlignment - 1) / BufferAlignment * BufferAlignment;
+    slots.resize(queueDepth);
+    for (Slot& slot : slots) {
+        void* buffer = nullptr;
+        if (posix_memalign(&buffer, BufferAlignment, this->bufferSize) != 0) {
+            return -1;
+        }
+        slot.buffer = (uint8_t*)buffer;
+        slot.offset = 0;
+        slot.length = 0;
+        slot.result = 0;
+        slot.busy = false;
+    }
+
+    failed = false;
+    endOfFile = false;
+    current = 0;
+    currentUsed = 0;
+    nextOffset = 0;
+    return 0;
+}
+
+bool UringFile::Submit(size_t slot, uint64_t offset, size_t length)
+{
+    unsigned tail = *sqTail;
+    unsigned index = tail & *sqMask;
+    struct io_uring_sqe* sqe = &((struct io_uring_sqe*)sqEntries)[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = forWrite ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fileFd;
+    sqe->addr = (uint64_t)(uintptr_t)slots[slot].buffer;
+    sqe->len = (uint32_t)length;
+    sqe->off = offset;
+    sqe->user_data = slot;
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    slots[slot].offset = offset;
+    slots[slot].length = length;
+    slots[slot].busy = true;
+
+    int submitted;
+    do {
+        submitted = (int)syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, nullptr, 0);
+    } while (submitted < 0 && errno == EINTR);
+
+    if (submitted != 1) {
+        Logger::GetLogger().Log(LL_ERROR, "Can not submit asynchronous I/O");
+        slots[slot].busy = false;
+        failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool UringFile::Reap(bool wait)
+{
+    if (wait) {
+        int result = (int)syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (result < 0 && errno != EINTR) {
+            failed = true;
+            return false;
+        }
+    }
+
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &((struct io_uring_cqe*)cqEntries)[head & *cqMask];
+        Slot& slot = slots[(size_t)cqe->user_data];
+        slot.result = cqe->res;
+        slot.busy = false;
+
+        if (forWrite && slot.result != (int32_t)slot.length) {
+            Logger::GetLogger().Log(LL_ERROR, "Asynchronous write failed. Check the free space.");
+            failed = true;
+        }
+        head++;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool UringFile::WaitSlot(size_t slot)
+{
+    while (slots[slot].busy) {
+        if (!Reap(true)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool UringFile::WaitAll()
+{
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (!WaitSlot(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int UringFile::OpenRead(const char* fileName, unsigned int queueDepth, size_t bufferSize)
+{
+    Close();
+
+    fileFd = open(fileName, O_RDONLY);
+    if (fileFd < 0) {
+        return -1;
+    }
+
+    forWrite = false;
+    if (Setup(queueDepth, bufferSize) != 0 || Seek(0) != 0) {
+        Close();
+        return -1;
+    }
+    return 0;
+}
+
+int UringFile::OpenWrite(const char* fileName, unsigned int queueDepth, size_t bufferSize)
+{
+    Close();
+
+    fileFd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fileFd < 0) {
+        return -1;
+    }
+
+    forWrite = true;
+    if (Setup(queueDepth, bufferSize) != 0) {
+        Close();
+        return -1;
+    }
+    return 0;
+}
+
+int UringFile::Close()
+{
+    int result = 0;
+
+    if (fileFd >= 0 && ringFd >= 0 && !slots.empty() && slots[0].buffer != nullptr) {
+        if (forWrite) {
+            result = Flush();
+        }
+        // The kernel may still write into the buffers
+        WaitAll();
+    }
+
+    for (Slot& slot : slots) {
+        free(slot.buffer);
+    }
+    slots.clear();
+
+    if (sqEntries != nullptr && sqEntries != MAP_FAILED)
+        munmap(sqEntries, sqEntriesSize);
+    if (cqRing != nullptr && cqRing != MAP_FAILED)
+        munmap(cqRing, cqRingSize);
+    if (sqRing != nullptr && sqRing != MAP_FAILED)
+        munmap(sqRing, sqRingSize);
+    sqEntries = nullptr;
+    cqRing = nullptr;
+    sqRing = nullptr;
+
+    if (ringFd >= 0) {
+        close(ringFd);
+        ringFd = -1;
+    }
+    if (fileFd >= 0) {
+        close(fileFd);
+        fileFd = -1;
+    }
+    return result;
+}
+
+size_t UringFile::Read(uint8_t* target, size_t length)
+{
+    size_t done = 0;
+
+    while (done < length && !endOfFile && !failed) {
+        if (!WaitSlot(current)) {
+            break;
+        }
+
+        Slot& slot = slots[current];
+        if (slot.result < 0) {
+            Logger::GetLogger().Log(LL_ERROR, "Asynchronous read failed");
+            failed = true;
+            break;
+        }
+
+        if (currentUsed < (size_t)slot.result) {
+            size_t count = min((size_t)slot.result - currentUsed, length - done);
+            memcpy(target + done, slot.buffer + currentUsed, count);
+            done += count;
+            currentUsed += count;
+        }
+
+        if (currentUsed >= (size_t)slot.result) {
+            // Only the block at the end of the file is short
+            if ((size_t)slot.result < slot.length) {
+                endOfFile = true;
+                break;
+            }
+
+            // Consumed, reuse the buffer for the block behind the read-ahead
+            if (!Submit(current, nextOffset, bufferSize)) {
+                break;
+            }
+            nextOffset += bufferSize;
+            current = (current + 1) % slots.size();
+            currentUsed = 0;
+        }
+    }
+
+    return done;
+}
+
+int UringFile::Seek(uint64_t offset)
+{
+    // Forward within the read-ahead, the blocks in front are recycled without waiting for all
+    if (!failed && !slots.empty() && offset >= slots[current].offset + currentUsed && offset < nextOffset) {
+        while (offset >= slots[current].offset + bufferSize) {
+            if (!WaitSlot(current) || !Submit(current, nextOffset, bufferSize)) {
+                return -1;
+            }
+            nextOffset += bufferSize;
+            current = (current + 1) % slots.size();
+        }
+        currentUsed = (size_t)(offset - slots[current].offset);
+        endOfFile = false;
+        return 0;
+    }
+
+    if (!WaitAll()) {
+        return -1;
+    }
+
+    current = 0;
+    currentUsed = 0;
+    endOfFile = false;
+    nextOffset = offset;
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (!Submit(i, nextOffset, bufferSize)) {
+            return -1;
+        }
+        nextOffset += bufferSize;
+    }
+    return 0;
+}
+
+int UringFile::Write(const uint8_t* data, size_t length)
+{
+    while (length > 0) {
+        if (failed) {
+            return -1;
+        }
+
+        size_t count = min(length, bufferSize - currentUsed);
+        memcpy(slots[current].buffer + currentUsed, data, count);
+        data += count;
+        length -= count;
+        currentUsed += count;
+
+        if (currentUsed == bufferSize) {
+            // Write the full buffer behind and continue in the next one once it is done
+            if (!Submit(current, nextOffset, currentUsed)) {
+                return -1;
+            }
+            nextOffset += currentUsed;
+            current = (current + 1) % slots.size();
+            currentUsed = 0;
+            if (!WaitSlot(current)) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+uint8_t* UringFile::Reserve(size_t length)
+{
+    if (currentUsed + length > bufferSize) {
+        // Write the filled part behind, the room starts in the next buffer
+        if (Submit(current, nextOffset, currentUsed)) {
+            nextOffset += currentUsed;
+            current = (current + 1) % slots.size();
+            currentUsed = 0;
+            WaitSlot(current);
+        }
+        if (failed) {
+            currentUsed = 0;
+        }
+    }
+
+    uint8_t* room = slots[current].buffer + currentUsed;
+    currentUsed += length;
+    return room;
+}
+
+int UringFile::Preallocate(uint64_t size)
+{
+    return (fallocate(fileFd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size) == 0) ? 0 : -1;
+}
+
+int UringFile::Flush()
+{
+    if (currentUsed > 0 && !failed) {
+        if (Submit(current, nextOffset, currentUsed)) {
+            nextOffset += currentUsed;
+            current = (current + 1) % slots.size();
+            currentUsed = 0;
+        }
+    }
+    if (!WaitAll() || failed) {
+        return -1;
+    }
+    return 0;
+}
+
+void UringFile::SetWriteOffset(uint64_t offset)
+{
+    nextOffset = offset;
+}
+
+#else
+
+// Without io_uring every open fails and the callers stay on their stream path
+
+int UringFile::OpenRead(const char* fileName, unsigned int queueDepth, size_t bufferSize)
+{
+    return -1;
+}
+
+int UringFile::OpenWrite(const char* fileName, unsigned int queueDepth, size_t bufferSize)
+{
+    return -1;
+}
+
+int UringFile::Close()
+{
+    return 0;
+}
+
+size_t UringFile::Read(uint8_t* target, size_t length)
+{
+    return 0;
+}
+
+int UringFile::Seek(uint64_t offset)
+{
+    return -1;
+}
+
+int UringFile::Write(const uint8_t* data, size_t length)
+{
+    return -1;
+}
+
+uint8_t* UringFile::Reserve(size_t length)
+{
+    return nullptr;
+}
+
+int UringFile::Preallocate(uint64_t size)
+{
+    return -1;
+}
+
+int UringFile::Flush()
+{
+    return 0;
+}
+
+void UringFile::SetWriteOffset(uint64_t offset)
+{
+    nextOffset = offset;
+}
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PCAPSORTER_IO_URING
+#endif
+#endif
+
+/**
+ * Sequential file I/O through a Linux io_uring with several large buffers in
+ * flight. Reading keeps queueDepth blocks ahead of the consumer, writing lets
+ * up to queueDepth filled blocks complete in the background. Open fails if
+ * io_uring is not available (other OS, old kernel, blocked by seccomp), the
+ * caller then uses its stream path.
+ */
+class UringFile
+{
+private:
+    struct Slot {
+        uint8_t*    buffer;
+        uint64_t    offset;     // File offset of the block
+        size_t      length;     // Bytes submitted
+        int32_t     result;     // Bytes transferred or -errno
+        bool        busy;       // Submitted, completion not reaped yet
+    };
+
+    int             ringFd;
+    int             fileFd;
+    bool            forWrite;
+    bool            failed;
+    vector<Slot>    slots;
+    size_t          bufferSize;
+    size_t          current;        // Slot which is consumed (read) or filled (write)
+    size_t          currentUsed;    // Bytes of the current slot consumed or filled
+    uint64_t        nextOffset;     // Read: offset of the next block to submit. Write: offset of the current slot
+    bool            endOfFile;
+
+    // Mapped rings
+    void*           sqRing;
+    size_t          sqRingSize;
+    void*           cqRing;
+    size_t          cqRingSize;
+    void*           sqEntries;
+    size_t          sqEntriesSize;
+    unsigned*       sqTail;
+    unsigned*       sqMask;
+    unsigned*       sqArray;
+    unsigned*       cqHead;
+    unsigned*       cqTail;
+    unsigned*       cqMask;
+    void*           cqEntries;
+
+    int Setup(unsigned int queueDepth, size_t bufferSize);
+    bool Submit(size_t slot, uint64_t offset, size_t length);
+    bool Reap(bool wait);
+    bool WaitSlot(size_t slot);
+    bool WaitAll();
+
+public:
+    UringFile(void);
+    virtual ~UringFile(void);
+
+    int OpenRead(const char* fileName, unsigned int queueDepth, size_t bufferSize);
+    int OpenWrite(const char* fileName, unsigned int queueDepth, size_t bufferSize);
+    int Close();
+
+    bool IsOpen() const {
+        return fileFd >= 0;
+    }
+
+    // Sequential read, returns less than length only at the end of the file
+    size_t Read(uint8_t* target, size_t length);
+    // Drops the read-ahead and continues reading at offset
+    int Seek(uint64_t offset);
+
+    int Write(const uint8_t* data, size_t length);
+    // Room for length bytes (at most the buffer size) at the end of the output,
+    // valid until the next call
+    uint8_t* Reserve(size_t length);
+    // Reserves the disk space of a file of the expected size up front
+    int Preallocate(uint64_t size);
+    // Waits until everything written so far is in the file
+    int Flush();
+    // Write position. Only change it after Flush, e.g. to skip a range copied by the kernel.
+    uint64_t WriteOffset() const {
+        return nextOffset + currentUsed;
+    }
+    void SetWriteOffset(uint64_t offset);
+
+    // Descriptor of the file, e.g. for copy_file_range behind a Flush
+    int Descriptor() const {
+        return fileFd;
+    }
+};
@@ -0,0 +1,71 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+/**
+ * Lets a thread sleep until another one changed a state it waits for, e.g. a
+ * ring which was full or empty. The state lives in atomics of the caller and
+ * changes before Notify. Wait spins shortly before it sleeps, Notify only takes
+ * the lock if a thread sleeps.
+ */
+class WaitEvent
+{
+private:
+    static const int SpinCount = 64;
+
+    mutex               sleepMutex;
+    condition_variable  woken;
+    atomic<int>         sleepers;
+
+public:
+    WaitEvent(void) {
+        sleepers.store(0);
+    }
+
+    // Returns once done() is true. done must not call Notify of the same event.
+    template <typename Predicate>
+    void Wait(Predicate done) {
+        for (int spin = 0; spin < SpinCount; spin++) {
+            if (done())
+                return;
+            this_thread::yield();
+        }
+
+        unique_lock<mutex> lock(sleepMutex);
+        sleepers.fetch_add(1);
+        atomic_thread_fence(memory_order_seq_cst);
+        woken.wait(lock, done);
+        sleepers.fetch_sub(1);
+    }
+
+    void Notify() {
+        // Either the sleeper sees the changed state or the sleeper is seen here
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleepers.load(memory_order_relaxed) > 0) {
+            lock_guard<mutex> lock(sleepMutex);
+            woken.notify_all();
+        }
+    }
+};
@@ -0,0 +1,140 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "WindowBenchmark.h"
+#include "Logger.h"
+#include "PcapPacket.h"
+#include "SortWindow.h"
+#include <chrono>
+#include <list>
+#include <random>
+#include <string>
+#include <vector>
+
+static const uint64_t BenchmarkSeed = 20201114;
+// Share of the packets which arrive late, each by up to half the window
+static const double LateShare = 0.05;
+// Microseconds between two packets, 0 gives packets with equal timestamps
+static const uint32_t MaxGapMicroseconds = 20;
+
+static vector<PcapPacketHdrData> SyntheticPackets(size_t packetCount, size_t windowSize)
+{
+    mt19937_64 random(BenchmarkSeed);
+    uniform_int_distribution<uint32_t> gap(0, MaxGapMicroseconds);
+    uniform_int_distribution<uint64_t> lateness(1, (uint64_t)windowSize / 2 * MaxGapMicroseconds / 2 + 1);
+    bernoulli_distribution late(LateShare);
+    vector<PcapPacketHdrData> packets(packetCount);
+    uint64_t now = 1600000000ULL * 1000000;
+
+    for (size_t i = 0; i < packetCount; i++) {
+        now += gap(random);
+        uint64_t time = late(random) ? now - lateness(random) : now;
+
+        PcapPacketHdrData& packet = packets[i];
+        packet.hdr.timestampSeconds = (uint32_t)(time / 1000000);
+        packet.hdr.timestampMicroSeconds = (uint32_t)(time % 1000000);
+        packet.hdr.packetLength = 0;
+        packet.hdr.originalLength = 0;
+        packet.data = nullptr;
+        packet.record = nullptr;
+        packet.recordLength = 0;
+        packet.chunk = 0;
+        packet.key = PacketSortKey(packet.hdr);
+        packet.sequence = i;
+        packet.interfaceId = 0;
+    }
+    return packets;
+}
+
+// The window of the first versions: newest packet in front, the oldest leaves at the back
+static void SortWithList(const vector<PcapPacketHdrData>& packets, size_t windowSize, vector<uint64_t>& order)
+{
+    list<PcapPacketHdrData> sortWindow;
+
+    for (const PcapPacketHdrData& packet : packets) {
+        list<PcapPacketHdrData>::iterator it;
+        for (it = sortWindow.begin(); it != sortWindow.end(); ++it) {
+            if (it->key <= packet.key)
+                break;
+        }
+        sortWindow.insert(it, packet);
+
+        if (sortWindow.size() >= windowSize) {
+            order.push_back(sortWindow.back().sequence);
+            sortWindow.pop_back();
+        }
+    }
+    while (!sortWindow.empty()) {
+        order.push_back(sortWindow.back().sequence);
+        sortWindow.pop_back();
+    }
+}
+
+static void SortWithHeap(const vector<PcapPacketHdrData>& packets, size_t windowSize, vector<uint64_t>& order)
+{
+    SortWindow sortWindow;
+    sortWindow.Reserve(windowSize);
+
+    for (const PcapPacketHdrData& packet : packets) {
+        sortWindow.Push(packet);
+
+        if (sortWindow.Size() >= windowSize) {
+            order.push_back(sortWindow.Top().sequence);
+            sortWindow.Pop();
+        }
+    }
+    while (!sortWindow.Empty()) {
+        order.push_back(sortWindow.Top().sequence);
+        sortWindow.Pop();
+    }
+}
+
+static void LogTime(const char* name, chrono::steady_clock::duration elapsed, size_t packetCount)
+{
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+    Logger::GetLogger().Log(LL_INFO, (string(name) + to_string(ns / 1000000) + string(" ms, ") + to_string(ns / (long long)packetCount) + string(" ns per packet")).c_str());
+}
+
+bool WindowBenchmark::Run(size_t packetCount, size_t windowSize)
+{
+    vector<PcapPacketHdrData> packets = SyntheticPackets(packetCount, windowSize);
+    vector<uint64_t> listOrder;
+    vector<uint64_t> heapOrder;
+    listOrder.reserve(packetCount);
+    heapOrder.reserve(packetCount);
+
+    Logger::GetLogger().Log(LL_INFO, (string("Sorting ") + to_string(packetCount) + string(" synthetic packets through a window of ") + to_string(windowSize)).c_str());
+
+    auto startTime = chrono::steady_clock::now();
+    SortWithList(packets, windowSize, listOrder);
+    auto listTime = chrono::steady_clock::now() - startTime;
+    LogTime("List window: ", listTime, packetCount);
+
+    startTime = chrono::steady_clock::now();
+    SortWithHeap(packets, windowSize, heapOrder);
+    auto heapTime = chrono::steady_clock::now() - startTime;
+    LogTime("Heap window: ", heapTime, packetCount);
+
+    if (listOrder != heapOrder) {
+        Logger::GetLogger().Log(LL_ERROR, "The windows sorted the packets differently");
+        return false;
+    }
+    if (heapTime.count() > 0) {
+        Logger::GetLogger().Log(LL_INFO, (string("The heap window is faster by a factor of ") + to_string((double)listTime.count() / heapTime.count())).c_str());
+    }
+    return true;
+}
@@ -17,16 +17,19 @@
 
 #pragma once
 
-class Thread {
+#include <cstddef>
 
-private:
-    void* handle;
+using namespace std;
 
+/**
+ * Times the SortWindow against the list of the first versions, which inserted
+ * every packet by a linear scan from the newest one. Both sort the same synthetic
+ * packets, generated from a fixed seed so that runs on different machines compare.
+ */
+class WindowBenchmark
+{
 public:
-    Thread();
-    virtual ~Thread();
-
-    bool Create();
-    virtual bool Run();
-    bool Remove();
-};
\ No newline at end of file
+    // Sorts packetCount packets through a window of windowSize packets with both
+    // windows and logs their times. False if the windows disagree on the order.
+    static bool Run(size_t packetCount, size_t windowSize);
+};
@@ -0,0 +1,107 @@
+/**
+ * Copyright(C) 2020 Florian Hisch
+ *
+ * This program is free software : you can redistribute itand /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+using namespace std;
+
+/**
+ * Bounded Chase-Lev deque of pointers. The owning thread pushes and pops at the
+ * bottom without contention, other threads steal the oldest entries from the top.
+ * Only the last entry is raced for, by one compare and swap.
+ */
+template <typename T>
+class WorkStealingDeque
+{
+private:
+    unique_ptr<atomic<T*>[]> slots;
+    int64_t         mask;
+
+    alignas(64) atomic<int64_t> top;    // Stolen from here
+    alignas(64) atomic<int64_t> bottom; // Owned by one thread
+
+public:
+    WorkStealingDeque(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots.reset(new atomic<T*>[size]);
+        for (size_t i = 0; i < size; i++) {
+            slots[i].store(nullptr, memory_order_relaxed);
+        }
+        mask = (int64_t)size - 1;
+        top.store(0);
+        bottom.store(0);
+    }
+
+    // Owner only. False if the deque is full.
+    bool Push(T* value) {
+        int64_t b = bottom.load(memory_order_relaxed);
+        int64_t t = top.load(memory_order_acquire);
+        if (b - t > mask) {
+            return false;
+        }
+        slots[b & mask].store(value, memory_order_relaxed);
+        bottom.store(b + 1, memory_order_release);  // Publishes the entry to thieves
+        return true;
+    }
+
+    // Owner only. Newest entry or nullptr.
+    T* Pop() {
+        int64_t b = bottom.load(memory_order_relaxed) - 1;
+        bottom.store(b, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        int64_t t = top.load(memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store(b + 1, memory_order_relaxed);
+            return nullptr;
+        }
+
+        T* value = slots[b & mask].load(memory_order_relaxed);
+        if (t == b) {
+            // The last entry, a thief may take it at the same time
+            if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+                value = nullptr;
+            }
+            bottom.store(b + 1, memory_order_relaxed);
+        }
+        return value;
+    }
+
+    // Any thread. Oldest entry or nullptr, also if another thread won the race.
+    T* Steal() {
+        int64_t t = top.load(memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        int64_t b = bottom.load(memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+
+        T* value = slots[t & mask].load(memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            return nullptr;
+        }
+        return value;
+    }
+};